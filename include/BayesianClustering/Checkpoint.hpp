@@ -0,0 +1,117 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+
+class Configuration;
+class EventProxy;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A record of a single cell of an RT-scan, as stored in a checkpoint
+struct ScanCell
+{
+  //! The R-index of the cell
+  uint32_t mRIndex;
+  //! The T-index of the cell
+  uint32_t mTIndex;
+  //! The R of the cell
+  double mR;
+  //! The T of the cell
+  double mT;
+  //! The log-probability density of the clusterization
+  double mLogP;
+  //! The number of clustered data-points
+  uint64_t mClusteredCount;
+  //! The number of background data-points
+  uint64_t mBackgroundCount;
+  //! The number of non-Null clusters
+  uint64_t mClusterCount;
+};
+
+//! Make the record of a cell from the arguments of an RT-scan callback
+//! \param aProxy The event-proxy holding the clusterization of the cell
+//! \param aR     The R of the cell
+//! \param aT     The T of the cell
+//! \param aIJ    The (R-index, T-index) of the cell
+//! \return The record of the cell
+ScanCell MakeScanCell( const EventProxy& aProxy , const double& aR , const double& aT , const std::pair<int,int>& aIJ );
+
+//! A fingerprint of the parts of a configuration which determine the results of an RT-scan, so that a checkpoint is never resumed with a different input or grid
+//! \param aConfiguration The configuration
+//! \return The fingerprint
+uint64_t ScanFingerprint( const Configuration& aConfiguration );
+
+//! Write a file atomically, by writing and syncing a temporary file, then renaming it over the target, so that an interrupted write never leaves a truncated file
+//! \param aFilename The name of the file
+//! \param aWriter   A callback which writes the contents of the file
+void AtomicWrite( const std::string& aFilename , const std::function< void( FILE* ) >& aWriter );
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Periodic checkpointing of the completed rows of an RT-scan, so that a scan interrupted by a walltime limit can be resumed
+//! Only complete rows are written, since the results of a row depend on the order in which its T-bins are scanned and a resumed row must be rescanned in full to be bit-identical
+class ScanCheckpoint
+{
+public:
+  //! Constructor - reads the completed cells from an existing checkpoint if resuming
+  //! \param aConfiguration The configuration of the scan
+  //! \param aCellsPerRow   The number of cells in each row of the scan
+  ScanCheckpoint( const Configuration& aConfiguration , const std::size_t& aCellsPerRow );
+
+  //! Deleted copy constructor
+  ScanCheckpoint( const ScanCheckpoint& aOther /*!< Anonymous argument */ ) = delete;
+
+  //! Deleted assignment operator
+  //! \return Reference to this, for chaining calls
+  ScanCheckpoint& operator = (const ScanCheckpoint& aOther /*!< Anonymous argument */ ) = delete;
+
+  //! Getter for the completed cells
+  //! \return The cells of the completed rows
+  inline const std::vector< ScanCell >& Cells() const { return mCells; }
+
+  //! Whether a row has been completed
+  //! \param aRIndex The R-index of the row
+  //! \return Whether the row has been completed
+  bool RowComplete( const uint32_t& aRIndex ) const;
+
+  //! Record a cell, and write the checkpoint if the interval has elapsed since the last - thread-safe
+  //! \param aCell The cell
+  void Record( const ScanCell& aCell );
+
+  //! Write the checkpoint
+  void Write();
+
+private:
+  //! Write the checkpoint - the mutex must be held
+  void WriteLocked();
+
+  //! The file to which the checkpoint is written
+  std::string mFilename;
+  //! The fingerprint of the configuration of the scan
+  uint64_t mFingerprint;
+  //! The number of cells in each row of the scan
+  std::size_t mCellsPerRow;
+  //! The interval between writes
+  std::chrono::duration< double > mInterval;
+  //! The time of the last write
+  std::chrono::steady_clock::time_point mLastWrite;
+
+  //! The cells of the completed rows
+  std::vector< ScanCell > mCells;
+  //! The R-indices of the completed rows
+  std::vector< bool > mRowComplete;
+  //! The cells of the rows in progress, by R-index
+  std::map< uint32_t , std::vector< ScanCell > > mPending;
+  //! The number of cells completed since the last write
+  std::size_t mUnwritten;
+
+  //! Mutex guarding the cells, since the callbacks come from every scanning thread
+  std::mutex mMutex;
+};
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
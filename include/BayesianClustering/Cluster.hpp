@@ -2,12 +2,15 @@
 
 /* ===== C++ ===== */
 #include <vector>
+#include <memory>
 
 /* ===== Cluster sources ===== */
 #include "BayesianClustering/Precision.hpp"
 
 class Data;
 class EventProxy;
+class Configuration;
+class GSLInterpolator;
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 //! A class representing a cluster
@@ -31,8 +34,9 @@ public:
     double log_score() const;
 
     //! Sean's alternative function to calculate the log-score using only the A's and B's as per the original paper for debugging 
+    //! \param aS2 The weighted sum of the squared residuals of the points from the weighted centre, as accumulated by EventProxy::ValidateLogScore
     //! \return the log-probability of this set of cluster parameters
-    double alt_log_score() const;
+    double alt_log_score( const double& aS2 ) const;
     
     //! Parameter A defined in the math
     PRECISION A;
@@ -44,22 +48,71 @@ public:
     PRECISION C;
     //! Parameter logF defined in the math
     PRECISION logF;
+  }; 
 
+  //! A struct representing the sufficient statistics of the points of a cluster in one uncertainty class, from which the parameters for every sigma hypothesis are reconstructed
+  struct UncertaintyClass
+  {
+    //! Default constructor
+    UncertaintyClass();
 
-    //! Parameters added by Sean for validation
-    PRECISION weightedCentreX;
-    //! Parameters added by Sean for validation
-    PRECISION weightedCentreY;
-    //! Parameters added by Sean for validation
-    PRECISION S2;
-  }; 
+    //! Add another set of sums to this set
+    //! \param aOther Another set of sums to add to this set
+    //! \return Reference to this, for chaining calls
+    UncertaintyClass& operator+= ( const UncertaintyClass& aOther );
+
+    //! The number of points
+    PRECISION N;
+    //! The sum of the x-positions
+    PRECISION X;
+    //! The sum of the y-positions
+    PRECISION Y;
+    //! The sum of the squared radial distances
+    PRECISION R2;
+  };
+
+  //! Scratch space for evaluating the log-score of clusters - each thread evaluating scores must own its own
+  struct Scratch
+  {
+    //! Constructor
+    //! \param aConfiguration The configuration for which the scratch space will be used
+    Scratch( const Configuration& aConfiguration );
+
+    //! Destructor
+    ~Scratch();
+
+    //! Deleted copy constructor
+    Scratch( const Scratch& aOther /*!< Anonymous argument */ ) = delete;
+
+    //! Deleted assignment operator
+    //! \return Reference to this, for chaining calls  
+    Scratch& operator = (const Scratch& aOther /*!< Anonymous argument */ ) = delete;
+
+    //! Default move constructor
+    Scratch( Scratch&& aOther /*!< Anonymous argument */ );
+
+    //! Default move-assignment constructor
+    //! \return Reference to this, for chaining calls  
+    Scratch& operator = ( Scratch&& aOther /*!< Anonymous argument */ );
+
+    //! The normalized integrand, one per sigma hypothesis
+    std::vector< double > mMuIntegral;
+    //! The log of the integrand, one per sigma hypothesis
+    std::vector< double > mIntegralArguments;
+    //! The interpolator used to integrate over sigma
+    std::unique_ptr< GSLInterpolator > mInterpolator;
+    //! The parameters reconstructed from the sums of the uncertainty classes
+    std::vector< Parameter > mParams;
+  };
 
   //! Default constructor
-  Cluster();
+  //! \param aConfiguration The configuration, which determines the number of sigma hypotheses
+  Cluster( const Configuration& aConfiguration );
   
   //! Construct a cluster from a single data-point
   //! \param aData A data-point with which to initialize the cluster
-  Cluster( const Data& aData );
+  //! \param aConfiguration The configuration, which determines the sigma hypotheses
+  Cluster( const Data& aData , const Configuration& aConfiguration );
 
 
   //! Deleted copy constructor
@@ -83,25 +136,50 @@ public:
   //! \return Reference to this, for chaining calls
   Cluster& operator+= ( const Cluster& aOther );
 
+  //! Add a single data-point to this cluster, computing its parameters from its position and uncertainty rather than from a stored proto-cluster
+  //! \param aData          The data-point to add
+  //! \param aConfiguration The configuration, which determines the sigma hypotheses
+  //! \return Reference to this, for chaining calls
+  Cluster& Add( const Data& aData , const Configuration& aConfiguration );
+
+  //! The parameters of the cluster for each sigma hypothesis - reconstructed from the uncertainty classes if the uncertainties are quantized
+  //! \param aConfiguration The configuration, which determines the sigma hypotheses and the uncertainty classes
+  //! \param aBuffer        Space into which the parameters are reconstructed, if needed
+  //! \return Reference to the parameters
+  const std::vector< Parameter >& Parameters( const Configuration& aConfiguration , std::vector< Parameter >& aBuffer ) const;
+
+  //! The log-probability of a cluster
+  //! \param aParams        The parameters of the cluster for each sigma hypothesis
+  //! \param aClusterSize   The number of points in the cluster
+  //! \param aConfiguration The configuration, which determines the sigma hypotheses
+  //! \param aScratch       Scratch space owned by the calling thread
+  //! \return The log-probability
+  static double LogScore( const std::vector< Parameter >& aParams , const std::size_t& aClusterSize , const Configuration& aConfiguration , Scratch& aScratch );
+
   //! Get a pointer to this cluster's ultimate parent
   //! \return A pointer to this cluster's ultimate parent
   Cluster* GetParent();
 
   //! Update log-probability after a scan
-  void UpdateLogScore();
+  //! \param aConfiguration The configuration, which determines the sigma hypotheses
+  //! \param aScratch       Scratch space owned by the calling thread
+  void UpdateLogScore( const Configuration& aConfiguration , Scratch& aScratch );
 
   //! Get the points after clustering
   //! \return Reference to a list of points in the cluster after clustering
   // std::vector< Data* >& GetPoints();
 
 public:
-  //! The collection of parameters, each corresponding to a different sigma hypothesis 
+  //! The collection of parameters, each corresponding to a different sigma hypothesis (empty if the uncertainties are quantized)
   std::vector< Parameter > mParams;
+
+  //! The sums for each uncertainty class (empty unless the uncertainties are quantized)
+  std::vector< UncertaintyClass > mClasses;
   
   //! The number of points in the current cluster
   std::size_t mClusterSize;
   
-  //! The number of points in the cluster on the previous scan iteration
+  //! The number of points in the cluster on the previous scan iteration - the size at which it was last scored, and with which it is counted in the log-probability of its event-proxy
   std::size_t mLastClusterSize;
   
   //! The log-probability of the current cluster
@@ -3,6 +3,7 @@
 /* ===== C++ ===== */
 #include <map>
 #include <vector>
+#include <cmath>
 #include <sstream>
 #include <string>
 #include <functional>
@@ -67,6 +68,19 @@ inline long double StrToDist( const std::string& aStr )
 
 
 
+//! A rectangular region of interest, in physical units
+struct RegionOfInterest
+{
+  //! The x-coordinate of the centre
+  double mCentreX;
+  //! The y-coordinate of the centre
+  double mCentreY;
+  //! The width
+  double mWidthX;
+  //! The height
+  double mWidthY;
+};
+
 //! Class for storing the configuration parameters
 class Configuration
 {
@@ -84,6 +98,25 @@ public:
   //! \param aWidthY The height of the window in physical units
   void SetWidth( const double& aWidthX , const double& aWidthY );
 
+  //! Add a region of interest to the list to be scanned from a single load of the input file
+  //! \param aCentreX The x-coordinate of the centre of the region in physical units
+  //! \param aCentreY The y-coordinate of the centre of the region in physical units
+  //! \param aWidthX  The width of the region in physical units
+  //! \param aWidthY  The height of the region in physical units
+  void AddRegionOfInterest( const double& aCentreX , const double& aCentreY , const double& aWidthX , const double& aWidthY );
+
+  //! The configuration for one of the list of regions of interest, with its centre and width, and with the output and checkpoint files suffixed with its index
+  //! \param aIndex The index of the region in the list
+  //! \return The configuration for the region
+  Configuration ForRegionOfInterest( const std::size_t& aIndex ) const;
+
+  //! Setter for the density map accumulated while the input file is parsed
+  //! \param aFilename  The file to which the map and the candidate RoIs are written (empty for none)
+  //! \param aBinSize   The size of a bin of the map in physical units
+  //! \param aThreshold The fraction of the peak of the smoothed map above which candidate RoIs are found
+  //! \param aScan      Whether the candidate RoIs are scanned, in place of the RoI given by the centre and width
+  void SetDensityMap( const std::string& aFilename , const double& aBinSize , const double& aThreshold , const bool& aScan );
+
   //! Setter for the sigma-bins to be integrated over
   //! \param aSigmacount   The number of sigma bins
   //! \param aSigmaMin     The lowest sigma bin
@@ -91,6 +124,14 @@ public:
   //! \param aInterpolator Function-object to generate the probability of any given sigma
 	void SetSigmaParameters( const std::size_t& aSigmacount , const double& aSigmaMin , const double& aSigmaMax , const std::function< double( const double& ) >& aInterpolator );
 
+  //! Setter for the number of classes into which the uncertainties of the data-points are quantized
+  //! \param aCount The number of classes (0 for no quantization)
+  void SetUncertaintyClasses( const std::size_t& aCount );
+
+  //! Setter for the representatives of the uncertainty classes, from which the table of the weight of each class for each sigma hypothesis is built
+  //! \param aS2 The representative squared uncertainty of each class
+  void SetUncertaintyClassTable( const std::vector< double >& aS2 );
+
   //! Setter for the R bins for the RT scan
   //! \param aRbins    The number of R bins to scan over
   //! \param aMinScanR The lowest value of R to scan
@@ -102,6 +143,39 @@ public:
   //! \param aMaxScanT The largest value of T to scan
   void SetTBins( const std::size_t& aTbins , const double& aMinScanT = 0.0 , const double& aMaxScanT = -1 );
 
+  //! Setter for the spacing of the R bins
+  //! \param aRLog Whether the R bins are logarithmically (rather than linearly) spaced
+  void SetRLogSpacing( const bool& aRLog );
+
+  //! Setter for the adaptive RT-scan parameters
+  //! \param aStride The spacing, in bins, of the coarse grid from which the adaptive scan starts (0 to disable the adaptive scan)
+  //! \param aTop    The number of top-scoring cells around which to refine at each level
+  void SetAdaptive( const std::size_t& aStride , const std::size_t& aTop );
+
+  //! Setter for the prescan parameters
+  //! \param aFraction The fraction of the data-points used in the prescan (0 to disable the prescan)
+  //! \param aMargin   The half-width, in bins, of the window around the best prescan cell to which the full scan is restricted (0 for automatic)
+  void SetPrescan( const double& aFraction , const std::size_t& aMargin );
+
+  //! Setter for the checkpointing of the RT-scan
+  //! \param aFilename The file to which the completed rows of the RT-scan are checkpointed
+  //! \param aInterval The interval between checkpoints in seconds
+  //! \param aEvent    Whether the preprocessed event is also saved
+  //! \param aResume   Whether to resume from an existing checkpoint
+  void SetCheckpoint( const std::string& aFilename , const double& aInterval , const bool& aEvent , const bool& aResume );
+
+  //! Setter for the memory budget, within which the thread count is planned before loading
+  //! \param aMegabytes The memory budget in MB (0 for unlimited)
+  void SetMemoryBudget( const double& aMegabytes );
+
+  //! Setter for whether the parameters of each data-point's proto-cluster are computed on the fly during clusterization, rather than stored
+  //! \param aOnTheFly Whether to compute the proto-cluster parameters on the fly
+  void SetProtoClustersOnTheFly( const bool& aOnTheFly );
+
+  //! Setter for whether each clusterization first finds the connected components with integer labels alone, then reduces the parameters of the changed components in a separate sweep
+  //! \param aTwoPhase Whether to clusterize in two phases
+  void SetTwoPhaseClusterize( const bool& aTwoPhase );
+
   //! Setter for the P_b parameter
   //! \param aPB    The P_b parameter
 	void SetPb( const double& aPB );
@@ -170,6 +244,20 @@ public:
   //! \return The log-probability of sigma_i
 	inline const double& log_probability_sigma( const std::size_t& i ) const { return mLogProbabilitySigma[i]; }
 
+  //! Getter for the number of uncertainty classes
+  //! \return The number of uncertainty classes (0 for no quantization)
+  inline const std::size_t& uncertaintyClasses() const { return mUncertaintyClasses; }
+  //! Getter for the weight of an uncertainty class for a sigma hypothesis
+  //! \param k The index of the class
+  //! \param i The index of the value of sigma
+  //! \return The weight, 1 / ( s_k^2 + sigma_i^2 )
+  inline const double& classWeight( const std::size_t& k , const std::size_t& i ) const { return mClassWeights[ ( k * mSigmacount ) + i ]; }
+  //! Getter for the log of the weight of an uncertainty class for a sigma hypothesis
+  //! \param k The index of the class
+  //! \param i The index of the value of sigma
+  //! \return The log of the weight
+  inline const double& classLogWeight( const std::size_t& k , const std::size_t& i ) const { return mClassLogWeights[ ( k * mSigmacount ) + i ]; }
+
   //! Getter for the maximum value of R
   //! \return The maximum value of R
 	inline const double& maxR() const { return mMaxR; }
@@ -209,6 +297,45 @@ public:
   //! \return The number of T values to scan
 	inline const std::size_t& Tbins() const { return mTbins; }
 
+  //! Getter for whether the R bins are logarithmically spaced
+  //! \return Whether the R bins are logarithmically spaced
+  inline const bool& RLogSpacing() const { return mRLog; }
+  //! Getter for the value of R at a (possibly fractional) bin index
+  //! \param aIndex The index of the R bin
+  //! \return The value of R 
+  inline double Rvalue( const double& aIndex ) const { return mRLog ? mMinScanR * pow( mMaxScanR / mMinScanR , aIndex / mRbins ) : mMinScanR + ( aIndex * mDR ); }
+  //! Getter for the value of T at a (possibly fractional) bin index - T is scanned from high to low
+  //! \param aIndex The index of the T bin
+  //! \return The value of T
+  inline double Tvalue( const double& aIndex ) const { return mMaxScanT - ( aIndex * mDT ); }
+
+  //! Getter for the spacing, in bins, of the coarse grid of the adaptive scan
+  //! \return The spacing of the coarse grid of the adaptive scan (0 if the adaptive scan is disabled)
+  inline const std::size_t& adaptiveStride() const { return mAdaptiveStride; }
+  //! Getter for the number of top-scoring cells around which the adaptive scan refines
+  //! \return The number of top-scoring cells around which the adaptive scan refines
+  inline const std::size_t& adaptiveTop() const { return mAdaptiveTop; }
+
+  //! Getter for the fraction of the data-points used in the prescan
+  //! \return The fraction of the data-points used in the prescan (0 if the prescan is disabled)
+  inline const double& prescanFraction() const { return mPrescanFraction; }
+  //! Getter for the half-width, in bins, of the window around the best prescan cell
+  //! \return The half-width of the prescan window (0 for automatic)
+  inline const std::size_t& prescanMargin() const { return mPrescanMargin; }
+
+  //! Getter for the checkpoint file
+  //! \return The file to which the completed rows of the RT-scan are checkpointed (empty if checkpointing is disabled)
+  inline const std::string& checkpointFile() const { return mCheckpointFile; }
+  //! Getter for the interval between checkpoints
+  //! \return The interval between checkpoints in seconds
+  inline const double& checkpointInterval() const { return mCheckpointInterval; }
+  //! Getter for whether the preprocessed event is saved with the checkpoint
+  //! \return Whether the preprocessed event is saved with the checkpoint
+  inline const bool& checkpointEvent() const { return mCheckpointEvent; }
+  //! Getter for whether to resume from an existing checkpoint
+  //! \return Whether to resume from an existing checkpoint
+  inline const bool& resume() const { return mResume; }
+
   //! Logarithm of the P_b parameter  
   //! \return Logarithm of the P_b parameter 
 	inline const double& logPb() const { return mLogPb; }
@@ -230,6 +357,18 @@ public:
   //! \return Whether or not to run the validation on the clustering 
 	inline const bool& validate() const { return mValidate; }
 
+  //! Getter for the memory budget
+  //! \return The memory budget in bytes (0 for unlimited)
+  inline const std::size_t& memoryBudget() const { return mMemoryBudget; }
+
+  //! Getter for whether the proto-cluster parameters are computed on the fly
+  //! \return Whether the proto-cluster parameters are computed on the fly
+  inline const bool& protoClustersOnTheFly() const { return mProtoClustersOnTheFly; }
+
+  //! Getter for whether to clusterize in two phases
+  //! \return Whether to clusterize in two phases
+  inline const bool& twoPhaseClusterize() const { return mTwoPhaseClusterize; }
+
 
   //! Getter for the input file 
   //! \return The name of the input event file
@@ -245,6 +384,9 @@ public:
   //! Getter for the T value for a clusterization pass
   //! \return The T value for a clusterization pass
   inline const double& ClusterT() const { return mClusterT; }
+  //! Getter for the list of (R, T) pairs for clusterization passes
+  //! \return The list of (R, T) pairs for clusterization passes
+  inline const std::vector< std::pair< double , double > >& ClusterRT() const { return mClusterRT; }
 
   //! Getter for the x-coordinate of the physical centre
   //! \return The x-coordinate of the physical centre
@@ -265,17 +407,22 @@ public:
   //! \return The height of the ROI window
   double getArea() const { return mArea; }
 
-public:
-  //! A single global copy of the global variables
-  static Configuration Instance;
-
-  //! Getter for the singleton instance
-  //! \return The singleton instance
-  inline static Configuration& getInstance()
-  {
-    return Instance;
-  }
-
+  //! Getter for the list of regions of interest to be scanned from a single load of the input file
+  //! \return The list of regions of interest (empty to scan only the window given by the centre and width)
+  inline const std::vector< RegionOfInterest >& regionsOfInterest() const { return mRegionsOfInterest; }
+
+  //! Getter for the file to which the density map is written
+  //! \return The file to which the density map is written (empty for none)
+  inline const std::string& densityMapFile() const { return mDensityMapFile; }
+  //! Getter for the size of a bin of the density map
+  //! \return The size of a bin of the density map in physical units (0 if the map is disabled)
+  inline const double& densityBinSize() const { return mDensityBinSize; }
+  //! Getter for the threshold for candidate RoIs
+  //! \return The fraction of the peak of the smoothed density map above which candidate RoIs are found
+  inline const double& roiThreshold() const { return mRoIThreshold; }
+  //! Getter for whether the candidate RoIs are scanned
+  //! \return Whether the candidate RoIs are scanned, in place of the RoI given by the centre and width
+  inline const bool& autoRoI() const { return mAutoRoI; }
 
 private:
   //! The x-coordinate of the centre of the window in physical units
@@ -289,6 +436,16 @@ private:
   double mWidthY;
   //! The area of the window in physical units 
   double mArea;
+  //! The list of regions of interest to be scanned from a single load of the input file
+  std::vector< RegionOfInterest > mRegionsOfInterest;
+  //! The file to which the density map is written
+  std::string mDensityMapFile;
+  //! The size of a bin of the density map
+  double mDensityBinSize;
+  //! The fraction of the peak of the smoothed density map above which candidate RoIs are found
+  double mRoIThreshold;
+  //! Whether the candidate RoIs are scanned
+  bool mAutoRoI;
 
   //! The number of sigma bins
 	std::size_t mSigmacount;
@@ -303,6 +460,13 @@ private:
   //! The log-probability of a gievn sigma
   std::vector< double > mLogProbabilitySigma;
 
+  //! The number of uncertainty classes
+  std::size_t mUncertaintyClasses;
+  //! The weight of each uncertainty class for each sigma hypothesis, class-major
+  std::vector< double > mClassWeights;
+  //! The log of the weight of each uncertainty class for each sigma hypothesis, class-major
+  std::vector< double > mClassLogWeights;
+
   //! The maximum value of R
 	double mMaxR;
   //! The maximum value of R squared
@@ -328,6 +492,27 @@ private:
 	std::size_t mRbins;
   //! The number of T values to scan 
 	std::size_t mTbins;
+  //! Whether the R bins are logarithmically spaced
+  bool mRLog;
+
+  //! The spacing, in bins, of the coarse grid of the adaptive scan
+  std::size_t mAdaptiveStride;
+  //! The number of top-scoring cells around which the adaptive scan refines
+  std::size_t mAdaptiveTop;
+
+  //! The fraction of the data-points used in the prescan
+  double mPrescanFraction;
+  //! The half-width, in bins, of the window around the best prescan cell
+  std::size_t mPrescanMargin;
+
+  //! The file to which the completed rows of the RT-scan are checkpointed
+  std::string mCheckpointFile;
+  //! The interval between checkpoints in seconds
+  double mCheckpointInterval;
+  //! Whether the preprocessed event is saved with the checkpoint
+  bool mCheckpointEvent;
+  //! Whether to resume from an existing checkpoint
+  bool mResume;
 
   //! The alpha parameter
 	double mAlpha;
@@ -344,6 +529,15 @@ private:
   //! Whether or not to run the validation on the clustering 
 	bool mValidate;
 
+  //! The memory budget in bytes (0 for unlimited)
+  std::size_t mMemoryBudget;
+
+  //! Whether the proto-cluster parameters are computed on the fly
+  bool mProtoClustersOnTheFly;
+
+  //! Whether to clusterize in two phases
+  bool mTwoPhaseClusterize;
+
   //! The input event file
   std::string mInputFile;
 
@@ -354,4 +548,6 @@ private:
   double mClusterR;
   //! The value of T for clustering
   double mClusterT;
+  //! A list of (R, T) pairs for clustering
+  std::vector< std::pair< double , double > > mClusterRT;
 };
@@ -3,11 +3,13 @@
 /* ===== C++ ===== */
 #include <math.h>
 #include <vector>
+#include <cstdint>
 
 /* ===== Cluster sources ===== */
 #include "BayesianClustering/Precision.hpp"
 
 class Cluster;
+class Configuration;
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 //! A class to store the raw data-points
@@ -70,22 +72,26 @@ public:
    return fabs( phi - aOther.phi );
   }
 
-  //! All the necessary pre-processing to get this data-point ready for an RT-scan
+  //! All the necessary pre-processing to get this data-point ready for an RT-scan - any existing neighbour list is rebuilt
   //! \param aData  The collection of data-points 
   //! \param aIndex The index of the current data-point
-  void Preprocess( std::vector<Data>& aData , const std::size_t& aIndex );
+  //! \param aMax2R The distance out to which neighbours are listed
+  //! \param aConfiguration The configuration of the event being preprocessed
+  void Preprocess( std::vector<Data>& aData , const std::size_t& aIndex , const double& aMax2R , const Configuration& aConfiguration );
 
   //! Calculate the localization score from the local neighbourhood
   //! \todo Remind myself how this works and what the difference is with below
   //! \param aData ?
-  void PreprocessLocalizationScores( std::vector<Data>& aData );
+  //! \param aConfiguration The configuration of the event being preprocessed
+  void PreprocessLocalizationScores( std::vector<Data>& aData , const Configuration& aConfiguration );
 
   //! Calculate the localization score from the local neighbourhood
   //! \todo Remind myself how this works and what the difference is with above
   //! \param aData ?
   //! \param R ?  
+  //! \param aConfiguration The configuration of the event
   //! \return The localization score
-  PRECISION CalculateLocalizationScore( const std::vector<Data>& aData , const double& R ) const;
+  PRECISION CalculateLocalizationScore( const std::vector<Data>& aData , const double& R , const Configuration& aConfiguration ) const;
 
 public:
   //! The x-position of the data-point
@@ -106,6 +112,8 @@ public:
   std::vector< std::pair< PRECISION , std::size_t > > mNeighbours;
   //! A cluster containing only this data-point 
   Cluster* mProtoCluster;  
+  //! The class into which the uncertainty of the data-point is quantized, if the uncertainties are quantized
+  uint32_t mUncertaintyClass;
 };
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
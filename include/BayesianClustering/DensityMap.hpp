@@ -0,0 +1,80 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Configuration.hpp"
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A coarse 2-D histogram of the localizations of a whole file, accumulated while it is parsed, from which dense candidate RoIs can be found
+//! The histogram grows to cover whatever is filled, so neither the extent nor the origin of the acquisition need be known in advance
+class DensityMap
+{
+public:
+  //! Constructor
+  //! \param aBinSize The size of a (square) bin in physical units (0 for a disabled map, which ignores every fill)
+  DensityMap( const double& aBinSize = 0 );
+
+  //! Whether the map is enabled
+  //! \return Whether the map is enabled
+  inline bool Enabled() const { return mBinSize > 0; }
+
+  //! Add a localization to the map
+  //! \param aX The x-position in physical units
+  //! \param aY The y-position in physical units
+  inline void Fill( const double& aX , const double& aY )
+  {
+    if( !Enabled() ) return;
+    const long lX( long( floor( aX / mBinSize ) ) - mX0 ) , lY( long( floor( aY / mBinSize ) ) - mY0 );
+    if( lX < 0 or lY < 0 or lX >= long( mColumns ) or lY >= long( mRows ) ) return GrowAndFill( lX + mX0 , lY + mY0 );
+    ++mCounts[ ( lY * mColumns ) + lX ];
+    ++mEntries;
+  }
+
+  //! Add the counts of another map, with the same bin size, to this one
+  //! \param aOther The other map
+  void Merge( const DensityMap& aOther );
+
+  //! Find the candidate RoIs - the bounding boxes of the connected regions in which the map, smoothed over a few bins, exceeds a fraction of its peak
+  //! \param aThreshold The fraction of the peak of the smoothed map
+  //! \return The candidate RoIs, in descending order of the number of localizations within them
+  std::vector< RegionOfInterest > Candidates( const double& aThreshold ) const;
+
+  //! Write the map, preceded by the candidate RoIs as comments, as comma-delimited rows of counts (one row per bin in y, from the lowest)
+  //! \param aFilename   The name of the file
+  //! \param aCandidates The candidate RoIs
+  void Write( const std::string& aFilename , const std::vector< RegionOfInterest >& aCandidates ) const;
+
+  //! The number of localizations in the map
+  //! \return The number of localizations
+  inline const std::size_t& Entries() const { return mEntries; }
+
+private:
+  //! Grow the map to cover a bin, then fill it
+  //! \param aX The absolute x-index of the bin
+  //! \param aY The absolute y-index of the bin
+  void GrowAndFill( const long& aX , const long& aY );
+
+  //! Resize the map to cover a range of absolute bin indices, preserving the counts
+  //! \param aX0 The lowest absolute x-index
+  //! \param aY0 The lowest absolute y-index
+  //! \param aX1 One past the highest absolute x-index
+  //! \param aY1 One past the highest absolute y-index
+  void Resize( const long& aX0 , const long& aY0 , const long& aX1 , const long& aY1 );
+
+  //! The size of a bin in physical units
+  double mBinSize;
+  //! The absolute indices of the lowest bin of the map
+  long mX0 , mY0;
+  //! The number of bins in x and y
+  std::size_t mColumns , mRows;
+  //! The counts, row-major in y then x
+  std::vector< uint32_t > mCounts;
+  //! The number of localizations in the map
+  std::size_t mEntries;
+};
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -2,13 +2,64 @@
 
 /* ===== C++ ===== */
 #include <vector>
+#include <map>
 #include <functional>
 #include <string>
+#include <cstdint>
 
 /* ===== Cluster sources ===== */
 #include "BayesianClustering/Data.hpp"
+#include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Memory.hpp"
+#include "BayesianClustering/DensityMap.hpp"
 
 class EventProxy;
+class LocalizationStore;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A record of a single cell evaluated by an adaptive RT-scan
+struct AdaptiveScanCell
+{
+  //! The R of the cell
+  double mR;
+  //! The T of the cell
+  double mT;
+  //! The log-probability density of the clusterization
+  double mLogP;
+  //! The number of clustered data-points
+  std::size_t mClusteredCount;
+  //! The number of background data-points
+  std::size_t mBackgroundCount;
+  //! The number of non-Null clusters
+  std::size_t mClusterCount;
+  //! The refinement level at which the cell was evaluated (0 is the coarse grid)
+  uint32_t mLevel;
+};
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A rectangular window of the RT grid, as inclusive ranges of bin indices
+struct RTWindow
+{
+  //! The lowest R-index in the window
+  int mRLo;
+  //! The highest R-index in the window
+  int mRHi;
+  //! The lowest T-index in the window
+  int mTLo;
+  //! The highest T-index in the window
+  int mTHi;
+
+  //! Whether a cell lies on an edge of the window which has been narrowed (i.e. is not also an edge of the full grid)
+  //! \param aCell    The (R-index, T-index) of the cell
+  //! \param aRbins   The number of R bins in the full grid
+  //! \param aTbins   The number of T bins in the full grid
+  //! \return Whether the cell lies on a narrowed edge of the window
+  inline bool OnNarrowedEdge( const std::pair<int,int>& aCell , const int& aRbins , const int& aTbins ) const
+  {
+    return ( aCell.first  == mRLo and mRLo > 0 ) or ( aCell.first  == mRHi and mRHi < aRbins-1 ) 
+        or ( aCell.second == mTLo and mTLo > 0 ) or ( aCell.second == mTHi and mTHi < aTbins-1 );
+  }
+};
 
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -16,8 +67,29 @@ class EventProxy;
 class Event
 {
 public:
-  //! Default Constructor
-  Event();  
+  //! Constructor - loads the input file given in the configuration
+  //! \param aConfiguration The configuration, of which the event keeps its own immutable copy
+  Event( const Configuration& aConfiguration );  
+
+  //! Constructor from contiguous in-memory buffers - the data-points are cropped to the RoI and sorted by radius, as for an input file
+  //! \param aConfiguration The configuration, of which the event keeps its own immutable copy
+  //! \param aX     Pointer to the x-positions of the data-points in physical units
+  //! \param aY     Pointer to the y-positions of the data-points in physical units
+  //! \param aS     Pointer to the uncertainties of the data-points in physical units
+  //! \param aCount The number of data-points in each buffer
+  Event( const Configuration& aConfiguration , const double* aX , const double* aY , const double* aS , const std::size_t& aCount );
+
+  //! Constructor from in-memory vectors - the data-points are cropped to the RoI and sorted by radius, as for an input file
+  //! \param aConfiguration The configuration, of which the event keeps its own immutable copy
+  //! \param aX The x-positions of the data-points in physical units
+  //! \param aY The y-positions of the data-points in physical units
+  //! \param aS The uncertainties of the data-points in physical units
+  Event( const Configuration& aConfiguration , const std::vector< double >& aX , const std::vector< double >& aY , const std::vector< double >& aS );
+
+  //! Constructor from a store of the localizations of a whole file - the data-points in the RoI of the configuration are cropped from the store, recentred and sorted by radius
+  //! \param aConfiguration The configuration, of which the event keeps its own immutable copy
+  //! \param aStore         The store, which may be shared by the events for any number of RoIs
+  Event( const Configuration& aConfiguration , const LocalizationStore& aStore );
 
   //! Deleted copy constructor
   Event( const Event& aOther /*!< Anonymous argument */ ) = delete;
@@ -33,14 +105,52 @@ public:
   //! \return Reference to this, for chaining calls
   Event& operator= ( Event&& aOther /*!< Anonymous argument */ ) = default;
 
-  //! All the necessary pre-processing to get the event ready for an RT-scan
+  //! All the necessary pre-processing to get the event ready for an RT-scan, out to the maximum R of the configuration
   void Preprocess();
+
+  //! All the necessary pre-processing to get the event ready for clusterization at any R up to a given bound
+  //! The neighbourhoods are cached, so this is a no-op if they were already built for at least this bound
+  //! \param aMaxR The largest R for which the event will be clusterized
+  void Preprocess( const double& aMaxR );
+
+  //! Populate the neighbourhoods and the localization scores ready for an RT-scan (a no-op if already done)
+  void PreprocessScan();
   
   //! Run the scan
   //! \param aCallback A callback for each RT-scan result
-  void ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback  );
+  //! \return The memory held by the event-proxies at the end of the scan, for the caller to record
+  std::size_t ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback  );
+
+  //! Run an adaptive scan, starting from a coarse grid and recursively refining around the top-scoring cells until the resolution of the full RT grid is reached
+  //! \param aCallback    A callback for each RT-scan result
+  //! \param aProxyMemory If given, set to the memory held by the event-proxies at the end of the scan, for the caller to record
+  //! \return The sparse score surface, as a map of (R-index, T-index) to the evaluated cell
+  std::map< std::pair<int,int> , AdaptiveScanCell > AdaptiveScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , std::size_t* aProxyMemory = NULL );
+
+  //! Run the scan over a window of the RT grid
+  //! \param aCallback A callback for each RT-scan result
+  //! \param aWindow   The window of the RT grid to scan
+  //! \return The memory held by the event-proxies at the end of the scan, for the caller to record
+  std::size_t ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const RTWindow& aWindow );
+
+  //! Run the scan over a sparse subset of the RT grid
+  //! \param aCallback A callback for each RT-scan result
+  //! \param aCells    The cells to scan, as a map of R-index to an ascending list of T-indices
+  //! \return The memory held by the event-proxies at the end of the scan, for the caller to record
+  std::size_t ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const std::map< uint32_t , std::vector< uint32_t > >& aCells );
+
+  //! Run an RT-scan on a stratified random subsample of the event and choose a window of the RT grid around the best cell for the full scan
+  //! \return The window of the RT grid to which the full scan should be restricted
+  RTWindow PrescanRT();
+
+  //! Draw a stratified random subsample of the data-points (one from each of the equal-sized strata in radius)
+  //! \param aFraction The fraction of data-points to draw
+  //! \param aSeed     The seed for the random-number generator
+  //! \return An event containing the subsample
+  Event Subsample( const double& aFraction , const uint32_t& aSeed = 0 ) const;
 
   //! Run clusterization for a specific choice of R and T
+  //! Preprocessing is only rerun if R exceeds the bound for which the event was last preprocessed, so concurrent calls are safe once the event has been preprocessed for the largest R
   //! \param R The R parameter for clusterization
   //! \param T The T parameter for clusterization
   //! \param aCallback A callback for the clusterization results
@@ -54,8 +164,128 @@ public:
   //! \param aFilename The name of the file to which to save   
   void WriteCSV( const std::string& aFilename );
 
+  //! Save the preprocessed state of the event (data-points, neighbourhoods and localization scores) to a binary file, so that a resumed scan need not repeat the preprocessing
+  //! \param aFilename The name of the file to which to save
+  void SaveState( const std::string& aFilename ) const;
+
+  //! Load an event from its preprocessed state saved by SaveState
+  //! \param aConfiguration The configuration, which must match that with which the state was saved
+  //! \param aFilename      The name of the file from which to load
+  //! \return The event, ready for an RT-scan
+  static Event LoadState( const Configuration& aConfiguration , const std::string& aFilename );
+
+  //! Whether the clusterization of an R-bin is unchanged between two T-bins, because no localization score lies between them
+  //! \param aRIndex The index of the R-bin
+  //! \param aFrom   The index of the earlier T-bin
+  //! \param aTo     The index of the later T-bin
+  //! \return Whether the clusterization is unchanged (false if the breakpoints have not been populated)
+  inline bool TUnchanged( const uint32_t& aRIndex , const uint32_t& aFrom , const uint32_t& aTo ) const
+  {
+    if( mTBreakpoints.empty() ) return false;
+    const std::size_t lRow( std::size_t( aRIndex ) * mConfiguration.Tbins() );
+    return mTBreakpoints[ lRow + aFrom ] == mTBreakpoints[ lRow + aTo ];
+  }
+
+  //! The first of the run of consecutive R-bins, sharing every localization score and neighbour edge, to which an R-bin belongs
+  //! All the R-bins in a run have the same clusterization at every T
+  //! \param aRIndex The index of the R-bin
+  //! \return The index of the first R-bin of the run (aRIndex itself if the breakpoints have not been populated)
+  inline uint32_t RRepresentative( const uint32_t& aRIndex ) const
+  {
+    return mRRepresentative.empty() ? aRIndex : mRRepresentative[ aRIndex ];
+  }
+
+  //! The log-gamma of the size of a cluster, from the table populated by the preprocessing
+  //! \param aSize The number of data-points in the cluster, at most the number in the event
+  //! \return lgamma( aSize )
+  inline const double& LogGamma( const std::size_t& aSize ) const
+  {
+    return mLogGamma[ aSize ];
+  }
+
+  //! The log-gamma of alpha plus the number of clustered data-points, from the table populated by the preprocessing
+  //! \param aClustered The number of clustered data-points, at most the number in the event
+  //! \return lgamma( alpha + aClustered )
+  inline const double& LogGammaAlpha( const std::size_t& aClustered ) const
+  {
+    return mLogGammaAlpha[ aClustered ];
+  }
+
+  //! Account the memory held by the event
+  //! \return The memory held by each of the major structures
+  MemoryBreakdown MemoryUsage() const;
+
+  //! Record the memory in use after a stage in the memory log
+  //! Not thread-safe, so only called by the owner of the event - never from within a scan, which may share the event with others
+  //! \param aStage   The name of the stage
+  //! \param aProxies The memory held by any event-proxies alive at the end of the stage
+  void RecordMemory( const std::string& aStage , const std::size_t& aProxies = 0 );
+
+  //! Getter for the configuration of this event
+  //! \return The configuration of this event
+  inline const Configuration& configuration() const
+  {
+    return mConfiguration;
+  }
+
+  //! Getter for the number of threads used by this event
+  //! \return The number of threads used by this event
+  inline const std::size_t& threads() const
+  {
+    return mThreads;
+  }
+
+private:
+  //! Construct an event from a collection of data-points, which must already be sorted by radius
+  //! \param aConfiguration The configuration, of which the event keeps its own copy
+  //! \param aData The data-points
+  Event( const Configuration& aConfiguration , std::vector<Data>&& aData );
+
+  //! Populate the breakpoints of the RT grid at which the clusterization can change, so that an RT-scan can reuse the results of unchanged cells
+  void PreprocessBreakpoints();
+
+  //! Quantize the uncertainties of the data-points into equally-populated classes, if enabled in the configuration, and tabulate the weight of each class for each sigma hypothesis (a no-op if already done)
+  void PreprocessUncertaintyClasses();
+
+  //! Tabulate the log-gamma terms of the log-probability for every count of data-points up to the number in the event (a no-op if already done)
+  void PreprocessLogGammaTables();
+
 public:
   //! The collection of raw data points
   std::vector<Data> mData; 
+
+  //! The memory in use after each stage
+  std::vector< MemorySnapshot > mMemoryLog;
+
+  //! The density map of the whole input file, accumulated while it is parsed if enabled in the configuration
+  DensityMap mDensityMap;
+
+private:
+  //! The configuration with which the event was created
+  Configuration mConfiguration;
+
+  //! The number of threads used by this event, being the concurrency in force on the thread which created it
+  std::size_t mThreads;
+
+  //! The largest R for which the neighbourhoods have been built (negative if they have not)
+  double mPreprocessedR = -1;
+
+  //! Whether the localization scores have been populated
+  bool mLocalizationScoresReady = false;
+
+  //! Whether the uncertainty classes have been assigned
+  bool mUncertaintyClassesReady = false;
+
+  //! For each R-bin, the running count over the T-bins of the data-points joining the inclusion set, indexed by ( R-index * Tbins ) + T-index
+  std::vector< uint32_t > mTBreakpoints;
+
+  //! For each R-bin, the first of the run of consecutive R-bins to which it belongs
+  std::vector< uint32_t > mRRepresentative;
+
+  //! lgamma( n ) for every n up to the number of data-points
+  std::vector< double > mLogGamma;
+
+  //! lgamma( alpha + n ) for every n up to the number of data-points
+  std::vector< double > mLogGammaAlpha;
 };
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -2,6 +2,7 @@
 
 /* ===== C++ ===== */
 #include <vector>
+#include <map>
 #include <functional>
 #include <cstdint>
 
@@ -10,6 +11,7 @@
 #include "BayesianClustering/DataProxy.hpp"
 
 class Event;
+class Configuration;
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 //! A lightweight wrapper for the event to store clusters for a given scan
@@ -39,24 +41,66 @@ public:
   //! \param T The T of the last run scan  
   void CheckClusterization( const double& R , const double& T );
   
-  //! Run an RT-scan
+  //! Run an RT-scan - runs of R-bins with identical clusterizations are scanned once, and the results emitted for each
   //! \param aCallback        A callback for each RT-scan result
   //! \param aParallelization The stride with which we will iterate across RT parameters
   //! \param aOffset          The starting point for the strides as we iterate across RT parameters
   void ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const uint8_t& aParallelization = 1 , const uint8_t& aOffset = 0 );
 
+  //! Run an RT-scan over a sparse subset of the RT grid
+  //! \param aCallback        A callback for each RT-scan result
+  //! \param aCells           The cells to scan, as a map of R-index to an ascending list of T-indices
+  //! \param aParallelization The stride with which we will iterate across R rows
+  //! \param aOffset          The starting point for the strides as we iterate across R rows
+  void ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const std::map< uint32_t , std::vector< uint32_t > >& aCells , const uint8_t& aParallelization = 1 , const uint8_t& aOffset = 0 );
+
+  //! Run the T-scan for a single R-bin - the results of a T-bin at which the inclusion set is unchanged are reused rather than reevaluated
+  //! \param aCallback   A callback for each RT-scan result
+  //! \param aRIndex     The index of the R-bin
+  //! \param aTIndices   An ascending list of the indices of the T-bins to scan (T is scanned from high to low)
+  //! \param aDuplicates The indices of any other R-bins with identical clusterizations, for which the results are emitted too
+  void ScanT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const uint32_t& aRIndex , const std::vector< uint32_t >& aTIndices , const std::vector< uint32_t >& aDuplicates = {} );
+
   //! Run clusterization for a specific choice of R and T
   //! \param R The R parameter for clusterization
   //! \param T The T parameter for clusterization
   //! \param aCallback A callback for the clusterization results
   void Clusterize( const double& R , const double& T , const std::function< void( const EventProxy& ) >& aCallback );
 
-  //! Update log-probability after a scan
-  void UpdateLogScore();
+  //! Update the log-probability after a clusterization - only the clusters recorded as changed are rescored, and their contributions to the running sums replaced
+  //! \param aParallel Whether to rescore the changed clusters across all threads
+  void UpdateLogScore( const bool& aParallel = false );
+
+  //! Release the clusters, and reset the log-probability and its running sums to those of no clusters
+  void ClearClusters();
+
+  //! Release the clusters and return every data-point to unclustered, ready to clusterize a row of the RT-scan from scratch
+  void ResetClusterization();
+
+  //! Include the data-points whose localization score for an R-bin reaches T, and grow the clusterization to take them in - the clusterization must be reset, or that of the same R-bin at a higher T
+  //! \param aRIndex The index of the R-bin
+  //! \param T       The T parameter for clusterization
+  //! \param a2R2    The clusterization radius
+  void GrowClusterization( const uint32_t& aRIndex , const double& T , const double& a2R2 );
+
+  //! Get the configuration of the underlying event
+  //! \return The configuration of the underlying event
+  inline const Configuration& configuration() const
+  {
+    return mConfiguration;
+  }
 
   //! Sean's validation code for testing when the running log-score fails
   void ValidateLogScore();
 
+  //! The error in the log-probability of the current clusterization due to the quantization of the uncertainties into classes, found by rescoring every cluster from the exact uncertainties of its points
+  //! \return The exact log-probability less the quantized one (0 if the uncertainties are not quantized)
+  double QuantizationError() const;
+
+  //! Account the memory held by the proxy, including the clusters at their most numerous
+  //! \return The memory in bytes
+  std::size_t MemoryUsage() const;
+
   //! Get the proxy for the Nth neighbour of this data-point
   //! \return A reference to the neighbour data-proxy
   //! \param aIndex The index of the neighbour we are looking for 
@@ -72,6 +116,9 @@ public:
   //! The collection of clusters found by this scan
   std::vector< Cluster > mClusters;
 
+  //! The clusters created, grown or absorbed since the log-probability was last updated
+  std::vector< Cluster* > mChangedClusters;
+
   //! The number of clustered data-points
   std::size_t mClusteredCount;
   
@@ -84,10 +131,67 @@ public:
   //! The log-probability density associated with the last scan
   double mLogP;
 
+  //! The largest number of clusters held at once
+  std::size_t mPeakClusters = 0;
+
+  //! The number of cells of the RT-scans whose results were reused rather than reevaluated
+  std::size_t mSkippedCells = 0;
+
 private:
+  //! Run the T-scan for a single R-bin, with the validation of each clusterization fixed at compile-time
+  //! \tparam tValidate  Whether to check the clusterization and the log-score of each cell
+  //! \param aCallback   A callback for each RT-scan result
+  //! \param aRIndex     The index of the R-bin
+  //! \param aTIndices   An ascending list of the indices of the T-bins to scan (T is scanned from high to low)
+  //! \param aDuplicates The indices of any other R-bins with identical clusterizations, for which the results are emitted too
+  template< bool tValidate >
+  void ScanT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const uint32_t& aRIndex , const std::vector< uint32_t >& aTIndices , const std::vector< uint32_t >& aDuplicates );
+
+  //! Clusterize the data-points included since the last call in two phases - the connected components are first found with integer labels alone, then the parameters of each component whose membership changed are reduced in a single sweep grouped by label
+  //! \param a2R2 The clusterization radius
+  void ClusterizeTwoPhase( const PRECISION& a2R2 );
+
+  //! Find the root of the label of a data-point, halving the path as we go
+  //! \param aIndex The index of the data-point
+  //! \return The index of the root data-point of its component
+  uint32_t FindLabel( uint32_t aIndex );
+
+  //! Reset the state of the two-phase clusterization, so that every data-point is unlabelled
+  void ResetLabels();
+
+  //! Clusterize the included data-points from scratch across all threads, with results identical to the serial clusterization
+  //! The connected components are found with a lock-free union-find in which the lower index always becomes the root, so that the root of each component is the data-point from which the serial clusterization would start it
+  //! Each component is then accumulated, in parallel with the others, by the same traversal from its root as the serial clusterization, so that its parameters are summed in the same order
+  //! \param a2R2 The clusterization radius
+  void ClusterizeParallel( const PRECISION& a2R2 );
+
+  //! Evaluate the log-scores of the changed clusters across all threads, each with its own scratch space, so that UpdateLogScore need only sum them
+  void ScoreClustersParallel();
+
   //! The underlying event this is a proxy to
   const Event& mEvent;
 
+  //! The configuration of the underlying event
+  const Configuration& mConfiguration;
+
+  //! Scratch space for evaluating cluster scores, owned by this proxy so that concurrent proxies never share state
+  Cluster::Scratch mScratch;
+
+  //! The union-find labels of the data-points for the two-phase clusterization, each the index of its parent data-point (NoLabel if not yet included)
+  std::vector< uint32_t > mLabels;
+
+  //! The data-points included by the current step of the two-phase clusterization
+  std::vector< uint32_t > mNewPoints;
+
+  //! The running sum of the log-scores of the non-Null clusters
+  double mClusterScoreSum = 0.0;
+
+  //! The running sum of the log-gamma of the sizes of the non-Null clusters
+  double mLogGammaSum = 0.0;
+
+  //! The members of the components changed by the current step of the two-phase clusterization - the new data-points and the roots of the existing components they join - as pairs of root and member
+  std::vector< std::pair< uint32_t , uint32_t > > mChangedMembers;
+
   // //max score we see in this event wrapper
   // double mMaxRTScore;
 
@@ -0,0 +1,53 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <string>
+#include <cstdint>
+
+class EventProxy;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Dense per-point cluster labels for the results of a clusterization, and the means to export them
+//! The binary format is columnar and, like the checkpoints, in the native byte order of the machine which wrote it: the 8-byte magic "BCLABELS", a uint64 point-count N, then N float64 x-positions [nm], N float64 y-positions [nm], N float64 uncertainties [nm] and N int32 labels
+class ClusterLabels
+{
+public:
+  //! Constructor - assigns dense cluster IDs in order of first appearance in one linear pass over the proxies
+  //! \param aProxy The event-proxy holding the clusterization results, which must outlive this object
+  ClusterLabels( const EventProxy& aProxy );
+
+  //! Deleted copy constructor
+  ClusterLabels( const ClusterLabels& aOther /*!< Anonymous argument */ ) = delete;
+
+  //! Deleted assignment operator
+  //! \return Reference to this, for chaining calls
+  ClusterLabels& operator = (const ClusterLabels& aOther /*!< Anonymous argument */ ) = delete;
+
+  //! Write the labelled localizations to file, as binary if the filename ends ".bin" and as CSV otherwise
+  //! \param aFilename The name of the file to which to write
+  void Write( const std::string& aFilename ) const;
+
+  //! Write the labelled localizations as CSV - chunks of rows are formatted concurrently and written in order
+  //! \param aFilename The name of the file to which to write
+  void WriteCSV( const std::string& aFilename ) const;
+
+  //! Write the labelled localizations in the binary columnar format
+  //! \param aFilename The name of the file to which to write
+  void WriteBinary( const std::string& aFilename ) const;
+
+public:
+  //! The label of each data-point, in event order: a dense cluster ID, or -1 for background
+  std::vector< int32_t > mLabels;
+
+  //! The number of data-points in each cluster, indexed by cluster ID
+  std::vector< std::size_t > mSizes;
+
+  //! The number of background data-points
+  std::size_t mBackgroundCount;
+
+private:
+  //! The event-proxy holding the clusterization results
+  const EventProxy& mProxy;
+};
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
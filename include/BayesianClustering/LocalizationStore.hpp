@@ -0,0 +1,135 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/DensityMap.hpp"
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Parse a chunk of a localization file, applying the cut on the PSF sigma, and pass the position and uncertainty of each localization to a callback
+//! The first (partial) line of the chunk is discarded, since the thread parsing the previous chunk reads past its end to complete it
+//! \tparam tCallback A function-object taking the x- and y-positions and the uncertainty in physical units
+//! \param aFilename The name of the file
+//! \param aOffset   The offset of the chunk in bytes
+//! \param aCount    The length of the chunk in bytes
+//! \param aCallback The callback
+template< typename tCallback >
+void ParseLocalizations( const std::string& aFilename , const std::size_t& aOffset , const std::size_t& aCount , tCallback&& aCallback )
+{
+  auto f = fopen( aFilename.c_str() , "rb");
+  if (fseek(f, aOffset, SEEK_SET)) throw std::runtime_error( "Fseek failed" ); // seek to offset from start_point
+
+  char ch[256];
+  char* lPtr( ch );
+  std::size_t lRead( 0 ); // Counted up, rather than the remaining bytes down, since the last line is read past the end of the chunk
+
+  auto ReadUntil = [ & ]( const char& aChar ){
+    lPtr = ch;
+    while ( ( *lPtr = fgetc(f)) != EOF )
+    {
+      lRead++;
+      if( *lPtr == aChar ) return;
+      lPtr++;
+    }
+  };
+
+  ReadUntil( '\n' ); // Throw away first line, or any partial lines (other thread will handle it)
+  while( lRead < aCount )
+  {
+    ReadUntil( ',' ); //"id"
+    if( *lPtr == EOF ) break;
+    ReadUntil( ',' ); //"frame"
+    ReadUntil( ',' ); //"x [nm]"
+    double x = strtod( ch , &lPtr ) * nanometer;
+    ReadUntil( ',' ); //"y [nm]"
+    double y = strtod( ch , &lPtr ) * nanometer;
+    ReadUntil( ',' ); //"sigma [nm]"
+    double sigma = strtod( ch , &lPtr );
+    ReadUntil( ',' ); //"intensity [photon]"
+    ReadUntil( ',' ); //"offset [photon]"
+    ReadUntil( ',' ); //"bkgstd [photon]"
+    ReadUntil( ',' ); //"chi2"
+    ReadUntil( '\n' ); //"uncertainty_xy [nm]"
+    double s = strtod( ch , &lPtr ) * nanometer;
+    if ( ( sigma < 100 ) or ( sigma  > 300) ) continue;
+    aCallback( x , y , s );
+  }
+
+  fclose(f);
+}
+
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A single localization in physical units, as held by the store
+struct Localization
+{
+  //! The x-position
+  double x;
+  //! The y-position
+  double y;
+  //! The uncertainty
+  double s;
+};
+
+//! The localizations of a whole file, parsed once and indexed on a uniform spatial grid, from which events for any number of RoIs can be cropped
+class LocalizationStore
+{
+public:
+  //! Constructor - parses the whole file in parallel
+  //! \param aFilename       The name of the file to load
+  //! \param aDensityBinSize The size of a bin of the density map accumulated during the parse (0 for none)
+  LocalizationStore( const std::string& aFilename , const double& aDensityBinSize = 0 );
+
+  //! Deleted copy constructor
+  LocalizationStore( const LocalizationStore& aOther /*!< Anonymous argument */ ) = delete;
+
+  //! Deleted assignment operator
+  //! \return Reference to this, for chaining calls
+  LocalizationStore& operator = (const LocalizationStore& aOther /*!< Anonymous argument */ ) = delete;
+
+  //! The contiguous ranges of localizations in the grid cells overlapping a window - every localization in the window lies in one of the ranges, but not every localization in the ranges lies in the window
+  //! \param aCentreX The x-coordinate of the centre of the window in physical units
+  //! \param aCentreY The y-coordinate of the centre of the window in physical units
+  //! \param aWidthX  The width of the window in physical units
+  //! \param aWidthY  The height of the window in physical units
+  //! \return The ranges, as pairs of begin and end indices into mLocalizations
+  std::vector< std::pair< std::size_t , std::size_t > > Ranges( const double& aCentreX , const double& aCentreY , const double& aWidthX , const double& aWidthY ) const;
+
+  //! The memory held by the store
+  //! \return The memory in bytes
+  std::size_t MemoryUsage() const;
+
+public:
+  //! The localizations, ordered by grid cell (row-major in y then x)
+  std::vector< Localization > mLocalizations;
+
+  //! The density map of the localizations, if enabled
+  DensityMap mDensityMap;
+
+private:
+  //! The grid column of an x-position, clamped to the grid
+  //! \param aX The x-position
+  //! \return The column
+  std::size_t Column( const double& aX ) const;
+
+  //! The grid row of a y-position, clamped to the grid
+  //! \param aY The y-position
+  //! \return The row
+  std::size_t Row( const double& aY ) const;
+
+  //! The lower-left corner of the grid
+  double mXLo , mYLo;
+  //! The size of a grid cell
+  double mCellSize;
+  //! The number of grid columns and rows
+  std::size_t mColumns , mRows;
+  //! The index of the first localization in each cell, with a final entry for the end
+  std::vector< std::size_t > mCellStart;
+};
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
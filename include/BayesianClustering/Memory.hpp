@@ -0,0 +1,136 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstddef>
+
+class Configuration;
+class Cluster;
+class LocalizationStore;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! The memory held by the major structures of an event, in bytes
+struct MemoryBreakdown
+{
+  //! The data-points themselves
+  std::size_t mPoints = 0;
+  //! The neighbour lists of the data-points
+  std::size_t mNeighbours = 0;
+  //! The localization scores of the data-points
+  std::size_t mLocalizationScores = 0;
+  //! The single-point proto-clusters
+  std::size_t mProtoClusters = 0;
+  //! The per-thread event-proxies and their clusters
+  std::size_t mProxies = 0;
+
+  //! The sum over the structures
+  //! \return The total in bytes
+  inline std::size_t Total() const { return mPoints + mNeighbours + mLocalizationScores + mProtoClusters + mProxies; }
+};
+
+//! The memory in use after a stage of the processing
+struct MemorySnapshot
+{
+  //! The name of the stage
+  std::string mStage;
+  //! The memory accounted to the major structures
+  MemoryBreakdown mAccounted;
+  //! The resident-set size of the process
+  std::size_t mResident;
+  //! The peak resident-set size of the process so far
+  std::size_t mPeakResident;
+};
+
+//! An estimate, made before loading, of the footprint of an event
+struct MemoryEstimate
+{
+  //! The estimated number of data-points in the RoI
+  std::size_t mPoints = 0;
+  //! The estimated number of data-points in the whole input file, passing the cuts (zero if not estimated from a file)
+  std::size_t mFilePoints = 0;
+  //! The estimated mean number of neighbours within the largest 2R
+  double mMeanNeighbours = 0;
+  //! The estimated memory of the structures shared by all threads (the proxies are zero)
+  MemoryBreakdown mShared;
+  //! The estimated memory of each thread during an RT-scan
+  std::size_t mPerThread = 0;
+
+  //! The estimated total for a given number of threads
+  //! \param aThreads The number of threads
+  //! \return The total in bytes
+  inline std::size_t Total( const std::size_t& aThreads ) const { return mShared.Total() + ( aThreads * mPerThread ); }
+};
+
+//! The memory held by a cluster, beyond its own footprint in a container
+//! \param aCluster The cluster
+//! \return The memory in bytes
+std::size_t ClusterHeapMemory( const Cluster& aCluster );
+
+//! The memory held by the parameters of a cluster - one set per sigma hypothesis, or one set of sums per uncertainty class if the uncertainties are quantized
+//! \param aConfiguration The configuration of the event
+//! \return The memory in bytes
+std::size_t ClusterParameterMemory( const Configuration& aConfiguration );
+
+//! The upper bound on the memory held by an event-proxy during an RT-scan, for which every pair of data-points may form a cluster
+//! \param aPoints        The number of data-points
+//! \param aConfiguration The configuration of the event
+//! \return The memory in bytes
+std::size_t ProxyMemoryBound( const std::size_t& aPoints , const Configuration& aConfiguration );
+
+//! Estimate the footprint of an event from a sample of its data-points
+//! \param aConfiguration The configuration of the event
+//! \param aSample        A sample of the (x, y) positions of the data-points in the RoI, relative to its centre
+//! \param aPoints        The estimated number of data-points in the RoI
+//! \return The estimate
+MemoryEstimate EstimateMemory( const Configuration& aConfiguration , const std::vector< std::pair< double , double > >& aSample , const std::size_t& aPoints );
+
+//! Estimate the footprint of an event from evenly-spaced lines of the input file given in its configuration, without loading it
+//! \param aConfiguration The configuration of the event
+//! \return The estimate
+MemoryEstimate EstimateMemory( const Configuration& aConfiguration );
+
+//! Estimate the footprint of an event from an evenly-spaced sample of in-memory buffers
+//! \param aConfiguration The configuration of the event
+//! \param aX     Pointer to the x-positions of the data-points in physical units
+//! \param aY     Pointer to the y-positions of the data-points in physical units
+//! \param aCount The number of data-points in each buffer
+//! \return The estimate
+MemoryEstimate EstimateMemory( const Configuration& aConfiguration , const double* aX , const double* aY , const std::size_t& aCount );
+
+//! Choose the number of threads so that the estimated footprint fits in a budget
+//! \param aEstimate The estimated footprint
+//! \param aBudget   The budget in bytes
+//! \param aThreads  The number of threads requested
+//! \return The largest number of threads, not exceeding that requested, which fits - throws if even a single thread does not fit
+std::size_t PlanThreads( const MemoryEstimate& aEstimate , const std::size_t& aBudget , const std::size_t& aThreads );
+
+//! Choose the number of threads for an event to be loaded from the input file given in its configuration, so that its estimated footprint fits in the memory budget of the configuration
+//! The concurrency is not changed - the caller decides whether, and for how long, to apply the plan
+//! \param aConfiguration The configuration of the event
+//! \param aThreads       The number of threads requested
+//! \return The number of threads (that requested if there is no budget)
+std::size_t PlanThreads( const Configuration& aConfiguration , const std::size_t& aThreads );
+
+//! Choose the number of threads for an event to be loaded from in-memory buffers, so that its estimated footprint fits in the memory budget of the configuration
+//! \param aConfiguration The configuration of the event
+//! \param aX       Pointer to the x-positions of the data-points in physical units
+//! \param aY       Pointer to the y-positions of the data-points in physical units
+//! \param aCount   The number of data-points in each buffer
+//! \param aThreads The number of threads requested
+//! \return The number of threads (that requested if there is no budget)
+std::size_t PlanThreads( const Configuration& aConfiguration , const double* aX , const double* aY , const std::size_t& aCount , const std::size_t& aThreads );
+
+//! Choose the number of threads for the scan of each RoI of a configuration, cropped from a localization store held throughout, so that the estimated footprint of the largest RoI plus that of the store fits in the memory budget of the configuration
+//! \param aConfiguration The configuration, holding the RoIs
+//! \param aStore         The store if already parsed, or null to estimate its footprint from the input file
+//! \param aThreads       The number of threads requested
+//! \return The number of threads (that requested if there is no budget)
+std::size_t PlanThreads( const Configuration& aConfiguration , const LocalizationStore* aStore , const std::size_t& aThreads );
+
+//! Write the memory in use after each stage, and the peak and steady-state usage, as a table
+//! \param aSnapshots The memory in use after each stage
+//! \param aStream    The stream to which to write
+void WriteMemoryReport( const std::vector< MemorySnapshot >& aSnapshots , std::ostream& aStream );
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
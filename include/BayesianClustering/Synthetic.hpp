@@ -0,0 +1,67 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Configuration.hpp"
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! The parameters of a synthetic SMLM data-set: a uniform background plus Gaussian clusters in a square region of interest
+struct SyntheticParameters
+{
+  //! The total number of localizations
+  std::size_t mPoints = 100000;
+  //! The density of localizations [per square meter] - together with the number of points, this fixes the width of the region of interest
+  double mDensity = 500.0 / ( micrometer * micrometer );
+  //! The fraction of localizations belonging to clusters
+  double mClusterFraction = 0.5;
+  //! The mean number of localizations per cluster
+  double mClusterSize = 50;
+  //! The standard deviation of the localizations about the centre of their cluster [m]
+  double mClusterSpread = 30 * nanometer;
+  //! The mean localization uncertainty [m]
+  double mUncertainty = 20 * nanometer;
+  //! The standard deviation of the localization uncertainty [m]
+  double mUncertaintySpread = 5 * nanometer;
+  //! The seed of the random-number generator
+  uint64_t mSeed = 0;
+
+  //! The width of the square region of interest, which spans [0,width) in both x and y
+  //! \return The width [m]
+  double Width() const;
+};
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A synthetic SMLM data-set, held in the same form as the in-memory constructors of Event expect
+struct SyntheticData
+{
+  //! The x-positions of the localizations [m]
+  std::vector< double > mX;
+  //! The y-positions of the localizations [m]
+  std::vector< double > mY;
+  //! The localization uncertainties [m]
+  std::vector< double > mS;
+  //! The number of clusters generated
+  std::size_t mClusterCount;
+};
+
+//! Generate a synthetic data-set - the output is fully determined by the parameters, including the seed
+//! \param aParameters The parameters of the data-set
+//! \return The localizations
+SyntheticData GenerateSynthetic( const SyntheticParameters& aParameters );
+
+//! Write a synthetic data-set in the ThunderSTORM CSV format read by Event::LoadCSV
+//! \param aFilename The name of the file to which to write
+//! \param aData     The localizations
+void WriteThunderstormCSV( const std::string& aFilename , const SyntheticData& aData );
+
+//! Build a configuration whose region of interest covers a synthetic data-set, with the sigma prior, pb and alpha of the example configuration and an RT-scan over 0-200nm in R and 0-500nm in T
+//! \param aParameters The parameters of the data-set
+//! \param aRbins      The number of R bins
+//! \param aTbins      The number of T bins
+//! \return The configuration
+Configuration SyntheticConfiguration( const SyntheticParameters& aParameters , const std::size_t& aRbins , const std::size_t& aTbins );
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
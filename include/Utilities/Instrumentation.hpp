@@ -0,0 +1,172 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <vector>
+#include <array>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Low-overhead instrumentation: timed spans, counters and histograms, each recorded into storage owned by the recording thread so that nothing is shared on the hot path
+//! Nothing is recorded unless a trace file has been set: stages timed by ProgressBar2 are then recorded, while the INSTRUMENT_* macros used on the hot path are compiled out unless built with -DINSTRUMENTATION (make INSTRUMENT=1)
+namespace Instrumentation
+{
+  //! A timed span on one thread
+  struct Span
+  {
+    //! The ID of the name of the span
+    uint32_t mName;
+    //! An optional argument recorded with the span (e.g. an R-index), or -1
+    int64_t mArg;
+    //! The start of the span [ns since the start of the process]
+    uint64_t mStart;
+    //! The duration of the span [ns]
+    uint64_t mDuration;
+  };
+
+  //! The number of logarithmic buckets in a histogram: bucket 0 counts zeros and bucket i counts values in [2^(i-1), 2^i)
+  constexpr std::size_t HistogramBuckets = 65;
+
+  //! The instrumentation recorded by one thread for one worker
+  struct ThreadRecord
+  {
+    //! The worker for which the thread is recording
+    std::size_t mWorker;
+    //! The spans, in order of completion
+    std::vector< Span > mSpans;
+    //! The counters, indexed by name ID
+    std::vector< uint64_t > mCounters;
+    //! The histograms, indexed by name ID
+    std::vector< std::array< uint64_t , HistogramBuckets > > mHistograms;
+  };
+
+  //! Get the ID of a name, registering it on first use
+  //! \param aName The name
+  //! \return The ID of the name
+  uint32_t Register( const std::string& aName );
+
+  //! The logical worker of the calling thread: one plus the offset or chunk of the parallel operator (|| or &&) whose task it is running, or 0 outside any
+  //! Results are reported per worker rather than per thread, since the operators spin up a fresh thread-pool on every call
+  extern thread_local std::size_t Worker;
+
+  //! Create and register the record of the calling thread for its current worker, first folding any record it holds for another worker into the totals of that worker
+  //! \return The record of the calling thread
+  ThreadRecord& CreateLocal();
+
+  //! The record of each thread, or null before the thread first records
+  extern thread_local ThreadRecord* LocalRecord;
+
+  //! Get the record of the calling thread, creating it on first use or when the thread has moved on to another worker
+  //! \return The record of the calling thread
+  inline ThreadRecord& Local()
+  {
+    if( __builtin_expect( LocalRecord != NULL and LocalRecord->mWorker == Worker , 1 ) ) return *LocalRecord;
+    return CreateLocal();
+  }
+
+  //! Whether a trace file has been set, without which nothing is recorded - so that long-lived processes do not accumulate records which are never written
+  extern std::atomic< bool > Tracing;
+
+  //! Whether anything is being recorded
+  //! \return Whether a trace file has been set
+  inline bool Enabled()
+  {
+    return Tracing.load( std::memory_order_relaxed );
+  }
+
+  //! The time since the start of the process
+  //! \return The time [ns]
+  uint64_t Now();
+
+  //! Add to a counter of the calling thread
+  //! \param aName  The ID of the name of the counter
+  //! \param aValue The value to add
+  inline void Count( const uint32_t& aName , const uint64_t& aValue )
+  {
+    if( !Enabled() ) return;
+    auto& lCounters( Local().mCounters );
+    if( aName >= lCounters.size() ) lCounters.resize( aName + 1 , 0 );
+    lCounters[ aName ] += aValue;
+  }
+
+  //! Add a value to a histogram of the calling thread
+  //! \param aName  The ID of the name of the histogram
+  //! \param aValue The value to add
+  inline void Fill( const uint32_t& aName , const uint64_t& aValue )
+  {
+    if( !Enabled() ) return;
+    auto& lHistograms( Local().mHistograms );
+    if( aName >= lHistograms.size() ) lHistograms.resize( aName + 1 , std::array< uint64_t , HistogramBuckets >{} );
+    ++lHistograms[ aName ][ aValue ? 64 - __builtin_clzll( aValue ) : 0 ];
+  }
+
+  //! A timer which records a span on the calling thread from its construction to its destruction, if a trace file has been set
+  class ScopedTimer
+  {
+  public:
+    //! Constructor
+    //! \param aName The ID of the name of the span
+    //! \param aArg  An optional argument recorded with the span
+    inline ScopedTimer( const uint32_t& aName , const int64_t& aArg = -1 ) : mName( aName ) , mArg( aArg ) , mStart( Now() ) {}
+
+    //! Destructor
+    inline ~ScopedTimer(){ if( Enabled() ) Local().mSpans.push_back( Span{ mName , mArg , mStart , Now() - mStart } ); }
+
+    //! Deleted copy constructor
+    ScopedTimer( const ScopedTimer& aOther /*!< Anonymous argument */ ) = delete;
+
+    //! Deleted assignment operator
+    //! \return Reference to this, for chaining calls
+    ScopedTimer& operator = (const ScopedTimer& aOther /*!< Anonymous argument */ ) = delete;
+
+    //! The elapsed time since construction
+    //! \return The elapsed time [s]
+    inline double Elapsed() const { return ( Now() - mStart ) * 1e-9; }
+
+  private:
+    //! The ID of the name of the span
+    uint32_t mName;
+    //! The argument recorded with the span
+    int64_t mArg;
+    //! The start of the span [ns since the start of the process]
+    uint64_t mStart;
+  };
+
+  //! Set the file to which the Chrome trace-event JSON is written by Finalize, enabling the recording of spans
+  //! \param aFilename The name of the file
+  void SetTraceFile( const std::string& aFilename );
+
+  //! Write everything recorded so far as Chrome trace-event JSON, as read by chrome://tracing or https://ui.perfetto.dev
+  //! \param aFilename The name of the file
+  void WriteChromeTrace( const std::string& aFilename );
+
+  //! Write a summary table of everything recorded so far: per span, the calls, total and maximum time and the spread of the busy-time over workers; per counter, the total and spread over workers; and per histogram, the bucket populations
+  //! \param aStream The stream to which to write
+  void WriteSummary( std::ostream& aStream );
+
+  //! If a trace file has been set, write the trace and print the summary - call only once no other thread is recording
+  void Finalize();
+}
+
+#define INSTRUMENT_CONCATENATE_( a , b ) a##b
+//! Utility macro to paste two tokens after expansion
+#define INSTRUMENT_CONCATENATE( a , b ) INSTRUMENT_CONCATENATE_( a , b )
+
+#ifdef INSTRUMENTATION
+//! Record a span, named by a string literal, over the rest of the enclosing scope, with an optional integer argument
+#define INSTRUMENT_SCOPE( aName , ... ) \
+  static const uint32_t INSTRUMENT_CONCATENATE( lInstrumentName , __LINE__ )( Instrumentation::Register( aName ) ); \
+  Instrumentation::ScopedTimer INSTRUMENT_CONCATENATE( lInstrumentTimer , __LINE__ )( INSTRUMENT_CONCATENATE( lInstrumentName , __LINE__ ) , ##__VA_ARGS__ )
+//! Add to a counter named by a string literal
+#define INSTRUMENT_COUNT( aName , aValue ) do { static const uint32_t lInstrumentName( Instrumentation::Register( aName ) ); Instrumentation::Count( lInstrumentName , aValue ); } while( 0 )
+//! Add a value to a histogram named by a string literal
+#define INSTRUMENT_FILL( aName , aValue ) do { static const uint32_t lInstrumentName( Instrumentation::Register( aName ) ); Instrumentation::Fill( lInstrumentName , aValue ); } while( 0 )
+#else
+#define INSTRUMENT_SCOPE( aName , ... )
+#define INSTRUMENT_COUNT( aName , aValue ) do {} while( 0 )
+#define INSTRUMENT_FILL( aName , aValue ) do {} while( 0 )
+#endif
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
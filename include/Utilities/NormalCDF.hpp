@@ -0,0 +1,23 @@
+#pragma once
+
+/* ===== BOOST libraries ===== */
+#include <boost/math/special_functions/erf.hpp>
+
+/* ===== C++ ===== */
+#include <cmath>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! The cumulative distribution function of a normal distribution
+//! Copied from the CERN ROOT implementaion
+//! Swap ROOT::Math::erfc and ROOT::Math::erf for the boost::math version
+//! \param x     The point at which to evaluate the CDF
+//! \param sigma The standard deviation of the distribution
+//! \param x0    The mean of the distribution
+//! \return The probability of a value below x
+inline double normal_cdf( const double& x, const double& sigma = 1, const double& x0 = 0 )
+{
+  double z = ( x - x0 ) / ( sigma * sqrt(2) );
+  if ( z < -1. ) return 0.5 * boost::math::erfc(-z);
+  else           return 0.5 * ( 1.0 + boost::math::erf(z) );
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "Utilities/Vectorize.hpp"
+
+//! Sort a range in parallel: each of Threads() blocks is sorted concurrently, then neighbouring blocks are merged pairwise in parallel rounds
+//! \tparam tIterator A random-access iterator type
+//! \tparam tCompare  A comparison function-object type
+//! \param  aBegin    The start of the range to sort
+//! \param  aEnd      The end of the range to sort
+//! \param  aCompare  The comparison function-object
+template< typename tIterator , typename tCompare = std::less< typename std::iterator_traits< tIterator >::value_type > >
+inline void ParallelSort( tIterator aBegin , tIterator aEnd , tCompare aCompare = tCompare() )
+{
+  const std::size_t lSize( aEnd - aBegin );
+  const std::size_t lBlocks( std::max( std::size_t( 1 ) , std::min( Threads() , lSize / 1024 ) ) ); // Not worth spinning up threads for tiny blocks
+
+  std::vector< tIterator > lBounds;
+  for( std::size_t i(0) ; i!=lBlocks ; ++i ) lBounds.push_back( aBegin + ( ( i * lSize ) / lBlocks ) );
+  lBounds.push_back( aEnd );
+
+  [&]( const std::size_t& i ){ std::sort( lBounds[i] , lBounds[i+1] , aCompare ); } && range( lBlocks );
+
+  while( lBounds.size() > 2 )
+  {
+    const std::size_t lPairs( ( lBounds.size() - 1 ) / 2 );
+    [&]( const std::size_t& i ){ std::inplace_merge( lBounds[2*i] , lBounds[(2*i)+1] , lBounds[(2*i)+2] , aCompare ); } && range( lPairs );
+
+    std::vector< tIterator > lMerged;
+    for( std::size_t i(0) ; i!=lPairs ; ++i ) lMerged.push_back( lBounds[2*i] );
+    if( lBounds.size() % 2 == 0 ) lMerged.push_back( lBounds[ lBounds.size() - 2 ] ); // An odd number of blocks leaves the last one unpaired
+    lMerged.push_back( lBounds.back() );
+    lBounds.swap( lMerged );
+  }
+}
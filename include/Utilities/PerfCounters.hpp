@@ -0,0 +1,93 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <iostream>
+#include <cstdint>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Optional hardware performance-counter profiling (Linux only), enabled at run-time with --perf-counters
+//! Each thread opens its own counters on first use, and the counts are attributed exclusively to the innermost stage open on that thread
+//! Work posted to a thread-pool is attributed to the stage that was open on the posting thread, so a stage need only be opened where it starts
+//! The open stage is per thread, so concurrent jobs (e.g. in the daemon) each attribute their counts to their own stages
+//! The counts are reported per logical worker (see Instrumentation::Worker), and a thread's counts are folded into those of its worker when it exits
+namespace PerfCounters
+{
+  //! The stages to which counts are attributed
+  enum Stage : int { Load , Preprocess , LocalizationScores , Clusterize , Score , StageCount };
+
+  //! The counters
+  enum Counter : int { TaskClock , Cycles , Instructions , LLCMisses , DTLBMisses , BranchMisses , CounterCount };
+
+  //! The names of the stages
+  extern const char* const StageNames[ StageCount ];
+
+  //! The names of the counters
+  extern const char* const CounterNames[ CounterCount ];
+
+  //! Whether profiling is enabled - set only by Enable, before any stage is opened
+  extern bool IsEnabled;
+
+  //! The stage open on the calling thread, or -1, which is passed on to the work it posts to a thread-pool
+  extern thread_local int CurrentStage;
+
+  //! Enable profiling, if the counters can be opened - a warning is printed for any which cannot, and they are reported as unavailable
+  void Enable();
+
+  //! Start attributing the counts of the calling thread to a stage, until the matching call to End
+  //! \param aStage The stage
+  void Begin( const int& aStage );
+
+  //! Stop attributing the counts of the calling thread to the innermost stage
+  void End();
+
+  //! Attribute the counts of the calling thread to a stage for the lifetime of the scope
+  class Scope
+  {
+  public:
+    //! Constructor
+    //! \param aStage The stage, by default that open on the calling thread
+    inline Scope( const int& aStage = CurrentStage ) : mActive( IsEnabled and aStage >= 0 ) { if( mActive ) Begin( aStage ); }
+
+    //! Destructor
+    inline ~Scope(){ if( mActive ) End(); }
+
+    //! Deleted copy constructor
+    Scope( const Scope& aOther /*!< Anonymous argument */ ) = delete;
+
+    //! Deleted assignment operator
+    //! \return Reference to this, for chaining calls
+    Scope& operator = (const Scope& aOther /*!< Anonymous argument */ ) = delete;
+
+  private:
+    //! Whether the scope is counting
+    bool mActive;
+  };
+
+  //! Attribute the counts of the calling thread, and of any work it posts to a thread-pool, to a stage for the lifetime of the scope
+  class StageScope : public Scope
+  {
+  public:
+    //! Constructor
+    //! \param aStage The stage, or -1 for none
+    inline StageScope( const int& aStage ) : Scope( aStage ) , mPrevious( CurrentStage ) { CurrentStage = aStage; }
+
+    //! Destructor
+    inline ~StageScope(){ CurrentStage = mPrevious; }
+
+  private:
+    //! The stage to restore on destruction
+    int mPrevious;
+  };
+
+  //! Write the counts per stage, with IPC and the spread of cycles over workers, as a table
+  //! \param aStream The stream to which to write
+  void WriteSummary( std::ostream& aStream );
+
+  //! Write the counts per stage as one record per line, in the '{ Key:Value, ... }' style of the Scan.exe results
+  //! \param aStream The stream to which to write
+  void WriteRecords( std::ostream& aStream );
+
+  //! If profiling is enabled, print the summary - call only once no other thread is counting
+  void Finalize();
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,20 @@
+#pragma once
+
+/* ===== C++ ===== */
+#include <cstddef>
+#include <string>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! The resident-set size of the process
+//! \return The resident-set size in bytes, or 0 if it cannot be read
+std::size_t ResidentMemory();
+
+//! The peak resident-set size of the process since it started
+//! \return The peak resident-set size in bytes
+std::size_t PeakResidentMemory();
+
+//! Format a number of bytes for printing
+//! \param aBytes The number of bytes
+//! \return The number of bytes in MB, to one decimal place
+std::string FormatMegabytes( const std::size_t& aBytes );
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <chrono>
+#include <string>
+#include <memory>
+
+#include "Utilities/Instrumentation.hpp"
 
 //! A utility progress-bar
 struct ProgressBar
@@ -30,7 +34,7 @@ struct ProgressBar
 };
 
 
-//! A utility code timer
+//! A utility code timer, which also records the stage as an instrumentation span if a trace file has been set
 struct ProgressBar2
 {
   //! Constructor
@@ -49,4 +53,6 @@ struct ProgressBar2
 
   //! A timer for end-of-task stats
   std::chrono::high_resolution_clock::time_point mStart;  
+  //! A timer which records the span on destruction, only created if a trace file has been set
+  std::unique_ptr< Instrumentation::ScopedTimer > mTimer;
 };
\ No newline at end of file
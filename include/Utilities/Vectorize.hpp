@@ -7,10 +7,38 @@
 #include <cmath>
 
 #include "ListComprehension.hpp"
+#include "PerfCounters.hpp"
+#include "Instrumentation.hpp"
 
 //! Utility variable for the concurrency
 extern std::size_t Nthreads;
 
+//! The concurrency for the calling thread, overriding Nthreads if non-zero
+extern thread_local std::size_t LocalThreads;
+
+//! The concurrency for the calling thread
+//! \return LocalThreads if set, otherwise Nthreads
+inline std::size_t Threads() { return LocalThreads ? LocalThreads : Nthreads; }
+
+//! Set the concurrency of the calling thread, and of the work it parallelizes, for the lifetime of a scope, leaving Nthreads and all other threads untouched
+class ScopedThreads
+{
+public:
+  //! Constructor
+  //! \param aThreads The concurrency to use within the scope
+  ScopedThreads( const std::size_t& aThreads ) : mPrevious( LocalThreads ) { LocalThreads = aThreads; }
+
+  //! Destructor
+  ~ScopedThreads() { LocalThreads = mPrevious; }
+
+  ScopedThreads( const ScopedThreads& ) = delete;
+  ScopedThreads& operator= ( const ScopedThreads& ) = delete;
+
+private:
+  //! The concurrency to restore
+  std::size_t mPrevious;
+};
+
 //! Syntactic sugar to allow you to interleave parallelize via operator
 //! \tparam tContainer A container type
 //! \tparam tExpr      A function-call type
@@ -20,8 +48,10 @@ extern std::size_t Nthreads;
 template< typename tContainer , typename tExpr, typename tContainerType = typename std::remove_reference<tContainer>::type::value_type >
 inline void operator|| ( tExpr&& aExpr , tContainer&& aContainer )
 {
-  boost::asio::thread_pool ThreadPool( Nthreads );
-  for( std::size_t offset(0) ; offset!=Nthreads ; ++offset ) boost::asio::post( ThreadPool , [ aExpr , &aContainer , offset ](){ for( auto i( aContainer.begin() + offset ) ; i<aContainer.end() ; i+=Nthreads ) aExpr( *i ); }  );
+  const int lStage( PerfCounters::CurrentStage ); // Attribute the work to the stage open on this thread
+  const std::size_t lThreads( Threads() );
+  boost::asio::thread_pool ThreadPool( lThreads );
+  for( std::size_t offset(0) ; offset!=lThreads ; ++offset ) boost::asio::post( ThreadPool , [ aExpr , &aContainer , offset , lStage , lThreads ](){ Instrumentation::Worker = offset + 1; ScopedThreads lScope( lThreads ); PerfCounters::StageScope lPerf( lStage ); for( auto i( aContainer.begin() + offset ) ; i<aContainer.end() ; i+=lThreads ) aExpr( *i ); }  );
   ThreadPool.join();
 }
 
@@ -34,11 +64,14 @@ inline void operator|| ( tExpr&& aExpr , tContainer&& aContainer )
 template< typename tContainer , typename tExpr, typename tContainerType = typename std::remove_reference<tContainer>::type::value_type >
 inline void operator&& ( tExpr&& aExpr , tContainer&& aContainer )
 {
-  boost::asio::thread_pool ThreadPool( Nthreads );
+  const int lStage( PerfCounters::CurrentStage ); // Attribute the work to the stage open on this thread
+  const std::size_t lThreads( Threads() );
+  boost::asio::thread_pool ThreadPool( lThreads );
 
-  const std::size_t lChunksize( ceil( double( aContainer.size() ) / Nthreads ) );
+  const std::size_t lChunksize( ceil( double( aContainer.size() ) / lThreads ) );
   auto A( aContainer.begin() ) , B( aContainer.begin() + lChunksize );
-  for( ; B < aContainer.end() ; A = B , B+=lChunksize ) boost::asio::post( ThreadPool ,  [ aExpr , A , B ](){ for( auto i( A ) ; i != B ; ++i ) aExpr( *i ); } );
-  boost::asio::post( ThreadPool , [ aExpr , A , &aContainer ](){ for( auto i( A ) ; i != aContainer.end() ; ++i ) aExpr( *i ); } );
+  std::size_t lChunk( 0 );
+  for( ; B < aContainer.end() ; A = B , B+=lChunksize , ++lChunk ) boost::asio::post( ThreadPool ,  [ aExpr , A , B , lStage , lThreads , lChunk ](){ Instrumentation::Worker = lChunk + 1; ScopedThreads lScope( lThreads ); PerfCounters::StageScope lPerf( lStage ); for( auto i( A ) ; i != B ; ++i ) aExpr( *i ); } );
+  boost::asio::post( ThreadPool , [ aExpr , A , &aContainer , lStage , lThreads , lChunk ](){ Instrumentation::Worker = lChunk + 1; ScopedThreads lScope( lThreads ); PerfCounters::StageScope lPerf( lStage ); for( auto i( A ) ; i != aContainer.end() ; ++i ) aExpr( *i ); } );
   ThreadPool.join();
 }
@@ -3,27 +3,17 @@ from sys import argv
 import matplotlib.pyplot as plt
 
 # ----------------------------------------------------------------------------
-def Callback( clusters , background  ):
-	print( "Displaying")
+config = Configuration.FromVector( argv[1:] )
+results = OneStopGetClusterArrays( config )
 
-	X , Y = [] , []
-	for point in background:
-		X.append( 1e6 * point.x )
-		Y.append( 1e6 * point.y )
+print( "Displaying")
 
-	x , y , colours = [] , [] , []
-	for colour , cluster in enumerate( clusters ) :
-		for point in cluster:
-			x.append( 1e6 * point.x )
-			y.append( 1e6 * point.y )
-			colours.append( colour )
+x , y , labels = 1e6 * results["x"] , 1e6 * results["y"] , results["label"]
+background = ( labels < 0 )
 
-	plt.scatter( X, Y, s=0.1 , marker='.' , c="black" )
-	plt.scatter( x, y, s=0.1 , marker='.' , c=colours , cmap="prism" )
-	plt.xlabel( r'$\mu$m' )
-	plt.ylabel( r'$\mu$m' )
-	plt.show()
+plt.scatter( x[background], y[background], s=0.1 , marker='.' , c="black" )
+plt.scatter( x[~background], y[~background], s=0.1 , marker='.' , c=labels[~background] , cmap="prism" )
+plt.xlabel( r'$\mu$m' )
+plt.ylabel( r'$\mu$m' )
+plt.show()
 # ----------------------------------------------------------------------------
-
-Configuration.FromVector( argv[1:] );
-OneStopGetClusters( Callback )
\ No newline at end of file
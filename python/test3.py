@@ -3,14 +3,12 @@ from sys import argv
 import matplotlib.pyplot as plt
 
 # ----------------------------------------------------------------------------
-def Callback( clusters , background  ):
-	print( "Displaying")
-	pts = [ len( cluster ) for cluster in clusters ]
-	plt.xlabel('Cluster size')	
-	plt.ylabel('Count')
-	plt.hist( pts , 100, facecolor='green', alpha=0.75)
-	plt.show()
-# ----------------------------------------------------------------------------
+config = Configuration.FromVector( argv[1:] )
+results = OneStopGetClusterArrays( config )
 
-Configuration.FromVector( argv[1:] );
-OneStopGetClusters( Callback )
\ No newline at end of file
+print( "Displaying")
+plt.xlabel('Cluster size')	
+plt.ylabel('Count')
+plt.hist( results["cluster_size"] , 100, facecolor='green', alpha=0.75)
+plt.show()
+# ----------------------------------------------------------------------------
@@ -0,0 +1,163 @@
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Checkpoint.hpp"
+#include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/EventProxy.hpp"
+
+// /* ===== C++ ===== */
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+
+/* ===== C ===== */
+#include <unistd.h>
+#include <sys/stat.h>
+
+//! The magic number at the start of a scan checkpoint
+constexpr char CheckpointMagic[4] = { 'B' , 'C' , 'C' , 'K' };
+
+//! The version of the format of a scan checkpoint
+constexpr uint32_t CheckpointVersion = 1;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+ScanCell MakeScanCell( const EventProxy& aProxy , const double& aR , const double& aT , const std::pair<int,int>& aIJ )
+{
+  return ScanCell{ uint32_t( aIJ.first ) , uint32_t( aIJ.second ) , aR , aT , aProxy.mLogP , aProxy.mClusteredCount , aProxy.mBackgroundCount , aProxy.mClusterCount };
+}
+
+//! Accumulate a value into an FNV-1a hash
+//! \param aHash  The hash
+//! \param aValue The value
+template< typename T >
+inline void Fnv1a( uint64_t& aHash , const T& aValue )
+{
+  const unsigned char* lBytes( reinterpret_cast< const unsigned char* >( &aValue ) );
+  for( std::size_t i(0) ; i!=sizeof( T ) ; ++i ) aHash = ( aHash ^ lBytes[i] ) * 0x100000001b3ULL;
+}
+
+uint64_t ScanFingerprint( const Configuration& aConfiguration )
+{
+  uint64_t lHash( 0xcbf29ce484222325ULL );
+
+  // The input is identified by its name and size, rather than hashing what may be many GB
+  struct stat lStat;
+  const std::string& lInput( aConfiguration.inputFile() );
+  for( auto& c : lInput ) Fnv1a( lHash , c );
+  Fnv1a( lHash , stat( lInput.c_str() , &lStat ) ? int64_t( -1 ) : int64_t( lStat.st_size ) );
+
+  Fnv1a( lHash , aConfiguration.getCentreX() );
+  Fnv1a( lHash , aConfiguration.getCentreY() );
+  Fnv1a( lHash , aConfiguration.getWidthX() );
+  Fnv1a( lHash , aConfiguration.getWidthY() );
+  Fnv1a( lHash , aConfiguration.Rbins() );
+  Fnv1a( lHash , aConfiguration.minScanR() );
+  Fnv1a( lHash , aConfiguration.maxScanR() );
+  Fnv1a( lHash , aConfiguration.RLogSpacing() );
+  Fnv1a( lHash , aConfiguration.Tbins() );
+  Fnv1a( lHash , aConfiguration.minScanT() );
+  Fnv1a( lHash , aConfiguration.maxScanT() );
+  for( auto& i : aConfiguration.sigmabins() ) Fnv1a( lHash , i );
+  for( auto& i : aConfiguration.probability_sigma() ) Fnv1a( lHash , i );
+  Fnv1a( lHash , aConfiguration.logPb() );
+  Fnv1a( lHash , aConfiguration.alpha() );
+  Fnv1a( lHash , aConfiguration.uncertaintyClasses() );
+  Fnv1a( lHash , aConfiguration.prescanFraction() );
+  Fnv1a( lHash , aConfiguration.prescanMargin() );
+  Fnv1a( lHash , aConfiguration.twoPhaseClusterize() );    // Both of these change the order of the floating-point summation,
+  Fnv1a( lHash , aConfiguration.protoClustersOnTheFly() ); // so a resumed scan would not otherwise be bit-identical
+  return lHash;
+}
+
+void AtomicWrite( const std::string& aFilename , const std::function< void( FILE* ) >& aWriter )
+{
+  const std::string lTemporary( aFilename + ".tmp" );
+  auto f = fopen( lTemporary.c_str() , "wb" );
+  if ( f == NULL ) throw std::runtime_error( "Unable to open " + lTemporary + " for writing" );
+  aWriter( f );
+  if( fflush( f ) or fsync( fileno( f ) ) or ferror( f ) ){ fclose( f ); throw std::runtime_error( "Failed to write " + lTemporary ); }
+  fclose( f );
+  if( rename( lTemporary.c_str() , aFilename.c_str() ) ) throw std::runtime_error( "Failed to rename " + lTemporary + " to " + aFilename );
+}
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+ScanCheckpoint::ScanCheckpoint( const Configuration& aConfiguration , const std::size_t& aCellsPerRow ) :
+  mFilename( aConfiguration.checkpointFile() ),
+  mFingerprint( ScanFingerprint( aConfiguration ) ),
+  mCellsPerRow( aCellsPerRow ),
+  mInterval( aConfiguration.checkpointInterval() ),
+  mLastWrite( std::chrono::steady_clock::now() ),
+  mRowComplete( aConfiguration.Rbins() , false ),
+  mUnwritten( 0 )
+{
+  if( !aConfiguration.resume() ) return;
+
+  auto f = fopen( mFilename.c_str() , "rb" );
+  if ( f == NULL )
+  {
+    std::cout << "No checkpoint " << mFilename << " to resume from - starting afresh" << std::endl;
+    return;
+  }
+
+  char lMagic[4];
+  uint32_t lVersion;
+  uint64_t lFingerprint , lCount;
+  bool lGood( fread( lMagic , sizeof( lMagic ) , 1 , f ) == 1 and fread( &lVersion , sizeof( lVersion ) , 1 , f ) == 1
+          and fread( &lFingerprint , sizeof( lFingerprint ) , 1 , f ) == 1 and fread( &lCount , sizeof( lCount ) , 1 , f ) == 1 );
+  if( !lGood or memcmp( lMagic , CheckpointMagic , sizeof( lMagic ) ) or lVersion != CheckpointVersion ){ fclose( f ); throw std::runtime_error( mFilename + " is not a scan checkpoint" ); }
+  if( lFingerprint != mFingerprint ){ fclose( f ); throw std::runtime_error( "Checkpoint " + mFilename + " was written for a different input or configuration" ); }
+
+  mCells.resize( lCount );
+  lGood = ( fread( mCells.data() , sizeof( ScanCell ) , lCount , f ) == lCount );
+  fclose( f );
+  if( !lGood ) throw std::runtime_error( "Checkpoint " + mFilename + " is truncated" );
+
+  for( auto& i : mCells )
+  {
+    if( i.mRIndex >= mRowComplete.size() ) throw std::runtime_error( "Checkpoint " + mFilename + " is corrupt" );
+    mRowComplete[ i.mRIndex ] = true;
+  }
+  std::cout << "Resuming from " << mFilename << " with " << mCells.size() << " cells already scanned" << std::endl;
+}
+
+bool ScanCheckpoint::RowComplete( const uint32_t& aRIndex ) const
+{
+  return mRowComplete.at( aRIndex );
+}
+
+void ScanCheckpoint::Record( const ScanCell& aCell )
+{
+  std::lock_guard< std::mutex > lLock( mMutex );
+  auto& lRow( mPending[ aCell.mRIndex ] );
+  lRow.push_back( aCell );
+  if( lRow.size() == mCellsPerRow )
+  {
+    mCells.insert( mCells.end() , lRow.begin() , lRow.end() );
+    mRowComplete[ aCell.mRIndex ] = true;
+    mPending.erase( aCell.mRIndex );
+    mUnwritten += mCellsPerRow;
+  }
+
+  if( mUnwritten and std::chrono::steady_clock::now() - mLastWrite > mInterval ) WriteLocked();
+}
+
+void ScanCheckpoint::Write()
+{
+  std::lock_guard< std::mutex > lLock( mMutex );
+  WriteLocked();
+}
+
+void ScanCheckpoint::WriteLocked()
+{
+  AtomicWrite( mFilename , [&]( FILE* f ){
+    const uint64_t lCount( mCells.size() );
+    fwrite( CheckpointMagic , sizeof( CheckpointMagic ) , 1 , f );
+    fwrite( &CheckpointVersion , sizeof( CheckpointVersion ) , 1 , f );
+    fwrite( &mFingerprint , sizeof( mFingerprint ) , 1 , f );
+    fwrite( &lCount , sizeof( lCount ) , 1 , f );
+    fwrite( mCells.data() , sizeof( ScanCell ) , mCells.size() , f );
+  } );
+  mUnwritten = 0;
+  mLastWrite = std::chrono::steady_clock::now();
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
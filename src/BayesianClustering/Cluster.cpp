@@ -1,9 +1,8 @@
 
 /* ===== Local utilities ===== */
 #include "Utilities/GSLInterpolator.hpp"
-
-/* ===== BOOST libraries ===== */
-#include <boost/math/special_functions/erf.hpp>
+#include "Utilities/NormalCDF.hpp"
+#include "Utilities/Instrumentation.hpp"
 
 /* ===== Cluster sources ===== */
 #include "BayesianClustering/Cluster.hpp"
@@ -11,22 +10,9 @@
 #include "BayesianClustering/Configuration.hpp"
 
 
-// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-// Copied from the CERN ROOT implementaion
-// Swap ROOT::Math::erfc and ROOT::Math::erf for the boost::math version
-inline double normal_cdf( const double& x, const double& sigma = 1, const double& x0 = 0 )
-{
-  double z = ( x - x0 ) / ( sigma * sqrt(2) );
-  if ( z < -1. ) return 0.5 * boost::math::erfc(-z);
-  else           return 0.5 * ( 1.0 + boost::math::erf(z) );
-}
-// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-
-
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 Cluster::Parameter::Parameter() : 
-A(0.0) , Bx(0.0) , By(0.0) , C(0.0) , logF(0.0),
-S2(0.0)
+A(0.0) , Bx(0.0) , By(0.0) , C(0.0) , logF(0.0)
 {}
     
 Cluster::Parameter& Cluster::Parameter::operator+= ( const Cluster::Parameter& aOther )
@@ -39,6 +25,19 @@ Cluster::Parameter& Cluster::Parameter::operator+= ( const Cluster::Parameter& a
   return *this;
 }
 
+Cluster::UncertaintyClass::UncertaintyClass() : 
+N(0.0) , X(0.0) , Y(0.0) , R2(0.0)
+{}
+
+Cluster::UncertaintyClass& Cluster::UncertaintyClass::operator+= ( const Cluster::UncertaintyClass& aOther )
+{
+  N += aOther.N;
+  X += aOther.X;
+  Y += aOther.Y;
+  R2 += aOther.R2;
+  return *this;
+}
+
 inline double CDF( const double& aArg )
 {
   // Above 8 or below -8 are indistinguishable from 0 and 1 respectively
@@ -47,7 +46,7 @@ inline double CDF( const double& aArg )
   return normal_cdf( aArg );
 }
 
-double Cluster::Parameter::alt_log_score() const
+double Cluster::Parameter::alt_log_score( const double& aS2 ) const
 {
   const double pi = atan(1)*4;
   const double log2pi = log( 2*pi );
@@ -66,7 +65,7 @@ double Cluster::Parameter::alt_log_score() const
                       CDF(sqrt_A * (-1 - lNubarY)));
 
   log_sum = logF
-            -S2 / 2.0 
+            -aS2 / 2.0 
             +lLogMuIntegral;
   return log_sum;
 }
@@ -93,20 +92,44 @@ double Cluster::Parameter::log_score() const
 
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-Cluster::Cluster(): mParams( Configuration::Instance.sigmacount() ),
+Cluster::Scratch::Scratch( const Configuration& aConfiguration ) :
+mMuIntegral( aConfiguration.sigmacount() , 1.0 ) ,
+mIntegralArguments( aConfiguration.sigmacount() , 1.0 ) ,
+mInterpolator( new GSLInterpolator( gsl_interp_linear , aConfiguration.sigmacount() ) )
+{}
+
+Cluster::Scratch::~Scratch() = default;
+Cluster::Scratch::Scratch( Scratch&& aOther ) = default;
+Cluster::Scratch& Cluster::Scratch::operator = ( Scratch&& aOther ) = default;
+
+
+
+Cluster::Cluster( const Configuration& aConfiguration ): mParams( aConfiguration.uncertaintyClasses() ? 0 : aConfiguration.sigmacount() ),
+mClasses( aConfiguration.uncertaintyClasses() ),
 mClusterSize( 0 ) , mLastClusterSize( 0 ) , mClusterScore( 0.0 ) , 
 mParent( NULL ) ,
 mData()
 {}
 
-Cluster::Cluster( const Data& aData ): mParams( Configuration::Instance.sigmacount() ),
+Cluster::Cluster( const Data& aData , const Configuration& aConfiguration ): mParams( aConfiguration.uncertaintyClasses() ? 0 : aConfiguration.sigmacount() ),
+mClasses( aConfiguration.uncertaintyClasses() ),
 mClusterSize( 1 ) , mLastClusterSize( 0 ) , mClusterScore( 0.0 ) , 
 mParent( NULL ) ,
 mData()
 { 
+  if( mClasses.size() )
+  {
+    auto& lClass( mClasses[ aData.mUncertaintyClass ] );
+    lClass.N = 1.0;
+    lClass.X = aData.x;
+    lClass.Y = aData.y;
+    lClass.R2 = aData.r2;
+    return;
+  }
+
   const auto s2 = aData.s * aData.s;
   auto lIt( mParams.begin() ) ;
-  auto lSig2It( Configuration::Instance.sigmabins2().begin() );
+  auto lSig2It( aConfiguration.sigmabins2().begin() );
 
   for( ; lIt != mParams.end() ; ++lIt , ++lSig2It )
   {
@@ -119,33 +142,71 @@ mData()
   }
 }
 
-void Cluster::UpdateLogScore()
+const std::vector< Cluster::Parameter >& Cluster::Parameters( const Configuration& aConfiguration , std::vector< Parameter >& aBuffer ) const
 {
-  static constexpr double pi = atan(1)*4;
-  static constexpr double log2pi = log( 2*pi );
+  if( mClasses.empty() ) return mParams;
+
+  // Each class contributes N w to A, w sum(x) to Bx, w sum(y) to By, w sum(r^2) to C and N log(w) to logF, for its weight w under each sigma hypothesis
+  const std::size_t lSigmacount( aConfiguration.sigmacount() );
+  aBuffer.assign( lSigmacount , Parameter() );
+  for( std::size_t k(0) ; k!=mClasses.size() ; ++k )
+  {
+    const UncertaintyClass& lClass( mClasses[k] );
+    if( lClass.N == 0.0 ) continue;
+    const double* lWeight( &aConfiguration.classWeight( k , 0 ) );
+    const double* lLogWeight( &aConfiguration.classLogWeight( k , 0 ) );
+    for( std::size_t i(0) ; i!=lSigmacount ; ++i )
+    {
+      Parameter& lParam( aBuffer[i] );
+      lParam.A += lClass.N * lWeight[i];
+      lParam.Bx += lWeight[i] * lClass.X;
+      lParam.By += lWeight[i] * lClass.Y;
+      lParam.C += lWeight[i] * lClass.R2;
+      lParam.logF += lClass.N * lLogWeight[i];
+    }
+  }
+  return aBuffer;
+}
 
-  if( mClusterSize <= mLastClusterSize ) return; // We were not bigger than the previous size when we were evaluated - score is still valid
+void Cluster::UpdateLogScore( const Configuration& aConfiguration , Scratch& aScratch )
+{
+  if( mClusterSize <= mLastClusterSize ) // We were not bigger than the previous size when we were evaluated - score is still valid
+  {
+    INSTRUMENT_COUNT( "UpdateLogScore skipped" , 1 );
+    return;
+  }
   mLastClusterSize = mClusterSize;
+  INSTRUMENT_COUNT( "UpdateLogScore evaluated" , 1 );
+  INSTRUMENT_FILL( "UpdateLogScore cluster size" , mClusterSize );
 
-  thread_local static std::vector< double > MuIntegral( Configuration::Instance.sigmacount() , 1.0 );
-  thread_local static std::vector< double > integralArguments( Configuration::Instance.sigmacount() , 1.0 );
+  mClusterScore = LogScore( Parameters( aConfiguration , aScratch.mParams ) , mClusterSize , aConfiguration , aScratch );
+}
+
+double Cluster::LogScore( const std::vector< Parameter >& aParams , const std::size_t& aClusterSize , const Configuration& aConfiguration , Scratch& aScratch )
+{
+  static constexpr double pi = atan(1)*4;
+  static constexpr double log2pi = log( 2*pi );
+
+  std::vector< double >& MuIntegral( aScratch.mMuIntegral );
+  std::vector< double >& integralArguments( aScratch.mIntegralArguments );
   double largestArg(-9E99);
   double tempArg;
-  for( std::size_t i(0) ; i!=Configuration::Instance.sigmacount() ; ++i ) {
-    tempArg =  mParams[i].log_score() + Configuration::Instance.log_probability_sigma( i );
+  for( std::size_t i(0) ; i!=aConfiguration.sigmacount() ; ++i ) {
+    tempArg =  aParams[i].log_score() + aConfiguration.log_probability_sigma( i );
     if (tempArg > largestArg) largestArg = tempArg;
     integralArguments[i] = tempArg;
   }
   //pass again to set the MuIntegral Correctly
-  for( std::size_t i(0) ; i!=Configuration::Instance.sigmacount() ; ++i ) MuIntegral[i] = exp(integralArguments[i] - largestArg);
+  for( std::size_t i(0) ; i!=aConfiguration.sigmacount() ; ++i ) MuIntegral[i] = exp(integralArguments[i] - largestArg);
 
-  thread_local static GSLInterpolator lInt( gsl_interp_linear , Configuration::Instance.sigmacount() );
-  lInt.SetData( Configuration::Instance.sigmabins() , MuIntegral );
+  GSLInterpolator& lInt( *aScratch.mInterpolator );
+  lInt.SetData( aConfiguration.sigmabins() , MuIntegral );
 
-  static const double Lower( Configuration::Instance.sigmabins(0) ) , Upper( Configuration::Instance.sigmabins(Configuration::Instance.sigmacount()-1) );
-  // mClusterScore = double( log( lInt.Integ( Lower , Upper ) ) ) + constant - double( log( 4.0 ) ) + (log2pi * (1.0-mClusterSize));  
-  mClusterScore = double( log( lInt.Integ( Lower , Upper ) ) ) + largestArg - double( log( 4.0 ) ) + (log2pi * (1.0-mClusterSize));  
-  mClusterScore += log(0.25) -(mClusterSize * log2pi);
+  const double Lower( aConfiguration.sigmabins(0) ) , Upper( aConfiguration.sigmabins(aConfiguration.sigmacount()-1) );
+  // double lClusterScore = double( log( lInt.Integ( Lower , Upper ) ) ) + constant - double( log( 4.0 ) ) + (log2pi * (1.0-aClusterSize));  
+  double lClusterScore = double( log( lInt.Integ( Lower , Upper ) ) ) + largestArg - double( log( 4.0 ) ) + (log2pi * (1.0-aClusterSize));  
+  lClusterScore += log(0.25) -(aClusterSize * log2pi);
+  return lClusterScore;
 }
 
 Cluster& Cluster::operator+= ( const Cluster& aOther )
@@ -154,10 +215,46 @@ Cluster& Cluster::operator+= ( const Cluster& aOther )
   auto lIt2( aOther.mParams.begin() );
 
   for( ; lIt != mParams.end() ; ++lIt , ++lIt2 ) *lIt += *lIt2;
+
+  auto lClassIt( mClasses.begin() );
+  auto lClassIt2( aOther.mClasses.begin() );
+  for( ; lClassIt != mClasses.end() ; ++lClassIt , ++lClassIt2 ) *lClassIt += *lClassIt2;
+
   mClusterSize += aOther.mClusterSize;
   return *this;
 }
 
+Cluster& Cluster::Add( const Data& aData , const Configuration& aConfiguration )
+{
+  if( mClasses.size() )
+  {
+    auto& lClass( mClasses[ aData.mUncertaintyClass ] );
+    lClass.N += 1.0;
+    lClass.X += aData.x;
+    lClass.Y += aData.y;
+    lClass.R2 += aData.r2;
+    mClusterSize += 1;
+    return *this;
+  }
+
+  // The same arithmetic as the single-point constructor, so that the sums are identical to adding a stored proto-cluster
+  const auto s2 = aData.s * aData.s;
+  auto lIt( mParams.begin() ) ;
+  auto lSig2It( aConfiguration.sigmabins2().begin() );
+
+  for( ; lIt != mParams.end() ; ++lIt , ++lSig2It )
+  {
+    double w = 1.0 / ( s2 + *lSig2It );
+    lIt->A += w;
+    lIt->Bx += (w * aData.x);
+    lIt->By += (w * aData.y);
+    lIt->C += (w * aData.r2);
+    lIt->logF += PRECISION( log( w ) );
+  }
+  mClusterSize += 1;
+  return *this;
+}
+
 Cluster* Cluster::GetParent()
 {
   if( mParent ) return mParent = mParent->GetParent();
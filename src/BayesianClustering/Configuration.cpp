@@ -4,6 +4,8 @@
 #include "Utilities/GSLInterpolator.hpp"
 #include "Utilities/ListComprehension.hpp"
 #include "Utilities/Vectorize.hpp"
+#include "Utilities/Instrumentation.hpp"
+#include "Utilities/PerfCounters.hpp"
 #include "BayesianClustering/Configuration.hpp"
 
 /* ===== C++ ===== */
@@ -22,14 +24,19 @@ Configuration::Configuration() :
   mPhysicalCentreX(0), mPhysicalCentreY(0),
   mWidthX(0), mWidthY(0),
   mArea(0),
-	mSigmacount(-1), mSigmaspacing(-1),
+  mDensityMapFile(""), mDensityBinSize(0), mRoIThreshold(0.2), mAutoRoI(false),
+	mSigmacount(-1), mSigmaspacing(-1), mUncertaintyClasses(0),
 	mMaxR(-1), mMaxR2(-1), mMax2R(-1), mMax2R2(-1),
 	mMinScanR(-1), mMaxScanR(-1), mMinScanT(-1), mMaxScanT(-1),
 	mDR(-1), mDT(-1),
-	mRbins(-1),  mTbins(-1),
+	mRbins(-1),  mTbins(-1), mRLog(false),
+	mAdaptiveStride(0), mAdaptiveTop(3),
+	mPrescanFraction(0), mPrescanMargin(0),
+	mCheckpointFile(""), mCheckpointInterval(60), mCheckpointEvent(false), mResume(false),
 	mLogPb(-1), mLogPbDagger(-1), 
 	mAlpha(-1), mLogAlpha(-1), mLogGammaAlpha(-1),
 	mValidate(false),
+	mMemoryBudget(0), mProtoClustersOnTheFly(false), mTwoPhaseClusterize(false),
   mInputFile(""), mOutputFile(""),
   mClusterR( -1 ), mClusterT(-1)
 {}
@@ -50,6 +57,46 @@ void Configuration::SetWidth( const double& aWidthX , const double& aWidthY )
   mArea = mWidthX * mWidthY;
 }
 
+void Configuration::AddRegionOfInterest( const double& aCentreX , const double& aCentreY , const double& aWidthX , const double& aWidthY )
+{
+  std::cout << "RoI " << mRegionsOfInterest.size() << ": centre x=" << aCentreX << ", y=" << aCentreY << ", width x=" << aWidthX << ", y=" << aWidthY << std::endl;
+  if( aWidthX <= 0.0 or aWidthY <= 0.0 ) throw std::runtime_error( "The width of a RoI must be positive" );
+  mRegionsOfInterest.push_back( RegionOfInterest{ aCentreX , aCentreY , aWidthX , aWidthY } );
+}
+
+Configuration Configuration::ForRegionOfInterest( const std::size_t& aIndex ) const
+{
+  const RegionOfInterest& lRoI( mRegionsOfInterest.at( aIndex ) );
+  const std::string lSuffix( "_roi" + std::to_string( aIndex ) );
+
+  Configuration lConfiguration( *this );
+  lConfiguration.mRegionsOfInterest.clear();
+  lConfiguration.SetCentre( lRoI.mCentreX , lRoI.mCentreY );
+  lConfiguration.SetWidth( lRoI.mWidthX , lRoI.mWidthY );
+
+  // The suffix goes before the extension, so that the format of the output is still chosen by it
+  if( mOutputFile.size() )
+  {
+    const std::size_t lSlash( mOutputFile.find_last_of( '/' ) ) , lDot( mOutputFile.find_last_of( '.' ) );
+    const std::size_t lSplit( ( lDot == std::string::npos or ( lSlash != std::string::npos and lDot < lSlash ) ) ? mOutputFile.size() : lDot );
+    lConfiguration.SetOutputFile( mOutputFile.substr( 0 , lSplit ) + lSuffix + mOutputFile.substr( lSplit ) );
+  }
+  if( mCheckpointFile.size() ) lConfiguration.mCheckpointFile += lSuffix;
+  return lConfiguration;
+}
+
+void Configuration::SetDensityMap( const std::string& aFilename , const double& aBinSize , const double& aThreshold , const bool& aScan )
+{
+  if( aBinSize <= 0.0 ) throw std::runtime_error( "The bin size of the density map must be positive" );
+  if( aThreshold < 0.0 or aThreshold >= 1.0 ) throw std::runtime_error( "The threshold for candidate RoIs must lie in [0, 1)" );
+  std::cout << "Density map: " << ( aFilename.size() ? aFilename : "not written" ) << ", " << aBinSize / nanometer << "nm bins, candidate RoIs above " << aThreshold << " of the peak" << ( aScan ? " are scanned" : "" ) << std::endl;
+
+  mDensityMapFile = aFilename;
+  mDensityBinSize = aBinSize;
+  mRoIThreshold = aThreshold;
+  mAutoRoI = aScan;
+}
+
 void Configuration::SetSigmaParameters( const std::size_t& aSigmacount , const double& aSigmaMin , const double& aSigmaMax , const std::function< double( const double& ) >& aInterpolator )
 {
 	std::cout << "Sigma-integral: " << aSigmaMin << " to " << aSigmaMax << " in " << aSigmacount << " steps" << std::endl;
@@ -62,6 +109,25 @@ void Configuration::SetSigmaParameters( const std::size_t& aSigmacount , const d
 	mLogProbabilitySigma = []( const double& w){ return log(w); } | mProbabilitySigma;
 }
 
+void Configuration::SetUncertaintyClasses( const std::size_t& aCount )
+{
+	if( aCount ) std::cout << "Uncertainty classes: " << aCount << std::endl;
+	mUncertaintyClasses = aCount;
+}
+
+void Configuration::SetUncertaintyClassTable( const std::vector< double >& aS2 )
+{
+	if( aS2.size() != mUncertaintyClasses ) throw std::runtime_error( "Expected one representative per uncertainty class" );
+	mClassWeights.resize( mUncertaintyClasses * mSigmacount );
+	mClassLogWeights.resize( mUncertaintyClasses * mSigmacount );
+	for( std::size_t k(0) ; k!=mUncertaintyClasses ; ++k )
+		for( std::size_t i(0) ; i!=mSigmacount ; ++i )
+		{
+			mClassWeights[ ( k * mSigmacount ) + i ] = 1.0 / ( aS2[k] + mSigmabins2[i] );
+			mClassLogWeights[ ( k * mSigmacount ) + i ] = log( mClassWeights[ ( k * mSigmacount ) + i ] );
+		}
+}
+
 void Configuration::SetRBins( const std::size_t& aRbins , const double& aMinScanR , const double& aMaxScanR )
 {
 	mRbins = aRbins;
@@ -69,6 +135,8 @@ void Configuration::SetRBins( const std::size_t& aRbins , const double& aMinScan
 	mMaxScanR = aMaxScanR;
 	mDR = ( mMaxScanR - mMinScanR ) / mRbins;
 
+	if( mRLog and mRbins and mMinScanR <= 0.0 ) throw std::runtime_error( "Logarithmically-spaced R bins require a positive lower R bound" );
+
 	std::cout << "R-bins: " << mRbins << " bins from " << mMinScanR << " to " << mMaxScanR << " in steps of " << mDR << std::endl;
 
 	mMaxR = aMaxScanR;
@@ -87,6 +155,42 @@ void Configuration::SetTBins( const std::size_t& aTbins , const double& aMinScan
 	std::cout << "T-bins: " << mTbins << " bins from " << mMinScanT << " to " << mMaxScanT << " in steps of " << mDT << std::endl;
 }
 
+void Configuration::SetRLogSpacing( const bool& aRLog )
+{
+	if( aRLog ) std::cout << "R-bins: logarithmically spaced" << std::endl;
+
+	mRLog = aRLog;
+}
+
+void Configuration::SetAdaptive( const std::size_t& aStride , const std::size_t& aTop )
+{
+	if( aStride ) std::cout << "Adaptive scan: coarse grid every " << aStride << " bins, refining around the top " << aTop << " cells" << std::endl;
+
+	mAdaptiveStride = aStride;
+	mAdaptiveTop = aTop;
+}
+
+void Configuration::SetPrescan( const double& aFraction , const std::size_t& aMargin )
+{
+	if( aFraction < 0.0 or aFraction >= 1.0 ) throw std::runtime_error( "Prescan fraction must be in the range [0,1)" );
+	if( aFraction ) std::cout << "Prescan: " << aFraction << " of points, window half-width " << ( aMargin ? std::to_string( aMargin ) + " bins" : std::string( "automatic" ) ) << std::endl;
+
+	mPrescanFraction = aFraction;
+	mPrescanMargin = aMargin;
+}
+
+void Configuration::SetCheckpoint( const std::string& aFilename , const double& aInterval , const bool& aEvent , const bool& aResume )
+{
+	if( aFilename.empty() ) throw std::runtime_error( "Checkpointing requires a checkpoint file" );
+	if( aInterval <= 0.0 ) throw std::runtime_error( "Checkpoint interval must be positive" );
+	std::cout << "Checkpoint: " << aFilename << " every " << aInterval << " s" << ( aEvent ? ", with the preprocessed event" : "" ) << ( aResume ? ", resuming" : "" ) << std::endl;
+
+	mCheckpointFile = aFilename;
+	mCheckpointInterval = aInterval;
+	mCheckpointEvent = aEvent;
+	mResume = aResume;
+}
+
 void Configuration::SetPb( const double& aPB )
 {
 	std::cout << "Pb: " << aPB << std::endl;
@@ -102,6 +206,25 @@ void Configuration::SetAlpha( const double& aAlpha )
 	mLogGammaAlpha = boost::math::lgamma( aAlpha );
 }
 
+void Configuration::SetMemoryBudget( const double& aMegabytes )
+{
+	if( aMegabytes < 0.0 ) throw std::runtime_error( "Memory budget must be non-negative" );
+	if( aMegabytes ) std::cout << "Memory budget: " << aMegabytes << " MB" << std::endl;
+	mMemoryBudget = std::size_t( aMegabytes * 1024 * 1024 );
+}
+
+void Configuration::SetProtoClustersOnTheFly( const bool& aOnTheFly )
+{
+	if( aOnTheFly ) std::cout << "Proto-clusters: computed on the fly" << std::endl;
+	mProtoClustersOnTheFly = aOnTheFly;
+}
+
+void Configuration::SetTwoPhaseClusterize( const bool& aTwoPhase )
+{
+	if( aTwoPhase ) std::cout << "Clusterize: connectivity, then parameters" << std::endl;
+	mTwoPhaseClusterize = aTwoPhase;
+}
+
 void Configuration::SetValidate( const bool& aValidate )
 {
 	if( aValidate ) std::cout << "Validate: TRUE" << std::endl;
@@ -158,7 +281,12 @@ void Configuration::FromVector( const std::vector< std::string >& aArgs )
   typedef std::size_t tZ;
 
   tD sigLo , sigHi , rLo , rHi , tLo , tHi;
-  tU Nsig(0) , Nr(0) , Nt(0);
+  tU Nsig(0) , Nr(0) , Nt(0) , AdaptiveStride(0) , AdaptiveTop(3) , PrescanMargin(0);
+  tD PrescanFraction(0) , CheckpointInterval(60);
+  tS CheckpointFile , DensityMapFile , DensityBin( "250nm" );
+  tD RoIThreshold(0.2);
+  bool AutoRoI(false);
+  bool CheckpointEvent(false) , Resume(false); // Switches are only ever set, since the nested parse of a config file stores every switch, given or not
   tVD SigKeys, SigVals;
 
   po::positional_options_description lPositional;
@@ -170,9 +298,18 @@ void Configuration::FromVector( const std::vector< std::string >& aArgs )
     ( "cfg",          po::value<tS>()                            ->notifier( [&]( const   tS& aArg ){ config_file( lDesc , aArg ); } )                        , "Config file" )
     ( "centre",       po::value<tVS>()->composing()->multitoken()->notifier( [&]( const  tVS& aArg ){ SetCentre( StrToDist(aArg.at(0)) , StrToDist(aArg.at(1)) ); } ) , "Centre of ROI as 'x y' pair" )
     ( "width",        po::value<tVS>()->composing()->multitoken()->notifier( [&]( const  tVS& aArg ){ SetWidth( StrToDist(aArg.at(0)) , StrToDist(aArg.at(1)) ); } ) , "Width of ROI as 'x y' pair" )
+    ( "roi",          po::value<tVS>()->composing()->multitoken()->notifier( [&]( const  tVS& aArg ){ 
+                                                                                                        if( aArg.size() % 4 ) throw std::runtime_error( "Each RoI must be given as 'x y width height'" );
+                                                                                                        for( std::size_t i(0) ; i!=aArg.size() ; i+=4 ) AddRegionOfInterest( StrToDist(aArg[i]) , StrToDist(aArg[i+1]) , StrToDist(aArg[i+2]) , StrToDist(aArg[i+3]) );
+                                                                                                      } )                                                     , "RoI to scan as 'x y width height' (repeatable) - the input file is loaded once and each RoI is scanned in turn, in place of --centre and --width" )
+    ( "density-map",  po::value<tS>(&DensityMapFile)                                                                                                          , "Accumulate a density map of the whole input file while it is parsed, and write it and the candidate RoIs to the given file" )
+    ( "density-bin",  po::value<tS>(&DensityBin)                                                                                                              , "Bin size of the density map (default 250nm)" )
+    ( "roi-threshold", po::value<tD>(&RoIThreshold)                                                                                                           , "Fraction of the peak of the smoothed density map above which candidate RoIs are found (default 0.2)" )
+    ( "auto-roi",     po::bool_switch()                          ->notifier( [&]( const bool& aArg ){ if( aArg ) AutoRoI = true; } )                          , "Scan the candidate RoIs of the density map, in place of --centre and --width" )
     ( "sigma-bins",   po::value<tU>(&Nsig)                                                                                                                    , "Number of sigma bins" )
     ( "sigma-low",    po::value<tS>()                            ->notifier( [&]( const   tS& aArg ){ sigLo=StrToDist(aArg); } )                              , "Lower sigma integration bound" )
     ( "sigma-high",   po::value<tS>()                            ->notifier( [&]( const   tS& aArg ){ sigHi=StrToDist(aArg); } )                              , "High sigma integration bound" )
+    ( "uncertainty-classes", po::value<tZ>()                      ->notifier( [&]( const   tZ& aArg ){ SetUncertaintyClasses( aArg ); } )                     , "Quantize the uncertainties of the points into the given number of classes, so that clusters keep per-class sums rather than per-sigma parameters (default 0, no quantization)" )
     ( "sigma-curve",  po::value<tVS>()->composing()->multitoken()->notifier( [&]( const  tVS& aArg ){ for( auto& i : aArg ) { 
                                                                                                         std::vector<std::string> lStrs; 
                                                                                                         boost::split( lStrs , i , [](char c){return c==':';} ); 
@@ -183,9 +320,18 @@ void Configuration::FromVector( const std::vector< std::string >& aArgs )
     ( "r-bins",       po::value<tU>(&Nr)                                                                                                                      , "Number of R bins" )
     ( "r-low",        po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ rLo=StrToDist(aArg); } )                               , "Lower R bound" )
     ( "r-high",       po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ rHi=StrToDist(aArg); } )                               , "High R bound" )
+    ( "r-log",        po::bool_switch()                           ->notifier( [&]( const bool& aArg ){ SetRLogSpacing( aArg ); } )                            , "Logarithmically-spaced R bins" )
     ( "t-bins",       po::value<tU>(&Nt)                                                                                                                      , "Number of T bins" )
     ( "t-low",        po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ tLo=StrToDist(aArg); } )                               , "Lower T bound" )
     ( "t-high",       po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ tHi=StrToDist(aArg); } )                               , "High T bound" )
+    ( "adaptive",     po::value<tU>(&AdaptiveStride)                                                                                                          , "Run an adaptive RT-scan, starting from a coarse grid with the given spacing in bins" )
+    ( "adaptive-top", po::value<tU>(&AdaptiveTop)                                                                                                             , "Number of top-scoring cells around which the adaptive RT-scan refines (default 3)" )
+    ( "prescan",      po::value<tD>(&PrescanFraction)                                                                                                         , "Run a prescan on the given fraction of the points to narrow the window of the full RT-scan" )
+    ( "prescan-margin", po::value<tU>(&PrescanMargin)                                                                                                         , "Half-width, in bins, of the window of the full RT-scan around the best prescan cell (default automatic)" )
+    ( "checkpoint",   po::value<tS>(&CheckpointFile)                                                                                                          , "Periodically checkpoint the completed rows of the RT-scan to the given file" )
+    ( "checkpoint-interval", po::value<tD>(&CheckpointInterval)                                                                                               , "Interval between checkpoints in seconds (default 60)" )
+    ( "checkpoint-event", po::bool_switch()                      ->notifier( [&]( const bool& aArg ){ if( aArg ) CheckpointEvent = true; } )              , "Also save the preprocessed event alongside the checkpoint, so that a resumed scan need not reload and preprocess" )
+    ( "resume",       po::bool_switch()                          ->notifier( [&]( const bool& aArg ){ if( aArg ) Resume = true; } )                           , "Resume the RT-scan from the checkpoint, rescanning only the rows not yet completed" )
     ( "pb",           po::value<tD>()                             ->notifier( [&]( const   tD& aArg ){ SetPb(aArg); } )                                       , "pb parameter" )
     ( "alpha",        po::value<tD>()                             ->notifier( [&]( const   tD& aArg ){ SetAlpha(aArg); } )                                    , "alpha parameter" )
     ( "validate,v",   po::bool_switch()                           ->notifier( [&]( const bool& aArg ){ SetValidate( aArg ); } )                               , "validate clusters" )
@@ -194,7 +340,18 @@ void Configuration::FromVector( const std::vector< std::string >& aArgs )
 
     ( "r",            po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ mClusterR=StrToDist(aArg); } )                         , "R for clustering" )
     ( "t",            po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ mClusterT=StrToDist(aArg); } )                         , "T for clustering" )
+    ( "rt",           po::value<tVS>()->composing()->multitoken()->notifier( [&]( const  tVS& aArg ){ for( auto& i : aArg ) { 
+                                                                                                        std::vector<std::string> lStrs; 
+                                                                                                        boost::split( lStrs , i , [](char c){return c==':';} ); 
+                                                                                                        mClusterRT.emplace_back( StrToDist( lStrs.at(0) ) , StrToDist( lStrs.at(1) ) ); 
+                                                                                                      } 
+                                                                                                    } )                                                       , "List of colon-separated R:T pairs for clustering" )
     ( "threads",      po::value<tZ>( &Nthreads )                                                                                                              , "Number of threads to use (default is value given by std::threads::hardware_concurrency())" )
+    ( "trace",        po::value<tS>()                             ->notifier( [&]( const   tS& aArg ){ Instrumentation::SetTraceFile( aArg ); } )             , "Write a Chrome trace-event JSON of the instrumentation to the given file, and print a summary" )
+    ( "memory-budget", po::value<tD>()                            ->notifier( [&]( const   tD& aArg ){ SetMemoryBudget( aArg ); } )                          , "Memory budget in MB: the thread count is chosen so that the estimated footprint fits, or the run is refused before loading" )
+    ( "proto-on-the-fly", po::bool_switch()                       ->notifier( [&]( const bool& aArg ){ if( aArg ) SetProtoClustersOnTheFly( true ); } )       , "Compute each point's contribution to its cluster from its position and uncertainty during clusterization, rather than storing a proto-cluster per point" )
+    ( "two-phase",    po::bool_switch()                           ->notifier( [&]( const bool& aArg ){ if( aArg ) SetTwoPhaseClusterize( true ); } )          , "Clusterize in two phases: find the connected components with integer labels alone, then reduce the parameters of each changed component in a single sweep" )
+    ( "perf-counters", po::bool_switch()                          ->notifier( [&]( const bool& aArg ){ if( aArg ) PerfCounters::Enable(); } )                  , "Profile each stage with the hardware performance counters, and print a summary" )
   ;
 
   po::variables_map lVm;
@@ -203,6 +360,11 @@ void Configuration::FromVector( const std::vector< std::string >& aArgs )
  
   if( Nr ) SetRBins( Nr , rLo , rHi );
   if( Nt ) SetTBins( Nt , tLo, tHi );
+  if( AdaptiveStride ) SetAdaptive( AdaptiveStride , AdaptiveTop );
+  if( PrescanFraction ) SetPrescan( PrescanFraction , PrescanMargin );
+  if( DensityMapFile.size() or AutoRoI ) SetDensityMap( DensityMapFile , StrToDist( DensityBin ) , RoIThreshold , AutoRoI );
+  if( CheckpointFile.size() ) SetCheckpoint( CheckpointFile , CheckpointInterval , CheckpointEvent , Resume );
+  else if( CheckpointEvent or Resume ) throw std::runtime_error( "--checkpoint-event and --resume require --checkpoint" );
 
   if( Nsig )
   {
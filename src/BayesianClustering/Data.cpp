@@ -9,10 +9,13 @@
 #include "BayesianClustering/Event.hpp"
 #include "BayesianClustering/Configuration.hpp"
 
+/* ===== Local utilities ===== */
+#include "Utilities/Instrumentation.hpp"
+
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 Data::Data( const PRECISION& aX , const PRECISION& aY , const PRECISION& aS ) : 
 x(aX) , y(aY) , s(aS) , r2( (aX*aX) + (aY*aY) ), r( sqrt( r2 ) ), phi( atan2( aY , aX ) ),
-mProtoCluster( NULL )
+mProtoCluster( NULL ) , mUncertaintyClass( 0 )
 {}
 
 Data::~Data()
@@ -24,12 +27,15 @@ Data::~Data()
 // Although the neighbourhood calculation is reciprocal (if I am your neighbour then you are mine) and we can, in fact, use that to halve the number of calculations,
 // doing so requires arbitration between threads or a single-threaded reciprocation step, both of which take longer than brute-forcing it
 __attribute__((flatten))
-void Data::Preprocess( std::vector<Data>& aData , const std::size_t& aIndex )
+void Data::Preprocess( std::vector<Data>& aData , const std::size_t& aIndex , const double& aMax2R , const Configuration& aConfiguration )
 {
   static constexpr double pi = atan(1)*4;  
-  auto dphi = asin( Configuration::Instance.max2R() / r ); // Configuration::Instance.max2R() / ( r - aParameters.max2R() );
+  const double lMax2R2( aMax2R * aMax2R );
+  auto dphi = asin( aMax2R / r ); // aMax2R / ( r - aMax2R );
   auto dphi2 = (2*pi) - dphi;
 
+  mNeighbours.clear();
+
   std::size_t i( aIndex + 1 );
   std::vector<Data>::const_iterator aPlusIt( aData.begin() + aIndex + 1 );
   const std::vector<Data>::const_iterator aPlusEnd( aData.end() );
@@ -37,11 +43,11 @@ void Data::Preprocess( std::vector<Data>& aData , const std::size_t& aIndex )
   // Iterate over other hits and populate the mNeighbour list
   for( ; aPlusIt != aPlusEnd ; ++aPlusIt , ++i )
   {
-    if( ( aPlusIt->r - r ) > Configuration::Instance.max2R() ) break; // aPlusIt is always further out than curent 
+    if( ( aPlusIt->r - r ) > aMax2R ) break; // aPlusIt is always further out than curent 
     auto lPhi = dPhi( *aPlusIt );
     if( lPhi > dphi and lPhi < dphi2 ) continue;
     PRECISION ldR2 = dR2( *aPlusIt );
-    if( ldR2 < Configuration::Instance.max2R2() ) mNeighbours.push_back( std::make_pair( ldR2 , i ) );
+    if( ldR2 < lMax2R2 ) mNeighbours.push_back( std::make_pair( ldR2 , i ) );
   }
 
   i = aIndex - 1;
@@ -50,36 +56,39 @@ void Data::Preprocess( std::vector<Data>& aData , const std::size_t& aIndex )
 
   for( ; aMinusIt != aMinusEnd ; ++aMinusIt , --i )
   {
-    if( ( r - aMinusIt->r ) > Configuration::Instance.max2R() ) break; // curent is always further out than aMinusIn
+    if( ( r - aMinusIt->r ) > aMax2R ) break; // curent is always further out than aMinusIn
     auto lPhi = dPhi( *aMinusIt );
     if( lPhi > dphi and lPhi < dphi2 ) continue;
     PRECISION ldR2 = dR2( *aMinusIt );    
-    if( ldR2 < Configuration::Instance.max2R2() ) mNeighbours.push_back( std::make_pair( ldR2 , i ) );
+    if( ldR2 < lMax2R2 ) mNeighbours.push_back( std::make_pair( ldR2 , i ) );
   }
 
   std::sort( mNeighbours.begin() , mNeighbours.end() );
+  INSTRUMENT_FILL( "Preprocess neighbours per point" , mNeighbours.size() );
 
   // -------------------------------------------------------------------------------------
 
-  mProtoCluster = new Cluster( *this );
+  if( !mProtoCluster and !aConfiguration.protoClustersOnTheFly() ) mProtoCluster = new Cluster( *this , aConfiguration );
 
   // -------------------------------------------------------------------------------------
 }
 
 
 __attribute__((flatten))
-void Data::PreprocessLocalizationScores( std::vector<Data>& aData )
+void Data::PreprocessLocalizationScores( std::vector<Data>& aData , const Configuration& aConfiguration )
 {
   static constexpr double pi = atan(1)*4;
-  const double lLocalizationConstant( Configuration::Instance.getArea() / ( pi * ( aData.size() - 1 ) ) ); 
+  const double lLocalizationConstant( aConfiguration.getArea() / ( pi * ( aData.size() - 1 ) ) ); 
 
   auto lNeighbourit( mNeighbours.begin() );
   PRECISION lLocalizationSum( 0 ) , lLastLocalizationSum( 0 ) , lLocalizationScore( 0 );
-  mLocalizationScores.reserve( Configuration::Instance.Rbins() );
+  mLocalizationScores.clear();
+  mLocalizationScores.reserve( aConfiguration.Rbins() );
 
-  double R( Configuration::Instance.minScanR() ) , R2( 0 );
-  for( uint32_t i(0) ; i!=Configuration::Instance.Rbins() ; ++i , R+=Configuration::Instance.dR() )
+  double R( 0 ) , R2( 0 );
+  for( uint32_t i(0) ; i!=aConfiguration.Rbins() ; ++i )
   {
+    R = aConfiguration.Rvalue( i );
     R2 = R * R;
 
     for(  ; lNeighbourit != mNeighbours.end() ; ++lNeighbourit )
@@ -99,19 +108,15 @@ void Data::PreprocessLocalizationScores( std::vector<Data>& aData )
 }
 
 
-PRECISION Data::CalculateLocalizationScore( const std::vector<Data>& aData , const double& R ) const
+PRECISION Data::CalculateLocalizationScore( const std::vector<Data>& aData , const double& R , const Configuration& aConfiguration ) const
 {
   static constexpr double pi = atan(1)*4;  
   auto R2 = R * R;
 
-  const double lLocalizationConstant( Configuration::Instance.getArea() / ( pi * ( aData.size() - 1 ) ) ); 
-  PRECISION lLocalizationSum( 0 );
+  const double lLocalizationConstant( aConfiguration.getArea() / ( pi * ( aData.size() - 1 ) ) ); 
 
-  for( auto lNeighbourit( mNeighbours.begin() ) ; lNeighbourit != mNeighbours.end() ; ++lNeighbourit )
-  { 
-    if( lNeighbourit->first > R2 ) break;
-    lLocalizationSum += 1;
-  }
+  // The neighbours are sorted by distance, so count those within R by bisection
+  const PRECISION lLocalizationSum( std::upper_bound( mNeighbours.begin() , mNeighbours.end() , R2 , []( const double& aR2 , const std::pair< PRECISION , std::size_t >& aNeighbour ){ return aR2 < aNeighbour.first; } ) - mNeighbours.begin() );
 
   return sqrt( lLocalizationConstant * lLocalizationSum );
 
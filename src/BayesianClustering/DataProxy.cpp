@@ -5,6 +5,9 @@
 #include "BayesianClustering/Cluster.hpp"
 #include "BayesianClustering/EventProxy.hpp"
 
+/* ===== Local utilities ===== */
+#include "Utilities/Instrumentation.hpp"
+
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 DataProxy::DataProxy( Data& aData ) :
@@ -16,7 +19,8 @@ void DataProxy::Clusterize( const PRECISION& a2R2 , EventProxy& aEvent ) // We a
 {
   if( mCluster || mExclude ) return;
 
-  aEvent.mClusters.emplace_back();
+  aEvent.mClusters.emplace_back( aEvent.configuration() );
+  aEvent.mChangedClusters.push_back( &aEvent.mClusters.back() );
   Clusterize( a2R2 , aEvent , &aEvent.mClusters.back() );
 }
 
@@ -28,18 +32,21 @@ void DataProxy::Clusterize( const PRECISION& a2R2 , EventProxy& aEvent , Cluster
     *aCluster += *mCluster;
     mCluster->mParent = aCluster;
     mCluster->mClusterSize = 0;
+    aEvent.mChangedClusters.push_back( mCluster );
     mCluster = aCluster;
   }
   else
   {
     if( mExclude ) return;
 
-    *aCluster += *(mData->mProtoCluster);
+    if( mData->mProtoCluster ) *aCluster += *(mData->mProtoCluster);
+    else aCluster->Add( *mData , aEvent.configuration() );
     mCluster = aCluster;
 
     for( auto& i : mData->mNeighbours )
     {
       if( i.first > a2R2 ) break;
+      INSTRUMENT_COUNT( "Clusterize neighbour edges" , 1 );
       aEvent.GetData( i.second ).Clusterize( a2R2 , aEvent , aCluster );
     }  
   }
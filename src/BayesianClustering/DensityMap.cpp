@@ -0,0 +1,170 @@
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/DensityMap.hpp"
+
+// /* ===== C++ ===== */
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+//! The half-width, in bins, of the box over which the map is smoothed before thresholding, so that sparse but neighbouring bins merge into one region
+constexpr long SmoothingRadius = 2;
+
+//! The fewest bins above threshold for a connected region to be a candidate RoI
+constexpr std::size_t MinimumRoIBins = 4;
+
+//! The margin, in bins, added around the first localization and to each subsequent growth, so that the map is resized only a handful of times
+constexpr long GrowthMargin = 64;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+DensityMap::DensityMap( const double& aBinSize ) : mBinSize( aBinSize ) , mX0( 0 ) , mY0( 0 ) , mColumns( 0 ) , mRows( 0 ) , mEntries( 0 )
+{}
+
+void DensityMap::Resize( const long& aX0 , const long& aY0 , const long& aX1 , const long& aY1 )
+{
+  const std::size_t lColumns( aX1 - aX0 ) , lRows( aY1 - aY0 );
+  std::vector< uint32_t > lCounts( lColumns * lRows , 0 );
+  for( std::size_t y(0) ; y!=mRows ; ++y )
+    std::copy( mCounts.begin() + ( y * mColumns ) , mCounts.begin() + ( ( y + 1 ) * mColumns ) , lCounts.begin() + ( ( y + mY0 - aY0 ) * lColumns ) + ( mX0 - aX0 ) );
+
+  mCounts.swap( lCounts );
+  mX0 = aX0;
+  mY0 = aY0;
+  mColumns = lColumns;
+  mRows = lRows;
+}
+
+void DensityMap::GrowAndFill( const long& aX , const long& aY )
+{
+  if( mCounts.empty() )
+  {
+    mX0 = aX; mY0 = aY; // So that the empty map is resized around the first localization
+    Resize( aX - GrowthMargin , aY - GrowthMargin , aX + GrowthMargin + 1 , aY + GrowthMargin + 1 );
+  }
+  else
+  {
+    // Grow by at least the current extent in the direction of the localization, so that the cost of resizing is amortized
+    const long lColumns( mColumns ) , lRows( mRows ) , lX1( mX0 + lColumns ) , lY1( mY0 + lRows );
+    Resize( aX <  mX0 ? std::min( aX - GrowthMargin , mX0 - lColumns ) : mX0 ,
+            aY <  mY0 ? std::min( aY - GrowthMargin , mY0 - lRows ) : mY0 ,
+            aX >= lX1 ? std::max( aX + GrowthMargin + 1 , lX1 + lColumns ) : lX1 ,
+            aY >= lY1 ? std::max( aY + GrowthMargin + 1 , lY1 + lRows ) : lY1 );
+  }
+  ++mCounts[ ( ( aY - mY0 ) * mColumns ) + ( aX - mX0 ) ];
+  ++mEntries;
+}
+
+void DensityMap::Merge( const DensityMap& aOther )
+{
+  if( aOther.mCounts.empty() ) return;
+  if( aOther.mBinSize != mBinSize ) throw std::runtime_error( "Cannot merge density maps with different bin sizes" );
+
+  const long lX1( mX0 + long( mColumns ) ) , lY1( mY0 + long( mRows ) ) , lOtherX1( aOther.mX0 + long( aOther.mColumns ) ) , lOtherY1( aOther.mY0 + long( aOther.mRows ) );
+  if( mCounts.empty() )
+  {
+    mX0 = aOther.mX0; mY0 = aOther.mY0;
+    Resize( aOther.mX0 , aOther.mY0 , lOtherX1 , lOtherY1 );
+  }
+  else if( aOther.mX0 < mX0 or aOther.mY0 < mY0 or lOtherX1 > lX1 or lOtherY1 > lY1 )
+  {
+    Resize( std::min( mX0 , aOther.mX0 ) , std::min( mY0 , aOther.mY0 ) , std::max( lX1 , lOtherX1 ) , std::max( lY1 , lOtherY1 ) );
+  }
+
+  for( std::size_t y(0) ; y!=aOther.mRows ; ++y )
+  {
+    auto lTarget( mCounts.begin() + ( ( y + aOther.mY0 - mY0 ) * mColumns ) + ( aOther.mX0 - mX0 ) );
+    for( std::size_t x(0) ; x!=aOther.mColumns ; ++x ) lTarget[x] += aOther.mCounts[ ( y * aOther.mColumns ) + x ];
+  }
+  mEntries += aOther.mEntries;
+}
+
+std::vector< RegionOfInterest > DensityMap::Candidates( const double& aThreshold ) const
+{
+  std::vector< RegionOfInterest > lCandidates;
+  if( !mEntries ) return lCandidates;
+
+  // Summed-area table, for box sums in constant time
+  const std::size_t lStride( mColumns + 1 );
+  std::vector< uint64_t > lSums( lStride * ( mRows + 1 ) , 0 );
+  for( std::size_t y(0) ; y!=mRows ; ++y )
+    for( std::size_t x(0) ; x!=mColumns ; ++x )
+      lSums[ ( ( y + 1 ) * lStride ) + x + 1 ] = mCounts[ ( y * mColumns ) + x ] + lSums[ ( y * lStride ) + x + 1 ] + lSums[ ( ( y + 1 ) * lStride ) + x ] - lSums[ ( y * lStride ) + x ];
+
+  auto BoxSum = [&]( const long& aX0 , const long& aY0 , const long& aX1 , const long& aY1 ){ // Inclusive of the lower bounds, exclusive of the upper
+    const long lX0( std::max( aX0 , 0L ) ) , lY0( std::max( aY0 , 0L ) ) , lX1( std::min( aX1 , long( mColumns ) ) ) , lY1( std::min( aY1 , long( mRows ) ) );
+    return lSums[ ( lY1 * lStride ) + lX1 ] - lSums[ ( lY0 * lStride ) + lX1 ] - lSums[ ( lY1 * lStride ) + lX0 ] + lSums[ ( lY0 * lStride ) + lX0 ];
+  };
+
+  std::vector< uint64_t > lSmoothed( mCounts.size() );
+  for( long y(0) ; y!=long( mRows ) ; ++y )
+    for( long x(0) ; x!=long( mColumns ) ; ++x )
+      lSmoothed[ ( y * mColumns ) + x ] = BoxSum( x - SmoothingRadius , y - SmoothingRadius , x + SmoothingRadius + 1 , y + SmoothingRadius + 1 );
+
+  const double lCut( aThreshold * *std::max_element( lSmoothed.begin() , lSmoothed.end() ) );
+
+  // Label the 8-connected regions above threshold, recording the bounding box of each
+  std::vector< uint8_t > lVisited( mCounts.size() , 0 );
+  std::vector< std::pair< long , long > > lStack;
+  std::vector< std::pair< uint64_t , RegionOfInterest > > lRegions;
+  for( long y(0) ; y!=long( mRows ) ; ++y )
+    for( long x(0) ; x!=long( mColumns ) ; ++x )
+    {
+      if( lVisited[ ( y * mColumns ) + x ] or !( lSmoothed[ ( y * mColumns ) + x ] > lCut ) ) continue;
+
+      long lXLo( x ) , lXHi( x ) , lYLo( y ) , lYHi( y );
+      std::size_t lBins( 0 );
+      lStack.emplace_back( x , y );
+      lVisited[ ( y * mColumns ) + x ] = 1;
+      while( lStack.size() )
+      {
+        const auto lBin( lStack.back() );
+        lStack.pop_back();
+        ++lBins;
+        lXLo = std::min( lXLo , lBin.first ); lXHi = std::max( lXHi , lBin.first );
+        lYLo = std::min( lYLo , lBin.second ); lYHi = std::max( lYHi , lBin.second );
+        for( long j( std::max( lBin.second - 1 , 0L ) ) ; j <= std::min( lBin.second + 1 , long( mRows ) - 1 ) ; ++j )
+          for( long i( std::max( lBin.first - 1 , 0L ) ) ; i <= std::min( lBin.first + 1 , long( mColumns ) - 1 ) ; ++i )
+          {
+            const std::size_t lIndex( ( j * mColumns ) + i );
+            if( lVisited[ lIndex ] or !( lSmoothed[ lIndex ] > lCut ) ) continue;
+            lVisited[ lIndex ] = 1;
+            lStack.emplace_back( i , j );
+          }
+      }
+      if( lBins < MinimumRoIBins ) continue;
+
+      const RegionOfInterest lRoI{ ( mX0 + ( ( lXLo + lXHi + 1 ) / 2.0 ) ) * mBinSize , ( mY0 + ( ( lYLo + lYHi + 1 ) / 2.0 ) ) * mBinSize , ( lXHi - lXLo + 1 ) * mBinSize , ( lYHi - lYLo + 1 ) * mBinSize };
+      lRegions.emplace_back( BoxSum( lXLo , lYLo , lXHi + 1 , lYHi + 1 ) , lRoI );
+    }
+
+  std::stable_sort( lRegions.begin() , lRegions.end() , []( const std::pair< uint64_t , RegionOfInterest >& a , const std::pair< uint64_t , RegionOfInterest >& b ){ return a.first > b.first; } );
+  for( auto& i : lRegions ) lCandidates.push_back( i.second );
+  return lCandidates;
+}
+
+void DensityMap::Write( const std::string& aFilename , const std::vector< RegionOfInterest >& aCandidates ) const
+{
+  std::ofstream lFile( aFilename );
+  if( !lFile ) throw std::runtime_error( "Unable to open " + aFilename + " for writing" );
+
+  // Only the bounding box of the occupied bins is written, not the margins left by growing the map
+  std::size_t lXLo( mColumns ) , lXHi( 0 ) , lYLo( mRows ) , lYHi( 0 );
+  for( std::size_t y(0) ; y!=mRows ; ++y )
+    for( std::size_t x(0) ; x!=mColumns ; ++x )
+      if( mCounts[ ( y * mColumns ) + x ] )
+      {
+        lXLo = std::min( lXLo , x ); lXHi = std::max( lXHi , x + 1 );
+        lYLo = std::min( lYLo , y ); lYHi = std::max( lYHi , y + 1 );
+      }
+  if( lXLo > lXHi ) lXLo = lXHi = lYLo = lYHi = 0;
+
+  lFile << "# Density map of " << mEntries << " localizations: " << lXHi - lXLo << "x" << lYHi - lYLo << " bins of " << mBinSize / nanometer << "nm, the first centred at x=" << ( mX0 + long( lXLo ) + 0.5 ) * mBinSize / nanometer << "nm, y=" << ( mY0 + long( lYLo ) + 0.5 ) * mBinSize / nanometer << "nm\n";
+  for( auto& i : aCandidates ) lFile << "# --roi " << i.mCentreX / nanometer << "nm " << i.mCentreY / nanometer << "nm " << i.mWidthX / nanometer << "nm " << i.mWidthY / nanometer << "nm\n";
+  for( std::size_t y( lYLo ) ; y!=lYHi ; ++y )
+  {
+    for( std::size_t x( lXLo ) ; x!=lXHi ; ++x ) lFile << ( x!=lXLo ? "," : "" ) << mCounts[ ( y * mColumns ) + x ];
+    lFile << "\n";
+  }
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
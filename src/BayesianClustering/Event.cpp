@@ -1,144 +1,573 @@
 
+/* ===== BOOST libraries ===== */
+#include <boost/math/special_functions/gamma.hpp>
+
 /* ===== Cluster sources ===== */
 #include "BayesianClustering/Event.hpp"
 #include "BayesianClustering/EventProxy.hpp"
 #include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Checkpoint.hpp"
+#include "BayesianClustering/LocalizationStore.hpp"
 
 /* ===== Local utilities ===== */
 #include "Utilities/ProgressBar.hpp"
 #include "Utilities/Vectorize.hpp"
+#include "Utilities/ParallelSort.hpp"
+#include "Utilities/PerfCounters.hpp"
+#include "Utilities/ProcessMemory.hpp"
 
 // /* ===== C++ ===== */
 #include <iostream>
+#include <set>
+#include <mutex>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <queue>
+#include <tuple>
+#include <cstring>
 
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-Configuration Configuration::Instance;
-
-Event::Event()
+Event::Event( const Configuration& aConfiguration ) : mConfiguration( aConfiguration ) , mThreads( Threads() )
 {
-  const std::string& lFilename = Configuration::Instance.inputFile();
+  const std::string& lFilename = mConfiguration.inputFile();
   if( lFilename.size() == 0 ) throw std::runtime_error( "No input file specified" ); 
 
   LoadCSV( lFilename );
+  RecordMemory( "Load" );
 }
 
+Event::Event( const Configuration& aConfiguration , const double* aX , const double* aY , const double* aS , const std::size_t& aCount ) : mConfiguration( aConfiguration ) , mThreads( Threads() )
+{
+  const double lMaxX( mConfiguration.getWidthX() / 2 ) , lMaxY( mConfiguration.getWidthY() / 2 );
+  const double lCentreX( mConfiguration.getCentreX() ) , lCentreY( mConfiguration.getCentreY() );
+
+  PerfCounters::StageScope lPerf( PerfCounters::Load );
+  ProgressBar2 lProgressBar( "Loading from memory" , aCount );
+
+  // Crop in parallel blocks, preserving the input order within each block
+  std::vector< std::vector< Data > > lData( mThreads );
+  const std::size_t lChunkSize( ceil( double( aCount ) / mThreads ) );
+  [&]( const std::size_t& i ){ 
+    for( std::size_t j( i * lChunkSize ) ; j < std::min( aCount , ( i + 1 ) * lChunkSize ) ; ++j )
+    {
+      const double x( aX[j] - lCentreX ) , y( aY[j] - lCentreY );
+      if( fabs(x) < lMaxX and fabs(y) < lMaxY ) lData[i].emplace_back( x , y , aS[j] );
+    }
+  } && range( mThreads );
+
+  std::size_t lSize( 0 );
+  for( auto& i : lData ) lSize += i.size();
+  mData.reserve( lSize );
+  for( auto& i : lData ) mData.insert( mData.end() , std::make_move_iterator( i.begin() ) , std::make_move_iterator( i.end() ) );
+
+  ParallelSort( mData.begin() , mData.end() );
+
+  std::cout << "Loaded " << mData.size() << " of " << aCount << " points" << std::endl;
+  RecordMemory( "Load" );
+}
+
+//! Utility function to check that the x, y and s vectors are the same length
+//! \param aX The x-positions of the data-points
+//! \param aY The y-positions of the data-points
+//! \param aS The uncertainties of the data-points
+//! \return The common length
+inline std::size_t CommonSize( const std::vector< double >& aX , const std::vector< double >& aY , const std::vector< double >& aS )
+{
+  if( aY.size() != aX.size() or aS.size() != aX.size() ) throw std::runtime_error( "x, y and s must be the same length" );
+  return aX.size();
+}
+
+Event::Event( const Configuration& aConfiguration , const std::vector< double >& aX , const std::vector< double >& aY , const std::vector< double >& aS ) :
+  Event( aConfiguration , aX.data() , aY.data() , aS.data() , CommonSize( aX , aY , aS ) )
+{}
+
+Event::Event( const Configuration& aConfiguration , const LocalizationStore& aStore ) : mConfiguration( aConfiguration ) , mThreads( Threads() )
+{
+  const double lMaxX( mConfiguration.getWidthX() / 2 ) , lMaxY( mConfiguration.getWidthY() / 2 );
+  const double lCentreX( mConfiguration.getCentreX() ) , lCentreY( mConfiguration.getCentreY() );
+
+  PerfCounters::StageScope lPerf( PerfCounters::Load );
+  ProgressBar2 lProgressBar( "Cropping from the store" , 0 );
+
+  // Only the grid cells overlapping the RoI are visited
+  const auto lRanges( aStore.Ranges( lCentreX , lCentreY , mConfiguration.getWidthX() , mConfiguration.getWidthY() ) );
+  std::vector< std::vector< Data > > lData( lRanges.size() );
+  [&]( const std::size_t& i ){ 
+    for( std::size_t j( lRanges[i].first ) ; j!=lRanges[i].second ; ++j )
+    {
+      const Localization& lLocalization( aStore.mLocalizations[j] );
+      const double x( lLocalization.x - lCentreX ) , y( lLocalization.y - lCentreY );
+      if( fabs(x) < lMaxX and fabs(y) < lMaxY ) lData[i].emplace_back( x , y , lLocalization.s );
+    }
+  } || range( lRanges.size() );
+
+  std::size_t lSize( 0 );
+  for( auto& i : lData ) lSize += i.size();
+  mData.reserve( lSize );
+  for( auto& i : lData ) mData.insert( mData.end() , std::make_move_iterator( i.begin() ) , std::make_move_iterator( i.end() ) );
+
+  ParallelSort( mData.begin() , mData.end() );
+
+  std::cout << "Cropped " << mData.size() << " of " << aStore.mLocalizations.size() << " points" << std::endl;
+  RecordMemory( "Load" );
+}
+
+Event::Event( const Configuration& aConfiguration , std::vector<Data>&& aData ) : mData( std::move( aData ) ) , mConfiguration( aConfiguration ) , mThreads( Threads() )
+{}
+
 void Event::Preprocess()
 {
+  Preprocess( mConfiguration.maxR() );
+}
+
+void Event::Preprocess( const double& aMaxR )
+{
+  ScopedThreads lThreads( mThreads ); // The concurrency of the event, whichever thread it is used from
+  PreprocessUncertaintyClasses();
+  PreprocessLogGammaTables();
+  if( aMaxR <= mPreprocessedR ) return; // The cached neighbourhoods already extend far enough
+
   // Populate mNeighbour lists  
+  const double lMax2R( 2.0 * aMaxR );
+  PerfCounters::StageScope lPerf( PerfCounters::Preprocess );
   ProgressBar2 lProgressBar( "Populating neighbourhood" , mData.size() );
-  [&]( const std::size_t& i ){ mData.at( i ).Preprocess( mData , i ); } || range( mData.size() );  // Interleave threading since processing time increases with radius from origin
+  [&]( const std::size_t& i ){ mData.at( i ).Preprocess( mData , i , lMax2R , mConfiguration ); } || range( mData.size() );  // Interleave threading since processing time increases with radius from origin
+  mPreprocessedR = aMaxR;
+  RecordMemory( "Preprocess" );
 }
 
-void Event::ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback ) 
+void Event::PreprocessScan()
 {
+  ScopedThreads lThreads( mThreads );
   Preprocess();    
 
+  if( mLocalizationScoresReady ) return;
+  PerfCounters::StageScope lPerf( PerfCounters::LocalizationScores );
+  ProgressBar2 lProgressBar( "Populating localization scores" , mData.size() );
+  [&]( const std::size_t& i ){ mData.at( i ).PreprocessLocalizationScores( mData , mConfiguration ); } || range( mData.size() );  // Interleave threading since processing time increases with radius from origin
+  PreprocessBreakpoints();
+  mLocalizationScoresReady = true;
+  RecordMemory( "LocalizationScores" );
+}
+
+void Event::PreprocessUncertaintyClasses()
+{
+  const std::size_t lClasses( mConfiguration.uncertaintyClasses() );
+  if( !lClasses or mUncertaintyClassesReady ) return;
+
+  // Equally-populated classes in order of uncertainty, each represented by the mean of the squared uncertainties of its members
+  std::vector< std::pair< PRECISION , std::size_t > > lOrder( mData.size() );
+  for( std::size_t i(0) ; i!=mData.size() ; ++i ) lOrder[i] = std::make_pair( mData[i].s , i );
+  std::sort( lOrder.begin() , lOrder.end() );
+
+  std::vector< double > lS2( lClasses , 0.0 );
+  for( std::size_t k(0) ; k!=lClasses ; ++k )
+  {
+    const std::size_t lBegin( ( k * lOrder.size() ) / lClasses ) , lEnd( ( ( k + 1 ) * lOrder.size() ) / lClasses );
+    for( std::size_t i( lBegin ) ; i!=lEnd ; ++i )
+    {
+      mData[ lOrder[i].second ].mUncertaintyClass = k;
+      lS2[k] += lOrder[i].first * lOrder[i].first;
+    }
+    if( lEnd > lBegin ) lS2[k] /= ( lEnd - lBegin );
+  }
+  mConfiguration.SetUncertaintyClassTable( lS2 );
+
+  // The largest relative error of the weight of any point, which is largest for the smallest sigma hypothesis
+  double lMaxError( 0.0 );
+  for( auto& i : mData )
   {
-    ProgressBar2 lProgressBar( "Populating localization scores" , mData.size() );
-    [&]( const std::size_t& i ){ mData.at( i ).PreprocessLocalizationScores( mData ); } || range( mData.size() );  // Interleave threading since processing time increases with radius from origin
+    const double lS2Point( i.s * i.s ) , lSigma2( mConfiguration.sigmabins2( 0 ) );
+    lMaxError = std::max( lMaxError , fabs( lS2[ i.mUncertaintyClass ] - lS2Point ) / ( lS2[ i.mUncertaintyClass ] + lSigma2 ) );
   }
+  std::cout << "Quantized the uncertainties of " << mData.size() << " points into " << lClasses << " classes: largest relative error of a weight " << lMaxError << std::endl;
+  mUncertaintyClassesReady = true;
+}
+
+void Event::PreprocessLogGammaTables()
+{
+  if( mLogGamma.size() == mData.size() + 1 ) return;
+
+  // lgamma( 0 ) is never needed, since an empty cluster contributes nothing
+  mLogGamma.resize( mData.size() + 1 );
+  mLogGammaAlpha.resize( mData.size() + 1 );
+  mLogGamma[0] = 0.0;
+  mLogGammaAlpha[0] = boost::math::lgamma( mConfiguration.alpha() );
+  [&]( const std::size_t& i ){
+    if( i ) mLogGamma[i] = boost::math::lgamma( double( i ) );
+    mLogGammaAlpha[i] = boost::math::lgamma( mConfiguration.alpha() + i );
+  } && range( mData.size() + 1 );
+}
+
+void Event::PreprocessBreakpoints()
+{
+  const uint32_t lRbins( mConfiguration.Rbins() ) , lTbins( mConfiguration.Tbins() );
+  mTBreakpoints.assign( std::size_t( lRbins ) * lTbins , 0 );
+  mRRepresentative.resize( lRbins );
+  std::vector< uint8_t > lRChanged( lRbins , 1 );
+  if( !lTbins ) return;
+
+  const double lT0( mConfiguration.Tvalue( 0 ) ) , lDT( lTbins > 1 ? lT0 - mConfiguration.Tvalue( 1 ) : 0.0 );
+
+  // Parallelize over R-bins, so that each writes only its own row
+  [&]( const std::size_t& i ){
+    // A data-point joins the inclusion set at the first T-bin (T is scanned from high to low) at which its score is no longer below T, exactly as tested by the scan
+    auto lRow( mTBreakpoints.begin() + ( i * lTbins ) );
+    for( auto& k : mData )
+    {
+      const PRECISION lScore( k.mLocalizationScores[i] );
+      uint32_t j( lDT > 0 ? std::min( std::max( ceil( ( lT0 - lScore ) / lDT ) , 0.0 ) , double( lTbins ) ) : 0 );
+      while( j > 0 and !( lScore < mConfiguration.Tvalue( j-1 ) ) ) --j;
+      while( j < lTbins and lScore < mConfiguration.Tvalue( j ) ) ++j;
+      if( j < lTbins ) ++lRow[j];
+    }
+    std::partial_sum( lRow , lRow + lTbins , lRow );
+
+    // An R-bin shares the clusterizations of the R-bin before if no data-point changes its score or gains a neighbour edge between them
+    if( i == 0 ) return;
+    const double lLastR( mConfiguration.Rvalue( i-1 ) ) , lR( mConfiguration.Rvalue( i ) );
+    const PRECISION lLast2R2( 4.0 * lLastR * lLastR ) , l2R2( 4.0 * lR * lR ); // As passed to DataProxy::Clusterize
+    auto lCount = []( const std::vector< std::pair< PRECISION , std::size_t > >& aNeighbours , const PRECISION& a2R2 ){ 
+      return std::upper_bound( aNeighbours.begin() , aNeighbours.end() , a2R2 , []( const PRECISION& a , const std::pair< PRECISION , std::size_t >& b ){ return a < b.first; } ) - aNeighbours.begin(); 
+    };
+    for( auto& k : mData )
+    {
+      if( k.mLocalizationScores[i] != k.mLocalizationScores[i-1] ) return;
+      if( lCount( k.mNeighbours , l2R2 ) != lCount( k.mNeighbours , lLast2R2 ) ) return;
+    }
+    lRChanged[i] = 0;
+  } || range( lRbins );
+
+  for( uint32_t i(0) ; i!=lRbins ; ++i ) mRRepresentative[i] = lRChanged[i] ? i : mRRepresentative[i-1];
+}
+
+//! Report the number of cells of an RT-scan whose results were reused rather than reevaluated
+//! \param aProxies The event-proxies which ran the scan
+//! \param aCells   The number of cells in the scan
+void ReportSkippedCells( const std::vector< EventProxy >& aProxies , const std::size_t& aCells )
+{
+  std::size_t lSkipped( 0 );
+  for( auto& i : aProxies ) lSkipped += i.mSkippedCells;
+  std::cout << "  Reused the results of " << lSkipped << " of " << aCells << " cells with an unchanged clusterization" << std::endl;
+}
+
+//! Account the memory held by a collection of event-proxies
+//! \param aProxies The event-proxies
+//! \return The memory in bytes
+std::size_t ProxyMemory( const std::vector< EventProxy >& aProxies )
+{
+  std::size_t lBytes( 0 );
+  for( auto& i : aProxies ) lBytes += i.MemoryUsage();
+  return lBytes;
+}
+
+std::size_t Event::ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback ) 
+{
+  ScopedThreads lThreads( mThreads );
+  PreprocessScan();
 
   std::vector< EventProxy > lEventProxys;
-  lEventProxys.reserve( Nthreads );
-  for( int i(0) ; i!=Nthreads ; ++i ) lEventProxys.emplace_back( *this );
+  lEventProxys.reserve( mThreads );
+  for( std::size_t i(0) ; i!=mThreads ; ++i ) lEventProxys.emplace_back( *this );
   ProgressBar2 lProgressBar( "Scan over RT"  , 0 );
-  [&]( const std::size_t& i ){ lEventProxys.at(i).ScanRT( aCallback , Nthreads , i ); } || range( Nthreads );
+  [&]( const std::size_t& i ){ lEventProxys.at(i).ScanRT( aCallback , mThreads , i ); } || range( mThreads );
+  ReportSkippedCells( lEventProxys , mConfiguration.Rbins() * mConfiguration.Tbins() );
+  return ProxyMemory( lEventProxys );
+}
+
+std::size_t Event::ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const RTWindow& aWindow ) 
+{
+  std::map< uint32_t , std::vector< uint32_t > > lCells;
+  for( int i( aWindow.mRLo ) ; i <= aWindow.mRHi ; ++i )
+    for( int j( aWindow.mTLo ) ; j <= aWindow.mTHi ; ++j )
+      lCells[ i ].push_back( j );
+
+  return ScanRT( aCallback , lCells );
+}
+
+std::size_t Event::ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const std::map< uint32_t , std::vector< uint32_t > >& aCells ) 
+{
+  ScopedThreads lThreads( mThreads );
+  PreprocessScan();
+
+  std::size_t lCellCount( 0 );
+  for( auto& i : aCells ) lCellCount += i.second.size();
+
+  std::vector< EventProxy > lEventProxys;
+  lEventProxys.reserve( mThreads );
+  for( std::size_t i(0) ; i!=mThreads ; ++i ) lEventProxys.emplace_back( *this );
+  ProgressBar2 lProgressBar( "Scan over RT window"  , 0 );
+  [&]( const std::size_t& i ){ lEventProxys.at(i).ScanRT( aCallback , aCells , mThreads , i ); } || range( mThreads );
+  ReportSkippedCells( lEventProxys , lCellCount );
+  return ProxyMemory( lEventProxys );
+}
+
+Event Event::Subsample( const double& aFraction , const uint32_t& aSeed ) const
+{
+  ScopedThreads lThreads( mThreads ); // So that the subsample inherits the concurrency of the event
+  if( aFraction <= 0.0 or aFraction > 1.0 ) throw std::runtime_error( "Subsample fraction must be in the range (0,1]" );
+
+  // The data is sorted by radius, so drawing one point at random from each contiguous stratum preserves the ordering
+  const double lStratum( 1.0 / aFraction );
+  const std::size_t lCount( std::max( std::size_t( 2 ) , std::size_t( mData.size() * aFraction ) ) );
+
+  std::mt19937 lGenerator( aSeed );
+  std::uniform_real_distribution< double > lUniform( 0.0 , 1.0 );
+
+  std::vector< Data > lData;
+  lData.reserve( lCount );
+  for( std::size_t i(0) ; i!=lCount ; ++i )
+  {
+    const std::size_t lLo( i * lStratum ) , lHi( std::min( std::size_t( ( i + 1 ) * lStratum ) , mData.size() ) );
+    if( lLo >= lHi ) break;
+    auto& lPoint( mData[ lLo + std::size_t( lUniform( lGenerator ) * ( lHi - lLo ) ) ] );
+    lData.emplace_back( lPoint.x , lPoint.y , lPoint.s );
+  }
+
+  return Event( mConfiguration , std::move( lData ) );
+}
+
+RTWindow Event::PrescanRT()
+{
+  ScopedThreads lThreads( mThreads );
+  const int lRbins( mConfiguration.Rbins() ) , lTbins( mConfiguration.Tbins() );
+  if( lRbins < 1 or lTbins < 1 ) throw std::runtime_error( "Prescan requires at least one R bin and one T bin" );
+
+  // The localization constant is derived from the number of points in the event, so is automatically rescaled to the density of the subsample.
+  // P_b is a per-localization prior, which is invariant under uniform thinning, so needs no rescaling.
+  Event lSubsample( Subsample( mConfiguration.prescanFraction() ) );
+
+  std::vector< double > lScores( lRbins * lTbins , -9E99 );
+  {
+    ProgressBar2 lProgressBar( "Prescan on " + std::to_string( lSubsample.mData.size() ) + " of " + std::to_string( mData.size() ) + " points" , 0 );
+    lSubsample.ScanRT( [&]( const EventProxy& aProxy , const double& , const double& , std::pair<int,int> aIJ ){ lScores[ ( aIJ.first * lTbins ) + aIJ.second ] = aProxy.mLogP; } );
+  }
+
+  const int lBest( std::max_element( lScores.begin() , lScores.end() ) - lScores.begin() );
+  const int lBestR( lBest / lTbins ) , lBestT( lBest % lTbins );
+
+  const int lMarginR( mConfiguration.prescanMargin() ? mConfiguration.prescanMargin() : std::max( 2 , lRbins / 8 ) );
+  const int lMarginT( mConfiguration.prescanMargin() ? mConfiguration.prescanMargin() : std::max( 2 , lTbins / 8 ) );
+
+  RTWindow lWindow{ std::max( 0 , lBestR - lMarginR ) , std::min( lRbins-1 , lBestR + lMarginR ) , std::max( 0 , lBestT - lMarginT ) , std::min( lTbins-1 , lBestT + lMarginT ) };
+
+  std::cout << "  Prescan best cell (" << lBestR << ", " << lBestT << "): R = " << mConfiguration.Rvalue( lBestR ) << ", T = " << mConfiguration.Tvalue( lBestT ) << std::endl;
+  std::cout << "  Prescan window: R-bins " << lWindow.mRLo << " to " << lWindow.mRHi << " (R = " << mConfiguration.Rvalue( lWindow.mRLo ) << " to " << mConfiguration.Rvalue( lWindow.mRHi ) << ")"
+            << ", T-bins " << lWindow.mTLo << " to " << lWindow.mTHi << " (T = " << mConfiguration.Tvalue( lWindow.mTLo ) << " to " << mConfiguration.Tvalue( lWindow.mTHi ) << ")" << std::endl;
+
+  return lWindow;
+}
+
+std::map< std::pair<int,int> , AdaptiveScanCell > Event::AdaptiveScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , std::size_t* aProxyMemory )
+{
+  ScopedThreads lThreads( mThreads );
+  const int lRbins( mConfiguration.Rbins() ) , lTbins( mConfiguration.Tbins() );
+  int lStride( mConfiguration.adaptiveStride() );
+  if( lStride < 1 ) throw std::runtime_error( "Adaptive scan requires a coarse-grid spacing of at least 1 bin" );
+  if( lRbins < 1 or lTbins < 1 ) throw std::runtime_error( "Adaptive scan requires at least one R bin and one T bin" );
+
+  PreprocessScan();
+
+  std::vector< EventProxy > lEventProxys;
+  lEventProxys.reserve( mThreads );
+  for( std::size_t i(0) ; i!=mThreads ; ++i ) lEventProxys.emplace_back( *this );
+
+  std::map< std::pair<int,int> , AdaptiveScanCell > lSurface;
+  std::mutex lMutex;
+  uint32_t lLevel( 0 );
+
+  auto lRecord = [&]( const EventProxy& aProxy , const double& R , const double& T , std::pair<int,int> aIJ ){
+    {
+      std::lock_guard< std::mutex > lLock( lMutex );
+      lSurface[ aIJ ] = { R , T , aProxy.mLogP , aProxy.mClusteredCount , aProxy.mBackgroundCount , aProxy.mClusterCount , lLevel };
+    }
+    aCallback( aProxy , R , T , aIJ );
+  };
+
+  // Evaluate those of the requested cells which are inside the grid and have not already been evaluated
+  auto lEvaluate = [&]( const std::set< std::pair<int,int> >& aCells ){
+    std::map< uint32_t , std::vector< uint32_t > > lRows;
+    for( auto& i : aCells )
+    {
+      if( i.first < 0 or i.first >= lRbins or i.second < 0 or i.second >= lTbins ) continue;
+      if( lSurface.count( i ) ) continue;
+      lRows[ i.first ].push_back( i.second ); // std::set is ordered, so the T-indices are ascending
+    }
+    if( lRows.empty() ) return false;
+    [&]( const std::size_t& i ){ lEventProxys.at(i).ScanRT( lRecord , lRows , mThreads , i ); } || range( mThreads );
+    return true;
+  };
+
+  // The set of cells within +/-2 steps of a given cell - at unit stride, this is the window used for the best-RT estimate
+  auto lNeighbourhood = [&]( std::set< std::pair<int,int> >& aCells , const std::pair<int,int>& aCentre , const int& aStep ){
+    for( int i(-2) ; i!=3 ; ++i )
+      for( int j(-2) ; j!=3 ; ++j )
+        aCells.emplace( aCentre.first + ( i * aStep ) , aCentre.second + ( j * aStep ) );
+  };
+
+  ProgressBar2 lProgressBar( "Adaptive scan over RT"  , 0 );
+
+  // Level 0: the coarse grid, always including the last bin in each direction
+  {
+    std::set< std::pair<int,int> > lCells;
+    for( int i(0) ; i < lRbins + lStride - 1 ; i+=lStride )
+      for( int j(0) ; j < lTbins + lStride - 1 ; j+=lStride )
+        lCells.emplace( std::min( i , lRbins-1 ) , std::min( j , lTbins-1 ) );
+    lEvaluate( lCells );
+  }
+
+  // Subsequent levels: refine around the top-scoring cells with half the spacing until we reach unit spacing
+  while( lStride > 1 )
+  {
+    lStride = ( lStride + 1 ) / 2;
+    ++lLevel;
+
+    std::vector< std::pair< double , std::pair<int,int> > > lRanked;
+    lRanked.reserve( lSurface.size() );
+    for( auto& i : lSurface ) lRanked.emplace_back( i.second.mLogP , i.first );
+    auto lTop( lRanked.begin() + std::min( lRanked.size() , mConfiguration.adaptiveTop() ) );
+    std::partial_sort( lRanked.begin() , lTop , lRanked.end() , std::greater< std::pair< double , std::pair<int,int> > >() );
+
+    std::set< std::pair<int,int> > lCells;
+    for( auto i( lRanked.begin() ) ; i != lTop ; ++i ) lNeighbourhood( lCells , i->second , lStride );
+    lEvaluate( lCells );
+  }
+
+  // Final polish: make sure the unit-spaced window around the best cell is fully evaluated, following the best cell if it moves
+  ++lLevel;
+  while( true )
+  {
+    auto lBest = std::max_element( lSurface.begin() , lSurface.end() , []( const std::pair< const std::pair<int,int> , AdaptiveScanCell >& a , const std::pair< const std::pair<int,int> , AdaptiveScanCell >& b ){ return a.second.mLogP < b.second.mLogP; } );
+    std::set< std::pair<int,int> > lCells;
+    lNeighbourhood( lCells , lBest->first , 1 );
+    if( not lEvaluate( lCells ) ) break;
+  }
+
+  std::cout << "  Adaptive scan evaluated " << lSurface.size() << " of " << ( lRbins * lTbins ) << " cells in " << ( lLevel + 1 ) << " levels" << std::endl;
+  ReportSkippedCells( lEventProxys , lSurface.size() );
+  if( aProxyMemory ) *aProxyMemory = ProxyMemory( lEventProxys );
+
+  return lSurface;
 }
 
 void Event::Clusterize( const double& R , const double& T , const std::function< void( const EventProxy& ) >& aCallback )
 {
+  ScopedThreads lThreads( mThreads );
   if( R < 0 ) throw std::runtime_error( "R must be specified and non-negative" );
   if( T < 0 ) throw std::runtime_error( "T must be specified and non-negative" );
 
-  Preprocess();    
+  Preprocess( R );    
 
   EventProxy lProxy( *this );
   lProxy.Clusterize( R ,  T , aCallback );
 }
 
 /* ===== Function for loading a chunk of data from CSV file ===== */
-void __LoadCSV__( const std::string& aFilename , Event& aEvent , std::vector< Data >& aData , const std::size_t& aOffset , int aCount )
+void __LoadCSV__( const std::string& aFilename , Event& aEvent , std::vector< Data >& aData , DensityMap& aDensityMap , const std::size_t& aOffset , const std::size_t& aCount )
 {
-  const double lMaxX( Configuration::Instance.getWidthX() / 2 ) , lMaxY( Configuration::Instance.getWidthY() / 2 );
+  const Configuration& lConfiguration( aEvent.configuration() );
+  const double lMaxX( lConfiguration.getWidthX() / 2 ) , lMaxY( lConfiguration.getWidthY() / 2 );
+  const double lCentreX( lConfiguration.getCentreX() ) , lCentreY( lConfiguration.getCentreY() );
 
-  auto f = fopen( aFilename.c_str() , "rb");
-  if (fseek(f, aOffset, SEEK_SET)) throw std::runtime_error( "Fseek failed" ); // seek to offset from start_point
+  ParseLocalizations( aFilename , aOffset , aCount , [&]( const double& aX , const double& aY , const double& aS ){
+    aDensityMap.Fill( aX , aY );
+    const double x( aX - lCentreX ) , y( aY - lCentreY );
+    if( fabs(x) < lMaxX and fabs(y) < lMaxY ) aData.emplace_back( x , y , aS );
+  } );
 
-  char ch[256];
-  char* lPtr( ch );
+  std::sort( aData.begin() , aData.end() );
+}
+
+/* ===== Function for merging the sorted chunks loaded from a CSV file ===== */
+void __MergeChunks__( std::vector< std::vector< Data > >& aChunks , std::vector< Data >& aData )
+{
+  if( aChunks.size() == 1 and aData.empty() ){ aData.swap( aChunks.front() ); return; }
+
+  // Points are ordered by r, with ties broken by chunk then by position within the chunk, which reproduces the order of folding the chunks in turn with a stable merge
+  typedef std::tuple< PRECISION , std::size_t , std::size_t > tKey;
+  auto RLess = []( const Data& a , const PRECISION& b ){ return a.r < b; };
+  auto RGreater = []( const PRECISION& a , const Data& b ){ return a < b.r; };
+
+  // The number of points in a chunk which precede a key
+  auto Rank = [&]( const tKey& aKey , const std::size_t& aChunk ){
+    const std::vector< Data >& lChunk( aChunks[ aChunk ] );
+    if( aChunk < std::get<1>( aKey ) ) return std::size_t( std::upper_bound( lChunk.begin() , lChunk.end() , std::get<0>( aKey ) , RGreater ) - lChunk.begin() );
+    if( aChunk > std::get<1>( aKey ) ) return std::size_t( std::lower_bound( lChunk.begin() , lChunk.end() , std::get<0>( aKey ) , RLess ) - lChunk.begin() );
+    return std::get<2>( aKey );
+  };
 
-  auto ReadUntil = [ & ]( const char& aChar ){
-    lPtr = ch;
-    while ( ( *lPtr = fgetc(f)) != EOF )
+  // Split the output into blocks at splitters sampled evenly from each chunk, and find where each splitter falls in each chunk
+  const std::size_t lChunks( aChunks.size() ) , lBlocks( std::max( Threads() , std::size_t( 1 ) ) );
+  std::vector< tKey > lSamples;
+  for( std::size_t i(0) ; i!=lChunks ; ++i )
+    for( std::size_t j(0) ; j!=lBlocks and aChunks[i].size() ; ++j )
     {
-      aCount--;
-      if( *lPtr == aChar ) return;
-      lPtr++;
+      const std::size_t lIndex( ( j * aChunks[i].size() ) / lBlocks );
+      lSamples.emplace_back( aChunks[i][ lIndex ].r , i , lIndex );
     }
-  };
+  std::sort( lSamples.begin() , lSamples.end() );
+
+  std::vector< std::vector< std::size_t > > lBounds( lBlocks + 1 , std::vector< std::size_t >( lChunks , 0 ) );
+  for( std::size_t i(0) ; i!=lChunks ; ++i ) lBounds[ lBlocks ][i] = aChunks[i].size();
+  for( std::size_t j(1) ; j!=lBlocks and lSamples.size() ; ++j )
+    for( std::size_t i(0) ; i!=lChunks ; ++i ) lBounds[j][i] = Rank( lSamples[ ( j * lSamples.size() ) / lBlocks ] , i );
+
+  // Multiway merge of each block in parallel, moving each point once, then concatenate the blocks
+  std::vector< std::vector< Data > > lMerged( lBlocks );
+  [ & ]( const std::size_t& j ){
+    typedef std::pair< PRECISION , std::size_t > tHead; // The r of the next point of a chunk, and the chunk
+    std::priority_queue< tHead , std::vector< tHead > , std::greater< tHead > > lHeads;
+    std::vector< std::size_t > lNext( lBounds[j] );
+    std::size_t lSize( 0 );
+    for( std::size_t i(0) ; i!=lChunks ; ++i )
+    {
+      lSize += lBounds[j+1][i] - lBounds[j][i];
+      if( lNext[i] != lBounds[j+1][i] ) lHeads.emplace( aChunks[i][ lNext[i] ].r , i );
+    }
+
+    lMerged[j].reserve( lSize );
+    while( lHeads.size() )
+    {
+      const std::size_t i( lHeads.top().second );
+      lHeads.pop();
+      lMerged[j].emplace_back( std::move( aChunks[i][ lNext[i]++ ] ) );
+      if( lNext[i] != lBounds[j+1][i] ) lHeads.emplace( aChunks[i][ lNext[i] ].r , i );
+    }
+  } || range( lBlocks );
+  for( auto& i : aChunks ) std::vector< Data >().swap( i );
 
-  ReadUntil( '\n' ); // Throw away first line, or any partial lines (other thread will handle it)
-  while( aCount > 0 )
+  std::size_t lSize( 0 );
+  for( auto& i : lMerged ) lSize += i.size();
+  aData.reserve( aData.size() + lSize );
+  for( auto& i : lMerged )
   {
-    ReadUntil( ',' ); //"id"
-    if( *lPtr == EOF ) break;
-    ReadUntil( ',' ); //"frame"
-    ReadUntil( ',' ); //"x [nm]"
-    double x = ( strtod( ch , &lPtr ) * nanometer ) - Configuration::Instance.getCentreX();
-    ReadUntil( ',' ); //"y [nm]"
-    double y = ( strtod( ch , &lPtr ) * nanometer ) - Configuration::Instance.getCentreY();      
-    ReadUntil( ',' ); //"sigma [nm]"   
-    double sigma = strtod( ch , &lPtr );
-    ReadUntil( ',' ); //"intensity [photon]"
-    ReadUntil( ',' ); //"offset [photon]"
-    ReadUntil( ',' ); //"bkgstd [photon]"
-    ReadUntil( ',' ); //"chi2"
-    ReadUntil( '\n' ); //"uncertainty_xy [nm]"
-    double s = strtod( ch , &lPtr ) * nanometer;      
-    if ( ( sigma < 100 ) or ( sigma  > 300) ) continue;
-    if( fabs(x) < lMaxX and fabs(y) < lMaxY ) aData.emplace_back( x , y , s );
+    aData.insert( aData.end() , std::make_move_iterator( i.begin() ) , std::make_move_iterator( i.end() ) );
+    std::vector< Data >().swap( i );
   }
-  
-  fclose(f);
-
-  std::sort( aData.begin() , aData.end() );
 }
 
 void Event::LoadCSV( const std::string& aFilename )
 {
+  PerfCounters::StageScope lPerf( PerfCounters::Load );
   auto f = fopen( aFilename.c_str() , "rb");
   if ( f == NULL ) throw std::runtime_error( "File is not available" );
   fseek(f, 0, SEEK_END); // seek to end of file
-  auto lSize = ftell(f); // get current file pointer
+  const std::size_t lSize( ftell(f) ); // get current file pointer
   fclose(f);
 
-  int lChunkSize = ceil( double(lSize) / Nthreads );
-  std::vector< std::vector< Data > > lData( Nthreads );
+  const std::size_t lChunkSize( ceil( double(lSize) / mThreads ) );
+  std::vector< std::vector< Data > > lData( mThreads );
+  std::vector< DensityMap > lDensityMaps( mThreads , DensityMap( mConfiguration.densityBinSize() ) ); // Per-thread maps, merged at the end
 
   ProgressBar2 lProgressBar( "Reading File" , lSize );
-  [ & ]( const std::size_t& i ){ __LoadCSV__( aFilename , *this , lData[i] , i*lChunkSize , lChunkSize ); } && range( Nthreads );
-
-  std::size_t lSize2( 0 );
-  for( auto& i : lData ) lSize2 += i.size();
-
-  mData.reserve( lSize2 );
+  [ & ]( const std::size_t& i ){ __LoadCSV__( aFilename , *this , lData[i] , lDensityMaps[i] , i*lChunkSize , lChunkSize ); } && range( mThreads );
 
-  for( auto& i : lData )
-  {
-    lSize2 = mData.size();
-    mData.insert( mData.end() , std::make_move_iterator( i.begin() ) , std::make_move_iterator( i.end() ) );
-    i.erase( i.begin() , i.end() );
-    std::inplace_merge ( mData.begin() , mData.begin()+lSize2 , mData.end() );  
-  }
+  mDensityMap = DensityMap( mConfiguration.densityBinSize() );
+  for( auto& i : lDensityMaps ) mDensityMap.Merge( i );
 
-  // // Validate the in-place merge
-  // PRECISION last = -1;
-  // for( auto& i : mData )
-  // {
-  //   if( i.r < last ) throw std::runtime_error( "Out of order!" );
-  //   last = i.r;
-  // }
+  __MergeChunks__( lData , mData );
 
   std::cout << "Read " << mData.size() << " points" << std::endl;
 }
@@ -152,10 +581,114 @@ void Event::WriteCSV( const std::string& aFilename )
 
   ProgressBar lProgressBar( "Writing File" , mData.size() );
   for( auto& i : mData ){
-    fprintf( f , ",,%f,%f,,,,,,%f\n" , (i.x + Configuration::Instance.getCentreX())/nanometer , (i.y + Configuration::Instance.getCentreY())/nanometer , i.s/nanometer );
+    fprintf( f , ",,%f,%f,,,,,,%f\n" , (i.x + mConfiguration.getCentreX())/nanometer , (i.y + mConfiguration.getCentreY())/nanometer , i.s/nanometer );
     lProgressBar++;
   }
 
   fclose(f);
 }
+
+//! The magic number at the start of a saved event state
+constexpr char EventStateMagic[4] = { 'B' , 'C' , 'E' , 'V' };
+
+//! The version of the format of a saved event state
+constexpr uint32_t EventStateVersion = 1;
+
+void Event::SaveState( const std::string& aFilename ) const
+{
+  if( !mLocalizationScoresReady ) throw std::runtime_error( "Only an event preprocessed for an RT-scan can be saved" );
+
+  ProgressBar2 lProgressBar( "Saving the preprocessed event" , 0 );
+  AtomicWrite( aFilename , [&]( FILE* f ){
+    const uint64_t lFingerprint( ScanFingerprint( mConfiguration ) ) , lCount( mData.size() );
+    fwrite( EventStateMagic , sizeof( EventStateMagic ) , 1 , f );
+    fwrite( &EventStateVersion , sizeof( EventStateVersion ) , 1 , f );
+    fwrite( &lFingerprint , sizeof( lFingerprint ) , 1 , f );
+    fwrite( &mPreprocessedR , sizeof( mPreprocessedR ) , 1 , f );
+    fwrite( &lCount , sizeof( lCount ) , 1 , f );
+    for( auto& i : mData )
+    {
+      const PRECISION lPoint[3] = { i.x , i.y , i.s };
+      const uint64_t lNeighbours( i.mNeighbours.size() ) , lScores( i.mLocalizationScores.size() );
+      fwrite( lPoint , sizeof( lPoint ) , 1 , f );
+      fwrite( &lNeighbours , sizeof( lNeighbours ) , 1 , f );
+      fwrite( i.mNeighbours.data() , sizeof( std::pair< PRECISION , std::size_t > ) , lNeighbours , f );
+      fwrite( &lScores , sizeof( lScores ) , 1 , f );
+      fwrite( i.mLocalizationScores.data() , sizeof( PRECISION ) , lScores , f );
+    }
+  } );
+}
+
+Event Event::LoadState( const Configuration& aConfiguration , const std::string& aFilename )
+{
+  auto f = fopen( aFilename.c_str() , "rb" );
+  if ( f == NULL ) throw std::runtime_error( "File is not available" );
+  auto lRead = [&]( void* aPtr , const std::size_t& aSize , const std::size_t& aCount ){ 
+    if( fread( aPtr , aSize , aCount , f ) != aCount ){ fclose( f ); throw std::runtime_error( "Saved event " + aFilename + " is truncated" ); }
+  };
+
+  char lMagic[4];
+  uint32_t lVersion;
+  uint64_t lFingerprint , lCount;
+  double lPreprocessedR;
+  lRead( lMagic , sizeof( lMagic ) , 1 );
+  lRead( &lVersion , sizeof( lVersion ) , 1 );
+  if( memcmp( lMagic , EventStateMagic , sizeof( lMagic ) ) or lVersion != EventStateVersion ){ fclose( f ); throw std::runtime_error( aFilename + " is not a saved event" ); }
+  lRead( &lFingerprint , sizeof( lFingerprint ) , 1 );
+  if( lFingerprint != ScanFingerprint( aConfiguration ) ){ fclose( f ); throw std::runtime_error( "Saved event " + aFilename + " was written for a different input or configuration" ); }
+  lRead( &lPreprocessedR , sizeof( lPreprocessedR ) , 1 );
+  lRead( &lCount , sizeof( lCount ) , 1 );
+
+  PerfCounters::StageScope lPerf( PerfCounters::Load );
+  ProgressBar2 lProgressBar( "Loading the preprocessed event" , 0 );
+
+  std::vector< Data > lData;
+  lData.reserve( lCount );
+  for( uint64_t i(0) ; i!=lCount ; ++i )
+  {
+    PRECISION lPoint[3];
+    uint64_t lNeighbours , lScores;
+    lRead( lPoint , sizeof( lPoint ) , 1 );
+    lData.emplace_back( lPoint[0] , lPoint[1] , lPoint[2] );
+    lRead( &lNeighbours , sizeof( lNeighbours ) , 1 );
+    lData.back().mNeighbours.resize( lNeighbours );
+    lRead( lData.back().mNeighbours.data() , sizeof( std::pair< PRECISION , std::size_t > ) , lNeighbours );
+    lRead( &lScores , sizeof( lScores ) , 1 );
+    lData.back().mLocalizationScores.resize( lScores );
+    lRead( lData.back().mLocalizationScores.data() , sizeof( PRECISION ) , lScores );
+  }
+  fclose( f );
+
+  Event lEvent( aConfiguration , std::move( lData ) );
+  lEvent.PreprocessUncertaintyClasses();
+  lEvent.PreprocessLogGammaTables();
+  if( !aConfiguration.protoClustersOnTheFly() ) [&]( const std::size_t& i ){ lEvent.mData[i].mProtoCluster = new Cluster( lEvent.mData[i] , lEvent.mConfiguration ); } || range( lEvent.mData.size() );
+  lEvent.mPreprocessedR = lPreprocessedR;
+  lEvent.PreprocessBreakpoints();
+  lEvent.mLocalizationScoresReady = true;
+
+  std::cout << "Loaded " << lEvent.mData.size() << " preprocessed points" << std::endl;
+  lEvent.RecordMemory( "Load" );
+  return lEvent;
+}
+
+MemoryBreakdown Event::MemoryUsage() const
+{
+  MemoryBreakdown lBytes;
+  lBytes.mPoints = sizeof( Event ) + ( mData.capacity() * sizeof( Data ) ) + ( ( mLogGamma.capacity() + mLogGammaAlpha.capacity() ) * sizeof( double ) );
+  for( auto& i : mData )
+  {
+    lBytes.mNeighbours += i.mNeighbours.capacity() * sizeof( std::pair< PRECISION , std::size_t > );
+    lBytes.mLocalizationScores += i.mLocalizationScores.capacity() * sizeof( PRECISION );
+    if( i.mProtoCluster ) lBytes.mProtoClusters += sizeof( Cluster ) + ClusterHeapMemory( *i.mProtoCluster );
+  }
+  return lBytes;
+}
+
+void Event::RecordMemory( const std::string& aStage , const std::size_t& aProxies )
+{
+  MemorySnapshot lSnapshot{ aStage , MemoryUsage() , ResidentMemory() , PeakResidentMemory() };
+  lSnapshot.mAccounted.mProxies = aProxies;
+  mMemoryLog.push_back( lSnapshot );
+}
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
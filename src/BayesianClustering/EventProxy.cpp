@@ -6,20 +6,52 @@
 #include "BayesianClustering/EventProxy.hpp"
 #include "BayesianClustering/Event.hpp"
 #include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Memory.hpp"
 
 /* ===== Local utilities ===== */
 #include "Utilities/ProgressBar.hpp"
+#include "Utilities/Instrumentation.hpp"
+#include "Utilities/PerfCounters.hpp"
+#include "Utilities/Vectorize.hpp"
 
 // /* ===== C++ ===== */
 #include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <atomic>
+
+//! The label of a data-point not yet included in the two-phase clusterization
+constexpr uint32_t NoLabel = uint32_t( -1 );
 
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 EventProxy::EventProxy( Event& aEvent ) :
-  mBackgroundCount( 0 ) , mEvent( aEvent )
+  mBackgroundCount( 0 ) , mEvent( aEvent ) , mConfiguration( aEvent.configuration() ) , mScratch( mConfiguration )
 {
   mClusters.reserve( aEvent.mData.size() );  // Reserve as much space for clusters as there are data points - prevent pointers being invalidated!
   mData.reserve( aEvent.mData.size() );
   for( auto& i : aEvent.mData ) mData.emplace_back( i );
+  ClearClusters();
+}
+
+void EventProxy::ClearClusters()
+{
+  mClusters.clear();
+  mChangedClusters.clear();
+  mClusterScoreSum = mLogGammaSum = 0.0;
+  mClusterCount = mClusteredCount = 0;
+  mBackgroundCount = mData.size();
+  mLogP = 0.0;
+}
+
+std::size_t EventProxy::MemoryUsage() const
+{
+  std::size_t lBytes( sizeof( EventProxy ) + ( mData.capacity() * sizeof( DataProxy ) ) + ( mClusters.capacity() * sizeof( Cluster ) ) );
+  lBytes += 2 * mConfiguration.sigmacount() * sizeof( double ); // The scratch space
+  lBytes += mConfiguration.uncertaintyClasses() ? mConfiguration.sigmacount() * sizeof( Cluster::Parameter ) : 0; // The reconstructed parameters
+  lBytes += std::max( mPeakClusters , mClusters.size() ) * ( ClusterParameterMemory( mConfiguration ) + sizeof( Data* ) ); // The clusters are released at the end of each row
+  lBytes += mChangedClusters.capacity() * sizeof( Cluster* );
+  lBytes += ( ( mLabels.capacity() + mNewPoints.capacity() ) * sizeof( uint32_t ) ) + ( mChangedMembers.capacity() * sizeof( std::pair< uint32_t , uint32_t > ) );
+  return lBytes;
 }
 
 void EventProxy::CheckClusterization( const double& R , const double& T )
@@ -93,44 +125,99 @@ void EventProxy::CheckClusterization( const double& R , const double& T )
   }
 }
 
-__attribute__((flatten))
 void EventProxy::ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const uint8_t& aParallelization , const uint8_t& aOffset )
 {
-  double dR( aParallelization * Configuration::Instance.dR() );
-  double R( Configuration::Instance.minScanR() + ( aOffset * Configuration::Instance.dR() ) ) , twoR2( 0 ) , T( 0 );
+  std::vector< uint32_t > lTIndices( mConfiguration.Tbins() );
+  std::iota( lTIndices.begin() , lTIndices.end() , 0 );
 
-  for( uint32_t i( aOffset ) ; i<Configuration::Instance.Rbins() ; i+=aParallelization , R+=dR )
+  uint32_t lRow( 0 );
+  for( uint32_t i( 0 ) ; i<mConfiguration.Rbins() ; ++i )
   {
-    twoR2 = 4.0 * R * R;
-    T = Configuration::Instance.maxScanT();
+    if( mEvent.RRepresentative( i ) != i ) continue;
+    std::vector< uint32_t > lDuplicates;
+    for( uint32_t k( i+1 ) ; k<mConfiguration.Rbins() and mEvent.RRepresentative( k ) == i ; ++k ) lDuplicates.push_back( k );
+    if( ( lRow++ % aParallelization ) == aOffset ) ScanT( aCallback , i , lTIndices , lDuplicates );
+  }
+}
 
-    mClusters.clear();
-    for( auto& k : mData ) k.mCluster = NULL;
+void EventProxy::ScanRT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const std::map< uint32_t , std::vector< uint32_t > >& aCells , const uint8_t& aParallelization , const uint8_t& aOffset )
+{
+  uint32_t lRow( 0 );
+  for( auto& i : aCells )
+  {
+    if( ( lRow++ % aParallelization ) == aOffset ) ScanT( aCallback , i.first , i.second );
+  }
+}
+
+void EventProxy::ScanT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const uint32_t& aRIndex , const std::vector< uint32_t >& aTIndices , const std::vector< uint32_t >& aDuplicates )
+{
+  // The validation policy is chosen once per row, so that the production instantiation carries no trace of the checks
+  if( mConfiguration.validate() ) ScanT< true >( aCallback , aRIndex , aTIndices , aDuplicates );
+  else                            ScanT< false >( aCallback , aRIndex , aTIndices , aDuplicates );
+}
 
-    std::pair<int,int> lCurrentIJ;
+template< bool tValidate >
+__attribute__((flatten))
+void EventProxy::ScanT( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback , const uint32_t& aRIndex , const std::vector< uint32_t >& aTIndices , const std::vector< uint32_t >& aDuplicates )
+{
+  INSTRUMENT_SCOPE( "ScanT row" , aRIndex );
+  const double R( mConfiguration.Rvalue( aRIndex ) ) , twoR2( 4.0 * R * R );
+  double T( 0 );
 
-    for( uint32_t j(0) ; j!=Configuration::Instance.Tbins() ; ++j , T-=Configuration::Instance.dT() )
+  ResetClusterization();
+
+  const uint32_t* lLast( NULL );
+  for( auto& j : aTIndices )
+  {
+    T = mConfiguration.Tvalue( j );
+
+    if( lLast and mEvent.TUnchanged( aRIndex , *lLast , j ) ) // No data-point joins the inclusion set, so the clusters and their scores are as for the last T
+    {
+      ++mSkippedCells;
+      INSTRUMENT_COUNT( "ScanT cells reused" , 1 );
+    }
+    else
     {
-      for( auto& k : mData ) k.mExclude = ( k.mData->mLocalizationScores[ i ] < T ) ;
-      for( auto& k : mData ) k.Clusterize( twoR2 , *this );
-      UpdateLogScore();
-      if( Configuration::Instance.validate() ){
+      {
+        INSTRUMENT_SCOPE( "ScanT clusterize" , j );
+        PerfCounters::Scope lPerf( PerfCounters::Clusterize );
+        GrowClusterization( aRIndex , T , twoR2 );
+      }
+      {
+        INSTRUMENT_SCOPE( "ScanT score" , j );
+        PerfCounters::Scope lPerf( PerfCounters::Score );
+        UpdateLogScore();
+      }
+      if( tValidate ){
         CheckClusterization( R , T ) ;
         ValidateLogScore();
         }
-
-      //place to store current ij
-      lCurrentIJ.first = i;
-      lCurrentIJ.second = j;
- 
-      aCallback( *this , R , T, lCurrentIJ );
     }
+    lLast = &j;
+
+    aCallback( *this , R , T, std::make_pair( aRIndex , j ) );
+    for( auto& k : aDuplicates ) aCallback( *this , mConfiguration.Rvalue( k ) , T , std::make_pair( k , j ) );
   }
+  mSkippedCells += aDuplicates.size() * aTIndices.size();
 
-  mClusters.clear();
+  mPeakClusters = std::max( mPeakClusters , mClusters.size() );
+  ClearClusters();
   for( auto& k : mData ) k.mCluster = NULL; // Clear cluster pointers which will be invalidated when we leave the function
 }
 
+void EventProxy::ResetClusterization()
+{
+  ClearClusters();
+  for( auto& k : mData ) k.mCluster = NULL;
+  if( mConfiguration.twoPhaseClusterize() ) ResetLabels();
+}
+
+void EventProxy::GrowClusterization( const uint32_t& aRIndex , const double& T , const double& a2R2 )
+{
+  for( auto& k : mData ) k.mExclude = ( k.mData->mLocalizationScores[ aRIndex ] < T ) ;
+  if( mConfiguration.twoPhaseClusterize() ) ClusterizeTwoPhase( a2R2 );
+  else for( auto& k : mData ) k.Clusterize( a2R2 , *this );
+}
 
 void EventProxy::Clusterize( const double& R , const double& T , const std::function< void( const EventProxy& ) >& aCallback )
 {
@@ -138,31 +225,224 @@ void EventProxy::Clusterize( const double& R , const double& T , const std::func
     ProgressBar2 lProgressBar( "Clusterize"  , 0 );  
     auto twoR2 = 4.0 * R * R;
 
-    mClusters.clear();
-    for( auto& k : mData )
-    { 
-      k.mCluster = NULL;
-      k.mExclude = ( k.mData->CalculateLocalizationScore( mEvent.mData , R ) < T ) ;
+    {
+      PerfCounters::StageScope lPerf( PerfCounters::Clusterize ); // Including the work posted to the thread-pools
+      ClearClusters();
+      [&]( const std::size_t& i ){
+        DataProxy& k( mData[i] );
+        k.mCluster = NULL;
+        k.mExclude = ( k.mData->CalculateLocalizationScore( mEvent.mData , R , mConfiguration ) < T ) ;
+      } && range( mData.size() );
+
+      if( Threads() > 1 ) ClusterizeParallel( twoR2 );
+      else if( mConfiguration.twoPhaseClusterize() )
+      {
+        ResetLabels();
+        ClusterizeTwoPhase( twoR2 );
+      }
+      else for( auto& k : mData ) k.Clusterize( twoR2 , *this );
     }
 
-    for( auto& k : mData ) k.Clusterize( twoR2 , *this );
-
-    UpdateLogScore();
+    PerfCounters::StageScope lPerf( PerfCounters::Score );
+    UpdateLogScore( Threads() > 1 );
   }
 
   aCallback( *this );
 }
 
 
+void EventProxy::ResetLabels()
+{
+  if( mData.size() >= NoLabel ) throw std::runtime_error( "Too many data-points for the two-phase clusterization" );
+  mLabels.assign( mData.size() , NoLabel );
+}
+
+uint32_t EventProxy::FindLabel( uint32_t aIndex )
+{
+  while( mLabels[ aIndex ] != aIndex )
+  {
+    mLabels[ aIndex ] = mLabels[ mLabels[ aIndex ] ];
+    aIndex = mLabels[ aIndex ];
+  }
+  return aIndex;
+}
+
+void EventProxy::ClusterizeTwoPhase( const PRECISION& a2R2 )
+{
+  // Phase 1 - the connected components, from the labels alone
+  // The edges between data-points included at earlier steps have already been followed, so only those from the newly included data-points are traversed
+  mNewPoints.clear();
+  mChangedMembers.clear();
+  for( uint32_t i(0) ; i!=mData.size() ; ++i )
+  {
+    if( mData[i].mExclude or mLabels[i] != NoLabel ) continue;
+    mLabels[i] = i;
+    mNewPoints.push_back( i );
+    mChangedMembers.emplace_back( i , i );
+  }
+  if( mNewPoints.empty() ) return;
+
+  // Every included data-point has a cluster once the step is complete, so only the roots of existing components have clusters during it
+  auto ComponentSize = [&]( const uint32_t& aRoot ){ return mData[ aRoot ].mCluster ? mData[ aRoot ].GetCluster()->mClusterSize : 0; };
+
+  {
+    INSTRUMENT_SCOPE( "Clusterize connectivity" , mNewPoints.size() );
+    for( auto& i : mNewPoints )
+      for( auto& j : mData[i].mData->mNeighbours )
+      {
+        if( j.first > a2R2 ) break;
+        INSTRUMENT_COUNT( "Clusterize neighbour edges" , 1 );
+        if( mLabels[ j.second ] == NoLabel ) continue;
+
+        uint32_t lRoot( FindLabel( i ) ) , lOther( FindLabel( j.second ) );
+        if( lRoot == lOther ) continue;
+
+        // The root with the larger cluster survives, so that the second phase moves the fewest parameters - existing components are never absorbed into a new one
+        if( ComponentSize( lRoot ) < ComponentSize( lOther ) ) std::swap( lRoot , lOther );
+        mLabels[ lOther ] = lRoot;
+        if( mData[ lOther ].mCluster ) mChangedMembers.emplace_back( lOther , lOther );
+      }
+  }
+
+  // Phase 2 - the parameters, reduced in a single sweep over the changed members grouped by the root of their component
+  INSTRUMENT_SCOPE( "Clusterize parameters" , mChangedMembers.size() );
+  for( auto& i : mChangedMembers ) i.first = FindLabel( i.first );
+  std::sort( mChangedMembers.begin() , mChangedMembers.end() );
+
+  for( auto lIt( mChangedMembers.begin() ) ; lIt != mChangedMembers.end() ; )
+  {
+    const uint32_t lRoot( lIt->first );
+    Cluster* lCluster( mData[ lRoot ].GetCluster() );
+    if( !lCluster )
+    {
+      mClusters.emplace_back( mConfiguration );
+      lCluster = &mClusters.back();
+    }
+    mChangedClusters.push_back( lCluster );
+
+    for( ; lIt != mChangedMembers.end() and lIt->first == lRoot ; ++lIt )
+    {
+      DataProxy& lMember( mData[ lIt->second ] );
+      if( lMember.mCluster ) // The root of an existing component, absorbed into this one
+      {
+        Cluster* lOther( lMember.GetCluster() );
+        *lCluster += *lOther;
+        lOther->mParent = lCluster;
+        lOther->mClusterSize = 0;
+        mChangedClusters.push_back( lOther );
+      }
+      else
+      {
+        if( lMember.mData->mProtoCluster ) *lCluster += *( lMember.mData->mProtoCluster );
+        else lCluster->Add( *lMember.mData , mConfiguration );
+        lMember.mCluster = lCluster;
+      }
+    }
+  }
+}
+
+
+void EventProxy::ClusterizeParallel( const PRECISION& a2R2 )
+{
+  if( mData.size() >= NoLabel ) throw std::runtime_error( "Too many data-points for the parallel clusterization" );
+  std::vector< std::atomic< uint32_t > > lLabels( mData.size() );
+
+  // Labels only ever decrease, from a data-point to a lower-indexed one in the same component, so any label seen is a valid step towards the root and a racing compression is harmless
+  auto Find = [&]( uint32_t aIndex ){
+    while( true )
+    {
+      uint32_t lParent( lLabels[ aIndex ].load() );
+      if( lParent == aIndex ) return aIndex;
+      const uint32_t lGrandParent( lLabels[ lParent ].load() );
+      if( lGrandParent != lParent ) lLabels[ aIndex ].compare_exchange_weak( lParent , lGrandParent );
+      aIndex = lGrandParent;
+    }
+  };
+
+  // A root is linked only if it is still a root, else the union is retried from the new roots
+  auto Union = [&]( uint32_t aFirst , uint32_t aSecond ){
+    while( true )
+    {
+      aFirst = Find( aFirst ); aSecond = Find( aSecond );
+      if( aFirst == aSecond ) return;
+      if( aFirst < aSecond ) std::swap( aFirst , aSecond );
+      uint32_t lExpected( aFirst );
+      if( lLabels[ aFirst ].compare_exchange_strong( lExpected , aSecond ) ) return;
+    }
+  };
+
+  {
+    INSTRUMENT_SCOPE( "Clusterize connectivity" , mData.size() );
+    [&]( const std::size_t& i ){ lLabels[i].store( uint32_t( i ) ); } && range( mData.size() );
+    [&]( const std::size_t& i ){
+      if( mData[i].mExclude ) return;
+      for( auto& j : mData[i].mData->mNeighbours )
+      {
+        if( j.first > a2R2 ) break;
+        INSTRUMENT_COUNT( "Clusterize neighbour edges" , 1 );
+        if( mData[ j.second ].mExclude ) continue;
+        Union( uint32_t( i ) , uint32_t( j.second ) );
+      }
+    } && range( mData.size() );
+  }
+
+  // The clusters are created in order of their roots, as the serial clusterization would create them
+  std::vector< uint32_t > lRoots;
+  std::vector< std::size_t > lSizes;
+  {
+    std::vector< uint32_t > lComponent( mData.size() );
+    for( uint32_t i(0) ; i!=mData.size() ; ++i )
+    {
+      if( mData[i].mExclude ) continue;
+      const uint32_t lRoot( Find( i ) );
+      if( lRoot == i )
+      {
+        lComponent[i] = lRoots.size();
+        lRoots.push_back( i );
+        lSizes.push_back( 0 );
+        mClusters.emplace_back( mConfiguration );
+        mChangedClusters.push_back( &mClusters.back() );
+      }
+      ++lSizes[ lComponent[ lRoot ] ];
+    }
+  }
+
+  // The largest components are started first, so that the threads finish together
+  std::vector< std::size_t > lOrder( range( lRoots.size() ) );
+  std::stable_sort( lOrder.begin() , lOrder.end() , [&]( const std::size_t& a , const std::size_t& b ){ return lSizes[a] > lSizes[b]; } );
+
+  INSTRUMENT_SCOPE( "Clusterize parameters" , lRoots.size() );
+  // A traversal touches only the data-points of its own component, and the excluded neighbours, which it only reads, so the components never race
+  [&]( const std::size_t& i ){ mData[ lRoots[i] ].Clusterize( a2R2 , *this , &mClusters[i] ); } || lOrder;
+}
+
+void EventProxy::ScoreClustersParallel()
+{
+  INSTRUMENT_SCOPE( "Score clusters" , mChangedClusters.size() );
+  const std::size_t lThreads( Threads() );
+  [&]( const std::size_t& t ){
+    Cluster::Scratch lScratch( mConfiguration );
+    for( std::size_t i( t ) ; i < mChangedClusters.size() ; i += lThreads ) if( mChangedClusters[i]->mClusterSize ) mChangedClusters[i]->UpdateLogScore( mConfiguration , lScratch );
+  } && range( lThreads );
+}
+
+
 void EventProxy::ValidateLogScore()
 {
-  for ( auto& i : mClusters)
+  // The weighted centres and the weighted sums of squared residuals are needed only here, so are held for the duration of the validation rather than in every Cluster::Parameter
+  const std::size_t lSigmacount( mConfiguration.sigmacount() );
+  std::vector< double > lWeightedCentreX( mClusters.size() * lSigmacount ) , lWeightedCentreY( mClusters.size() * lSigmacount ) , lS2( mClusters.size() * lSigmacount , 0.0 );
+
+  std::vector< Cluster::Parameter > lBuffer;
+  for( std::size_t i(0) ; i!=mClusters.size() ; ++i )
   {
-    if (i.mClusterSize == 0 ) continue;
-    for (auto& j : i.mParams)
+    if (mClusters[i].mClusterSize == 0 ) continue;
+    const std::vector< Cluster::Parameter >& lParams( mClusters[i].Parameters( mConfiguration , lBuffer ) );
+    for( std::size_t j(0) ; j!=lSigmacount ; ++j )
     {
-      j.weightedCentreX = j.Bx / j.A;
-      j.weightedCentreY = j.By / j.A;
+      const Cluster::Parameter& lParam( lParams[j] );
+      lWeightedCentreX[ ( i * lSigmacount ) + j ] = lParam.Bx / lParam.A;
+      lWeightedCentreY[ ( i * lSigmacount ) + j ] = lParam.By / lParam.A;
     }
   }
   //iterate over dPoints here, update cluster S2
@@ -182,65 +462,128 @@ void EventProxy::ValidateLogScore()
     auto s = datapoint->s;
     auto s2 = s * s; //bad naming! please redo
     double weightedCentre, weightedCentreX, weightedCentreY; 
+    const std::size_t lOffset( ( parent - mClusters.data() ) * lSigmacount );
 
     //update S2 for each sigma hypothesis
     //we need to recalculate w here i think 
     
-    auto lIt(parent->mParams.begin());
-    auto lSig2It( Configuration::Instance.sigmabins2().begin() );
-    for ( ; lIt != parent->mParams.end() ; ++lIt, ++lSig2It){
+    auto lSig2It( mConfiguration.sigmabins2().begin() );
+    for ( std::size_t j(0) ; j!=lSigmacount ; ++j, ++lSig2It){
       //we need to add on w_i here - which comes with each point in the cluster
-      double w = 1.0 / (s2 + *lSig2It); //these are found in the protoclusters, inside datapoint
-      // weightedCentreX = lIt -> nuBarX - x;
-      // weightedCentreY = lIt -> nuBarY - y;
-      weightedCentreX = (lIt -> weightedCentreX) - x;
-      weightedCentreY = (lIt -> weightedCentreY) - y;
+      double w = mConfiguration.uncertaintyClasses() ? mConfiguration.classWeight( datapoint->mUncertaintyClass , j ) : 1.0 / (s2 + *lSig2It); //these are found in the protoclusters, inside datapoint - or, if quantized, in the table of the class
+      weightedCentreX = lWeightedCentreX[ lOffset + j ] - x;
+      weightedCentreY = lWeightedCentreY[ lOffset + j ] - y;
       weightedCentre = weightedCentreX*weightedCentreX + weightedCentreY*weightedCentreY;
-      lIt->S2 += w*weightedCentre; 
+      lS2[ lOffset + j ] += w*weightedCentre; 
   }
 }
   //NEXT - we perform an alternate log_score 
   //and compare it with the usual log_score
 
   double fastLogScore, valLogScore;
-  for (auto& i : mClusters)
+  for( std::size_t i(0) ; i!=mClusters.size() ; ++i )
   {
-    if (i.mClusterSize == 0) continue;
-    for( std::size_t j(0) ; j!=Configuration::Instance.sigmacount() ; ++j )
+    if (mClusters[i].mClusterSize == 0) continue;
+    const std::vector< Cluster::Parameter >& lParams( mClusters[i].Parameters( mConfiguration , lBuffer ) );
+    for( std::size_t j(0) ; j!=lSigmacount ; ++j )
     {
-      fastLogScore = i.mParams[j].log_score();
-      valLogScore = i.mParams[j].alt_log_score();
+      fastLogScore = lParams[j].log_score();
+      valLogScore = lParams[j].alt_log_score( lS2[ ( i * lSigmacount ) + j ] );
       if (abs(fastLogScore - valLogScore) > 5) throw std::runtime_error("logscore check failed");
     }
   }
 
+  // The running sums, against a sweep over every cluster
+  double lScoreSum( 0.0 ) , lLogGammaSum( 0.0 );
+  for( auto& i : mClusters )
+  {
+    if( i.mClusterSize == 0 ) continue;
+    lScoreSum += i.mClusterScore;
+    lLogGammaSum += boost::math::lgamma( i.mClusterSize );
+  }
+  if( fabs( lScoreSum - mClusterScoreSum ) > 1e-9 * ( 1.0 + fabs( lScoreSum ) ) or fabs( lLogGammaSum - mLogGammaSum ) > 1e-9 * ( 1.0 + fabs( lLogGammaSum ) ) ) throw std::runtime_error("running logscore check failed");
+
 }
 
 
-void EventProxy::UpdateLogScore()
+double EventProxy::QuantizationError() const
 {
-  mClusterCount = mClusteredCount = 0;
-  double lLogPl = 0.0;
-  mLogP = 0.0;
-  for( auto& i: mClusters ) // here we operate on each of the identified clusters
+  if( !mConfiguration.uncertaintyClasses() ) return 0.0;
+
+  // Accumulate the exact parameters of each cluster from the uncertainties of its points, as for an unquantized cluster
+  const std::size_t lSigmacount( mConfiguration.sigmacount() );
+  std::vector< std::vector< Cluster::Parameter > > lExact( mClusters.size() );
+  for( auto& i : mData )
   {
-    if( i.mClusterSize == 0 ) continue;
-    
-    i.UpdateLogScore();
-    mClusterCount += 1;
-    mClusteredCount += i.mClusterSize;
-    mLogP += i.mClusterScore;
-    lLogPl += boost::math::lgamma( i.mClusterSize ); //this was omitted before - why?
+    const Cluster* lCluster( i.mCluster );
+    if( !lCluster ) continue;
+    while( lCluster->mParent ) lCluster = lCluster->mParent;
+
+    auto& lParams( lExact[ lCluster - mClusters.data() ] );
+    if( lParams.empty() ) lParams.resize( lSigmacount );
+    const Data& lData( *i.mData );
+    const double s2( lData.s * lData.s );
+    for( std::size_t j(0) ; j!=lSigmacount ; ++j )
+    {
+      double w = 1.0 / ( s2 + mConfiguration.sigmabins2( j ) );
+      lParams[j].A += w;
+      lParams[j].Bx += (w * lData.x);
+      lParams[j].By += (w * lData.y);
+      lParams[j].C += (w * lData.r2);
+      lParams[j].logF += PRECISION( log( w ) );
     }
-  
+  }
+
+  // The other terms of the log-probability depend only on the numbers of points and clusters, so only the scores of the clusters differ
+  Cluster::Scratch lScratch( mConfiguration );
+  double lError( 0.0 );
+  for( std::size_t i(0) ; i!=mClusters.size() ; ++i )
+  {
+    if( mClusters[i].mClusterSize == 0 ) continue;
+    lError += Cluster::LogScore( lExact[i] , mClusters[i].mClusterSize , mConfiguration , lScratch ) - mClusters[i].mClusterScore;
+  }
+  return lError;
+}
+
+void EventProxy::UpdateLogScore( const bool& aParallel )
+{
+  // A cluster is counted in the running sums with the score and size at which it was last evaluated, so its old contribution is removed before it is rescored
+  // The changed clusters are taken in the order of mClusters, so that a clusterization from scratch sums exactly as a sweep over every cluster would
+  std::sort( mChangedClusters.begin() , mChangedClusters.end() );
+  mChangedClusters.erase( std::unique( mChangedClusters.begin() , mChangedClusters.end() ) , mChangedClusters.end() );
+
+  for( auto& i : mChangedClusters )
+  {
+    if( i->mLastClusterSize == 0 ) continue;
+    mClusterCount -= 1;
+    mClusteredCount -= i->mLastClusterSize;
+    mClusterScoreSum -= i->mClusterScore;
+    mLogGammaSum -= mEvent.LogGamma( i->mLastClusterSize );
+    if( i->mClusterSize == 0 ) i->mLastClusterSize = 0; // Absorbed into another cluster
+  }
+
+  if( aParallel ) ScoreClustersParallel();
+
+  for( auto& i : mChangedClusters )
+  {
+    if( i->mClusterSize == 0 ) continue;
+    i->UpdateLogScore( mConfiguration , mScratch );
+    mClusterCount += 1;
+    mClusteredCount += i->mClusterSize;
+    mClusterScoreSum += i->mClusterScore;
+    mLogGammaSum += mEvent.LogGamma( i->mClusterSize ); //this was omitted before - why?
+  }
+  mChangedClusters.clear();
 
+  double lLogPl = mLogGammaSum;
   mBackgroundCount = mData.size() - mClusteredCount;
-  lLogPl += ( mBackgroundCount * Configuration::Instance.logPb() ) 
-         + ( mClusteredCount * Configuration::Instance.logPbDagger() )
-         + ( Configuration::Instance.logAlpha() * mClusterCount )
-         + Configuration::Instance.logGammaAlpha()
-         - boost::math::lgamma( Configuration::Instance.alpha() + mClusteredCount );  
+  lLogPl += ( mBackgroundCount * mConfiguration.logPb() ) 
+         + ( mClusteredCount * mConfiguration.logPbDagger() )
+         + ( mConfiguration.logAlpha() * mClusterCount )
+         + mConfiguration.logGammaAlpha()
+         - mEvent.LogGammaAlpha( mClusteredCount );  
 
+  mLogP = mClusterScoreSum;
   mLogP += (-log(4.0) * mBackgroundCount) + lLogPl;
 }
 // -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,182 @@
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Export.hpp"
+#include "BayesianClustering/EventProxy.hpp"
+#include "BayesianClustering/DataProxy.hpp"
+#include "BayesianClustering/Data.hpp"
+#include "BayesianClustering/Cluster.hpp"
+#include "BayesianClustering/Configuration.hpp"
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProgressBar.hpp"
+#include "Utilities/Vectorize.hpp"
+
+// /* ===== C++ ===== */
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <memory>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Format an unsigned integer
+//! \param aPtr   The position at which to write, which is advanced past the written characters
+//! \param aValue The value to format
+inline void FormatUnsigned( char*& aPtr , uint64_t aValue )
+{
+  char lBuffer[20];
+  char* lEnd( lBuffer + 20 ) , *lStart( lEnd );
+  do { *--lStart = '0' + ( aValue % 10 ); aValue /= 10; } while( aValue );
+  std::memcpy( aPtr , lStart , lEnd - lStart );
+  aPtr += lEnd - lStart;
+}
+
+//! Format a value to three decimal places, which for nanometers is well below the localization precision
+//! \param aPtr   The position at which to write, which is advanced past the written characters
+//! \param aValue The value to format
+inline void FormatFixed3( char*& aPtr , const double& aValue )
+{
+  const uint64_t lScaled( std::fabs( aValue ) * 1000.0 + 0.5 );
+  if( aValue < 0 and lScaled ) *aPtr++ = '-';
+  FormatUnsigned( aPtr , lScaled / 1000 );
+  const uint64_t lFraction( lScaled % 1000 );
+  aPtr[0] = '.';
+  aPtr[1] = '0' + ( lFraction / 100 );
+  aPtr[2] = '0' + ( lFraction / 10 ) % 10;
+  aPtr[3] = '0' + ( lFraction % 10 );
+  aPtr += 4;
+}
+
+//! Format a signed integer
+//! \param aPtr   The position at which to write, which is advanced past the written characters
+//! \param aValue The value to format
+inline void FormatSigned( char*& aPtr , const int64_t& aValue )
+{
+  if( aValue < 0 ){ *aPtr++ = '-'; FormatUnsigned( aPtr , -aValue ); }
+  else            { FormatUnsigned( aPtr , aValue ); }
+}
+
+//! Open a file for writing, throwing on failure
+//! \param aFilename The name of the file
+//! \return The file handle
+inline FILE* OpenForWriting( const std::string& aFilename )
+{
+  auto f = fopen( aFilename.c_str() , "wb" );
+  if ( f == NULL ) throw std::runtime_error( "Unable to open " + aFilename + " for writing" );
+  return f;
+}
+
+//! Close a file opened by OpenForWriting, throwing if any write to it failed - fwrite flags a short write (e.g. on a full disk) in the error indicator
+//! \param f         The file handle
+//! \param aFilename The name of the file
+inline void CloseAfterWriting( FILE* f , const std::string& aFilename )
+{
+  const bool lFailed( fflush( f ) or ferror( f ) );
+  if( fclose( f ) or lFailed ) throw std::runtime_error( "Failed writing " + aFilename );
+}
+
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+ClusterLabels::ClusterLabels( const EventProxy& aProxy ) :
+  mLabels( aProxy.mData.size() ) , mBackgroundCount( 0 ) , mProxy( aProxy )
+{
+  // Dense IDs are looked up by the position of the cluster in the event-proxy's list of clusters
+  std::vector< int32_t > lIds( aProxy.mClusters.size() , -1 );
+
+  auto lLabel( mLabels.begin() );
+  for( auto& i : aProxy.mData )
+  {
+    if( !i.mCluster ){ *lLabel++ = -1; ++mBackgroundCount; continue; }
+
+    int32_t& lId( lIds[ i.mCluster->GetParent() - aProxy.mClusters.data() ] );
+    if( lId < 0 )
+    {
+      lId = mSizes.size();
+      mSizes.push_back( 0 );
+    }
+    ++mSizes[ lId ];
+    *lLabel++ = lId;
+  }
+}
+
+void ClusterLabels::Write( const std::string& aFilename ) const
+{
+  static const std::string lBinary( ".bin" );
+  if( aFilename.size() >= lBinary.size() and aFilename.compare( aFilename.size() - lBinary.size() , lBinary.size() , lBinary ) == 0 ) WriteBinary( aFilename );
+  else                                                                                                                              WriteCSV( aFilename );
+}
+
+void ClusterLabels::WriteCSV( const std::string& aFilename ) const
+{
+  ProgressBar2 lProgressBar( "Writing labelled CSV" , mLabels.size() );
+
+  static constexpr std::size_t lChunkSize( 1 << 16 );
+  static constexpr std::size_t lMaxRowSize( 4 * 32 ); // Three fixed-point numbers, a label and separators
+  const std::size_t lChunks( ( mLabels.size() + lChunkSize - 1 ) / lChunkSize );
+  const double lCentreX( mProxy.configuration().getCentreX() ) , lCentreY( mProxy.configuration().getCentreY() );
+
+  auto f = OpenForWriting( aFilename );
+  static const std::string lHeader( "x [nm],y [nm],uncertainty_xy [nm],cluster\n" );
+  fwrite( lHeader.data() , 1 , lHeader.size() , f );
+
+  // Format a batch of chunks concurrently, then write them in order, so that the memory held is bounded by the batch
+  // The buffers are left uninitialized, since zeroing them would cost as much as the formatting
+  const std::size_t lBufferSize( std::min( lChunkSize , mLabels.size() ) * lMaxRowSize );
+  const std::size_t lThreads( Threads() );
+  std::vector< std::unique_ptr< char[] > > lBuffers( std::min( lThreads , lChunks ) );
+  for( auto& i : lBuffers ) i.reset( new char[ lBufferSize ] );
+  std::vector< std::size_t > lLengths( lBuffers.size() );
+
+  for( std::size_t lFirst(0) ; lFirst < lChunks ; lFirst += lThreads )
+  {
+    const std::size_t lBatch( std::min( lThreads , lChunks - lFirst ) );
+
+    [&]( const std::size_t& i ){
+      char* lPtr( lBuffers[i].get() );
+      const std::size_t lBegin( ( lFirst + i ) * lChunkSize ) , lEnd( std::min( mLabels.size() , lBegin + lChunkSize ) );
+      for( std::size_t j( lBegin ) ; j != lEnd ; ++j )
+      {
+        const Data& lData( *mProxy.mData[j].mData );
+        FormatFixed3( lPtr , ( lData.x + lCentreX ) / nanometer ); *lPtr++ = ',';
+        FormatFixed3( lPtr , ( lData.y + lCentreY ) / nanometer ); *lPtr++ = ',';
+        FormatFixed3( lPtr , lData.s / nanometer );                *lPtr++ = ',';
+        FormatSigned( lPtr , mLabels[j] );                         *lPtr++ = '\n';
+      }
+      lLengths[i] = lPtr - lBuffers[i].get();
+    } || range( lBatch );
+
+    for( std::size_t i(0) ; i!=lBatch ; ++i ) fwrite( lBuffers[i].get() , 1 , lLengths[i] , f );
+    if( ferror( f ) ) break; // No point formatting the rest
+  }
+
+  CloseAfterWriting( f , aFilename );
+}
+
+void ClusterLabels::WriteBinary( const std::string& aFilename ) const
+{
+  ProgressBar2 lProgressBar( "Writing labelled binary" , mLabels.size() );
+
+  const std::size_t lSize( mLabels.size() );
+  const double lCentreX( mProxy.configuration().getCentreX() ) , lCentreY( mProxy.configuration().getCentreY() );
+
+  // Gather the columns in parallel blocks
+  std::vector< double > lX( lSize ) , lY( lSize ) , lS( lSize );
+  [&]( const std::size_t& j ){
+    const Data& lData( *mProxy.mData[j].mData );
+    lX[j] = ( lData.x + lCentreX ) / nanometer;
+    lY[j] = ( lData.y + lCentreY ) / nanometer;
+    lS[j] = lData.s / nanometer;
+  } && range( lSize );
+
+  auto f = OpenForWriting( aFilename );
+  const uint64_t lCount( lSize );
+  fwrite( "BCLABELS" , 1 , 8 , f );
+  fwrite( &lCount , sizeof( lCount ) , 1 , f );
+  fwrite( lX.data() , sizeof( double ) , lSize , f );
+  fwrite( lY.data() , sizeof( double ) , lSize , f );
+  fwrite( lS.data() , sizeof( double ) , lSize , f );
+  fwrite( mLabels.data() , sizeof( int32_t ) , lSize , f );
+  CloseAfterWriting( f , aFilename );
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
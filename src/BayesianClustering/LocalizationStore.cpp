@@ -0,0 +1,118 @@
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/LocalizationStore.hpp"
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProgressBar.hpp"
+#include "Utilities/Vectorize.hpp"
+#include "Utilities/PerfCounters.hpp"
+#include "Utilities/ProcessMemory.hpp"
+
+// /* ===== C++ ===== */
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+//! The mean number of localizations per cell of the spatial grid
+constexpr double LocalizationsPerCell = 256;
+
+//! The largest number of cells along either axis of the spatial grid
+constexpr std::size_t MaxGridCells = 4096;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+LocalizationStore::LocalizationStore( const std::string& aFilename , const double& aDensityBinSize ) : mDensityMap( aDensityBinSize ) , mXLo( 0 ) , mYLo( 0 ) , mCellSize( 1 ) , mColumns( 1 ) , mRows( 1 )
+{
+  PerfCounters::StageScope lPerf( PerfCounters::Load );
+  auto f = fopen( aFilename.c_str() , "rb");
+  if ( f == NULL ) throw std::runtime_error( "File is not available" );
+  fseek(f, 0, SEEK_END); // seek to end of file
+  const std::size_t lSize( ftell(f) ); // get current file pointer
+  fclose(f);
+
+  const std::size_t lThreads( Threads() );
+  const std::size_t lChunkSize( ceil( double(lSize) / lThreads ) ); // 64-bit, since a chunk of a multi-GB file may exceed 2 GB
+  std::vector< std::vector< Localization > > lChunks( lThreads );
+  std::vector< DensityMap > lDensityMaps( lThreads , DensityMap( aDensityBinSize ) ); // Per-thread maps, merged at the end
+
+  {
+    ProgressBar2 lProgressBar( "Reading File" , lSize );
+    [ & ]( const std::size_t& i ){ 
+      ParseLocalizations( aFilename , i*lChunkSize , lChunkSize , [&]( const double& x , const double& y , const double& s ){ 
+        lChunks[i].push_back( Localization{ x , y , s } ); 
+        lDensityMaps[i].Fill( x , y );
+      } ); 
+    } && range( lThreads );
+  }
+  for( auto& i : lDensityMaps ) mDensityMap.Merge( i );
+
+  std::size_t lCount( 0 );
+  double lXHi( -INFINITY ) , lYHi( -INFINITY );
+  mXLo = mYLo = INFINITY;
+  for( auto& i : lChunks )
+  {
+    lCount += i.size();
+    for( auto& j : i )
+    {
+      mXLo = std::min( mXLo , j.x ); lXHi = std::max( lXHi , j.x );
+      mYLo = std::min( mYLo , j.y ); lYHi = std::max( lYHi , j.y );
+    }
+  }
+
+  if( lCount )
+  {
+    // Square cells holding LocalizationsPerCell localizations on average, were they uniformly spread over the bounding box
+    const double lWidthX( lXHi - mXLo ) , lWidthY( lYHi - mYLo );
+    mCellSize = std::max( { sqrt( lWidthX * lWidthY * LocalizationsPerCell / lCount ) , lWidthX / MaxGridCells , lWidthY / MaxGridCells , nanometer } );
+    mColumns = std::size_t( lWidthX / mCellSize ) + 1;
+    mRows = std::size_t( lWidthY / mCellSize ) + 1;
+  }
+
+  // Counting sort of the localizations into the grid cells, preserving the order within each cell
+  mCellStart.assign( ( mColumns * mRows ) + 1 , 0 );
+  for( auto& i : lChunks )
+    for( auto& j : i ) ++mCellStart[ ( Row( j.y ) * mColumns ) + Column( j.x ) + 1 ];
+  std::partial_sum( mCellStart.begin() , mCellStart.end() , mCellStart.begin() );
+
+  mLocalizations.resize( lCount );
+  std::vector< std::size_t > lNext( mCellStart.begin() , mCellStart.end() - 1 );
+  for( auto& i : lChunks )
+  {
+    for( auto& j : i ) mLocalizations[ lNext[ ( Row( j.y ) * mColumns ) + Column( j.x ) ]++ ] = j;
+    std::vector< Localization >().swap( i );
+  }
+
+  std::cout << "Read " << mLocalizations.size() << " points into a " << mColumns << "x" << mRows << " grid of " << mCellSize / nanometer << "nm cells (" << FormatMegabytes( MemoryUsage() ) << ")" << std::endl;
+}
+
+std::size_t LocalizationStore::Column( const double& aX ) const
+{
+  const double lColumn( floor( ( aX - mXLo ) / mCellSize ) );
+  return lColumn < 0 ? 0 : std::min( std::size_t( lColumn ) , mColumns - 1 );
+}
+
+std::size_t LocalizationStore::Row( const double& aY ) const
+{
+  const double lRow( floor( ( aY - mYLo ) / mCellSize ) );
+  return lRow < 0 ? 0 : std::min( std::size_t( lRow ) , mRows - 1 );
+}
+
+std::vector< std::pair< std::size_t , std::size_t > > LocalizationStore::Ranges( const double& aCentreX , const double& aCentreY , const double& aWidthX , const double& aWidthY ) const
+{
+  // The cells overlapping a row of the window are contiguous, so each row of the grid gives a single range
+  std::vector< std::pair< std::size_t , std::size_t > > lRanges;
+  const std::size_t lColumnLo( Column( aCentreX - ( aWidthX / 2 ) ) ) , lColumnHi( Column( aCentreX + ( aWidthX / 2 ) ) );
+  const std::size_t lRowLo( Row( aCentreY - ( aWidthY / 2 ) ) ) , lRowHi( Row( aCentreY + ( aWidthY / 2 ) ) );
+  for( std::size_t i( lRowLo ) ; i <= lRowHi ; ++i )
+  {
+    const std::size_t lBegin( mCellStart[ ( i * mColumns ) + lColumnLo ] ) , lEnd( mCellStart[ ( i * mColumns ) + lColumnHi + 1 ] );
+    if( lEnd > lBegin ) lRanges.emplace_back( lBegin , lEnd );
+  }
+  return lRanges;
+}
+
+std::size_t LocalizationStore::MemoryUsage() const
+{
+  return sizeof( LocalizationStore ) + ( mLocalizations.capacity() * sizeof( Localization ) ) + ( mCellStart.capacity() * sizeof( std::size_t ) );
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,195 @@
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Memory.hpp"
+#include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Cluster.hpp"
+#include "BayesianClustering/Data.hpp"
+#include "BayesianClustering/DataProxy.hpp"
+#include "BayesianClustering/LocalizationStore.hpp"
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProcessMemory.hpp"
+
+// /* ===== C++ ===== */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+//! The number of lines of an input file, or of entries of a buffer, sampled for an estimate
+constexpr std::size_t MemorySampleSize = 4096;
+
+//! The mean ratio of capacity to size of a vector grown by doubling (1/ln 2), as for the neighbour lists
+constexpr double VectorGrowth = 1.44;
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+std::size_t ClusterHeapMemory( const Cluster& aCluster )
+{
+  return ( aCluster.mParams.capacity() * sizeof( Cluster::Parameter ) ) + ( aCluster.mClasses.capacity() * sizeof( Cluster::UncertaintyClass ) ) + ( aCluster.mData.capacity() * sizeof( Data* ) );
+}
+
+std::size_t ClusterParameterMemory( const Configuration& aConfiguration )
+{
+  if( aConfiguration.uncertaintyClasses() ) return aConfiguration.uncertaintyClasses() * sizeof( Cluster::UncertaintyClass );
+  return aConfiguration.sigmacount() * sizeof( Cluster::Parameter );
+}
+
+std::size_t ProxyMemoryBound( const std::size_t& aPoints , const Configuration& aConfiguration )
+{
+  // Every bin of an RT-scan has T > 0, which excludes the isolated points, so every cluster holds at least two
+  const std::size_t lClusterHeap( ClusterParameterMemory( aConfiguration ) + sizeof( Data* ) );
+  // Each step records at most one change per point, either creating or absorbing a cluster
+  const std::size_t lChanges( aPoints * sizeof( Cluster* ) );
+  // The two-phase clusterization also holds a label, and at most one entry in each of its work-lists, per point
+  const std::size_t lLabels( aConfiguration.twoPhaseClusterize() ? aPoints * ( ( 2 * sizeof( uint32_t ) ) + sizeof( std::pair< uint32_t , uint32_t > ) ) : 0 );
+  return ( aPoints * ( sizeof( DataProxy ) + sizeof( Cluster ) ) ) + ( ( aPoints / 2 ) * lClusterHeap ) + lChanges + lLabels;
+}
+
+MemoryEstimate EstimateMemory( const Configuration& aConfiguration , const std::vector< std::pair< double , double > >& aSample , const std::size_t& aPoints )
+{
+  // The mean number of neighbours is estimated from the pairs of sampled points within the largest 2R, which, unlike a mean density, accounts for the clustering
+  const double lMax2R2( aConfiguration.max2R2() );
+  std::size_t lPairs( 0 );
+  for( std::size_t i(0) ; i!=aSample.size() ; ++i )
+    for( std::size_t j( i+1 ) ; j!=aSample.size() ; ++j )
+    {
+      const double dX( aSample[i].first - aSample[j].first ) , dY( aSample[i].second - aSample[j].second );
+      if( ( dX*dX ) + ( dY*dY ) < lMax2R2 ) ++lPairs;
+    }
+
+  MemoryEstimate lEstimate;
+  lEstimate.mPoints = aPoints;
+  if( aSample.size() > 1 and aPoints > 1 ) lEstimate.mMeanNeighbours = ( 2.0 * lPairs / aSample.size() ) * double( aPoints - 1 ) / ( aSample.size() - 1 );
+
+  lEstimate.mShared.mPoints = aPoints * ( sizeof( Data ) + ( 2 * sizeof( double ) ) ); // Including the log-gamma tables
+  lEstimate.mShared.mNeighbours = std::size_t( aPoints * lEstimate.mMeanNeighbours * VectorGrowth * sizeof( std::pair< PRECISION , std::size_t > ) );
+  lEstimate.mShared.mLocalizationScores = aPoints * aConfiguration.Rbins() * sizeof( PRECISION );
+  if( !aConfiguration.protoClustersOnTheFly() ) lEstimate.mShared.mProtoClusters = aPoints * ( sizeof( Cluster ) + ClusterParameterMemory( aConfiguration ) + sizeof( Data* ) );
+  lEstimate.mPerThread = ProxyMemoryBound( aPoints , aConfiguration );
+  return lEstimate;
+}
+
+MemoryEstimate EstimateMemory( const Configuration& aConfiguration )
+{
+  const std::string& lFilename( aConfiguration.inputFile() );
+  auto f = fopen( lFilename.c_str() , "rb" );
+  if ( f == NULL ) throw std::runtime_error( "File is not available" );
+  fseek( f , 0 , SEEK_END );
+  const long lSize( ftell( f ) );
+
+  const double lMaxX( aConfiguration.getWidthX() / 2 ) , lMaxY( aConfiguration.getWidthY() / 2 );
+  std::vector< std::pair< double , double > > lSample;
+  std::size_t lParsed( 0 ) , lPassed( 0 ) , lBytes( 0 );
+  long lLastLine( -1 );
+  char lLine[ 1024 ];
+
+  // Read the first whole line after each of a set of evenly-spaced offsets, with the same parsing and cuts as Event::LoadCSV
+  for( std::size_t i(0) ; i!=MemorySampleSize ; ++i )
+  {
+    if( fseek( f , long( double( lSize ) * i / MemorySampleSize ) , SEEK_SET ) ) throw std::runtime_error( "Fseek failed" );
+    if( i and !fgets( lLine , sizeof( lLine ) , f ) ) break; // Throw away any partial line
+    const long lStart( ftell( f ) );
+    if( lStart == lLastLine or !fgets( lLine , sizeof( lLine ) , f ) ) continue; // Small files will hit the same line more than once
+    lLastLine = lStart;
+
+    char* lPtr( lLine );
+    double lColumns[5];
+    std::size_t lColumn( 0 );
+    for( ; lColumn!=5 ; ++lColumn , ++lPtr )
+    {
+      char* lEnd( NULL );
+      lColumns[ lColumn ] = strtod( lPtr , &lEnd );
+      if( lEnd == lPtr ) break; // e.g. the header
+      if( !( lPtr = strchr( lEnd , ',' ) ) ) break;
+    }
+    if( lColumn != 5 ) continue;
+
+    ++lParsed;
+    lBytes += ftell( f ) - lStart;
+    const double x( ( lColumns[2] * nanometer ) - aConfiguration.getCentreX() ) , y( ( lColumns[3] * nanometer ) - aConfiguration.getCentreY() );
+    if ( ( lColumns[4] < 100 ) or ( lColumns[4] > 300 ) ) continue;
+    ++lPassed;
+    if( fabs(x) < lMaxX and fabs(y) < lMaxY ) lSample.emplace_back( x , y );
+  }
+  fclose( f );
+
+  if( !lParsed ) throw std::runtime_error( "Unable to sample " + lFilename + " to estimate its footprint" );
+  const double lLines( double( lSize ) * lParsed / lBytes );
+  MemoryEstimate lEstimate( EstimateMemory( aConfiguration , lSample , std::size_t( lLines * lSample.size() / lParsed ) ) );
+  lEstimate.mFilePoints = std::size_t( lLines * lPassed / lParsed );
+  return lEstimate;
+}
+
+MemoryEstimate EstimateMemory( const Configuration& aConfiguration , const double* aX , const double* aY , const std::size_t& aCount )
+{
+  const double lMaxX( aConfiguration.getWidthX() / 2 ) , lMaxY( aConfiguration.getWidthY() / 2 );
+  const std::size_t lStride( std::max< std::size_t >( 1 , aCount / MemorySampleSize ) );
+  std::vector< std::pair< double , double > > lSample;
+  std::size_t lSampled( 0 );
+  for( std::size_t i(0) ; i < aCount ; i += lStride , ++lSampled )
+  {
+    const double x( aX[i] - aConfiguration.getCentreX() ) , y( aY[i] - aConfiguration.getCentreY() );
+    if( fabs(x) < lMaxX and fabs(y) < lMaxY ) lSample.emplace_back( x , y );
+  }
+  return EstimateMemory( aConfiguration , lSample , lSampled ? aCount * lSample.size() / lSampled : 0 );
+}
+
+std::size_t PlanThreads( const MemoryEstimate& aEstimate , const std::size_t& aBudget , const std::size_t& aThreads )
+{
+  std::cout << "Estimated " << aEstimate.mPoints << " points with " << std::setprecision( 3 ) << aEstimate.mMeanNeighbours << std::setprecision( 6 ) << " neighbours each: "
+            << FormatMegabytes( aEstimate.mShared.Total() ) << " shared + " << FormatMegabytes( aEstimate.mPerThread ) << " per thread" << std::endl;
+
+  if( aEstimate.Total( 1 ) > aBudget ) throw std::runtime_error( "The estimated footprint of " + FormatMegabytes( aEstimate.Total( 1 ) ) + " with a single thread exceeds the memory budget of " + FormatMegabytes( aBudget ) );
+
+  const std::size_t lThreads( aEstimate.mPerThread ? std::min( aThreads , ( aBudget - aEstimate.mShared.Total() ) / aEstimate.mPerThread ) : aThreads );
+  if( lThreads < aThreads ) std::cout << "Reducing the number of threads from " << aThreads << " to " << lThreads << " to fit the memory budget" << std::endl;
+  return lThreads;
+}
+
+std::size_t PlanThreads( const Configuration& aConfiguration , const std::size_t& aThreads )
+{
+  if( !aConfiguration.memoryBudget() ) return aThreads;
+  return PlanThreads( EstimateMemory( aConfiguration ) , aConfiguration.memoryBudget() , aThreads );
+}
+
+std::size_t PlanThreads( const Configuration& aConfiguration , const double* aX , const double* aY , const std::size_t& aCount , const std::size_t& aThreads )
+{
+  if( !aConfiguration.memoryBudget() ) return aThreads;
+  return PlanThreads( EstimateMemory( aConfiguration , aX , aY , aCount ) , aConfiguration.memoryBudget() , aThreads );
+}
+
+std::size_t PlanThreads( const Configuration& aConfiguration , const LocalizationStore* aStore , const std::size_t& aThreads )
+{
+  if( !aConfiguration.memoryBudget() ) return aThreads;
+
+  std::size_t lThreads( aThreads );
+  for( std::size_t i(0) ; i!=aConfiguration.regionsOfInterest().size() ; ++i )
+  {
+    MemoryEstimate lEstimate( EstimateMemory( aConfiguration.ForRegionOfInterest( i ) ) );
+    // The store is held alongside the points of every RoI - bounded, before it is parsed, by one grid cell per localization
+    lEstimate.mShared.mPoints += aStore ? aStore->MemoryUsage() : lEstimate.mFilePoints * ( sizeof( Localization ) + sizeof( std::size_t ) );
+    lThreads = PlanThreads( lEstimate , aConfiguration.memoryBudget() , lThreads );
+  }
+  return lThreads;
+}
+
+void WriteMemoryReport( const std::vector< MemorySnapshot >& aSnapshots , std::ostream& aStream )
+{
+  if( aSnapshots.empty() ) return;
+
+  auto MB = []( const std::size_t& aBytes ){ std::ostringstream lStr; lStr << std::fixed << std::setprecision( 1 ) << aBytes / ( 1024.0 * 1024.0 ); return lStr.str(); };
+
+  aStream << std::left << std::setw( 20 ) << "memory [MB]" << std::right << std::setw( 10 ) << "points" << std::setw( 12 ) << "neighbours" << std::setw( 12 ) << "loc.scores" << std::setw( 12 ) << "proto-cl."
+          << std::setw( 10 ) << "proxies" << std::setw( 12 ) << "accounted" << std::setw( 12 ) << "resident" << std::setw( 12 ) << "peak" << "\n";
+  for( auto& i : aSnapshots )
+  {
+    aStream << std::left << std::setw( 20 ) << i.mStage << std::right << std::setw( 10 ) << MB( i.mAccounted.mPoints ) << std::setw( 12 ) << MB( i.mAccounted.mNeighbours ) << std::setw( 12 ) << MB( i.mAccounted.mLocalizationScores )
+            << std::setw( 12 ) << MB( i.mAccounted.mProtoClusters ) << std::setw( 10 ) << MB( i.mAccounted.mProxies ) << std::setw( 12 ) << MB( i.mAccounted.Total() ) << std::setw( 12 ) << MB( i.mResident ) << std::setw( 12 ) << MB( i.mPeakResident ) << "\n";
+  }
+  aStream << "Peak resident memory " << FormatMegabytes( aSnapshots.back().mPeakResident ) << ", steady-state " << FormatMegabytes( aSnapshots.back().mResident ) << std::endl;
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,119 @@
+
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Synthetic.hpp"
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProgressBar.hpp"
+
+// /* ===== C++ ===== */
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+double SyntheticParameters::Width() const
+{
+  return sqrt( mPoints / mDensity );
+}
+
+SyntheticData GenerateSynthetic( const SyntheticParameters& aParameters )
+{
+  if( aParameters.mDensity <= 0.0 ) throw std::runtime_error( "Synthetic density must be positive" );
+  if( aParameters.mClusterFraction < 0.0 or aParameters.mClusterFraction > 1.0 ) throw std::runtime_error( "Synthetic cluster fraction must be in the range [0,1]" );
+  if( aParameters.mClusterSize < 1.0 ) throw std::runtime_error( "Synthetic cluster size must be at least one" );
+  if( aParameters.mUncertainty <= 0.0 ) throw std::runtime_error( "Synthetic uncertainty must be positive" );
+
+  ProgressBar2 lProgressBar( "Generating synthetic data" , aParameters.mPoints );
+
+  // A single engine, drawn from in a fixed order, so that a seed always gives the same data-set
+  std::mt19937_64 lEngine( aParameters.mSeed );
+  const double lWidth( aParameters.Width() );
+  const std::size_t lClustered( std::llround( aParameters.mPoints * aParameters.mClusterFraction ) );
+
+  SyntheticData lData;
+  lData.mClusterCount = lClustered ? std::max< std::size_t >( 1 , std::llround( lClustered / aParameters.mClusterSize ) ) : 0;
+  lData.mX.reserve( aParameters.mPoints );
+  lData.mY.reserve( aParameters.mPoints );
+  lData.mS.reserve( aParameters.mPoints );
+
+  // The uncertainties are gamma-distributed, to be positive and skewed like real localization precisions, with a floor of a nanometer
+  const double lShape( pow( aParameters.mUncertainty / aParameters.mUncertaintySpread , 2 ) );
+  std::gamma_distribution< double > lUncertainty( lShape , aParameters.mUncertainty / lShape );
+  std::normal_distribution< double > lNormal( 0.0 , 1.0 );
+
+  auto Emplace = [&]( const double& aX , const double& aY ){
+    const double s( std::max( nanometer , lUncertainty( lEngine ) ) );
+    lData.mX.push_back( aX + s * lNormal( lEngine ) );
+    lData.mY.push_back( aY + s * lNormal( lEngine ) );
+    lData.mS.push_back( s );
+  };
+
+  // Cluster centres keep three spreads from the edges, so that clusters are not cropped
+  const double lMargin( std::min( 3.0 * aParameters.mClusterSpread , lWidth / 2 ) );
+  std::uniform_real_distribution< double > lCentre( lMargin , lWidth - lMargin );
+  std::vector< std::pair< double , double > > lCentres( lData.mClusterCount );
+  for( auto& i : lCentres ) i = std::make_pair( lCentre( lEngine ) , lCentre( lEngine ) );
+
+  std::uniform_int_distribution< std::size_t > lCluster( 0 , lData.mClusterCount ? lData.mClusterCount - 1 : 0 );
+  for( std::size_t i(0) ; i!=lClustered ; ++i )
+  {
+    const auto& lC( lCentres[ lCluster( lEngine ) ] );
+    const double x( lC.first  + aParameters.mClusterSpread * lNormal( lEngine ) );
+    const double y( lC.second + aParameters.mClusterSpread * lNormal( lEngine ) );
+    Emplace( x , y );
+  }
+
+  std::uniform_real_distribution< double > lBackground( 0.0 , lWidth );
+  for( std::size_t i( lClustered ) ; i!=aParameters.mPoints ; ++i )
+  {
+    const double x( lBackground( lEngine ) );
+    const double y( lBackground( lEngine ) );
+    Emplace( x , y );
+  }
+
+  return lData;
+}
+
+void WriteThunderstormCSV( const std::string& aFilename , const SyntheticData& aData )
+{
+  auto f = fopen( aFilename.c_str() , "w" );
+  if ( f == NULL ) throw std::runtime_error( "Unable to open " + aFilename + " for writing" );
+
+  ProgressBar2 lProgressBar( "Writing synthetic CSV" , aData.mX.size() );
+
+  // The PSF sigma and photometry are fixed at values which pass the quality cuts of Event::LoadCSV
+  fprintf( f , "id,frame,x [nm],y [nm],sigma [nm],intensity [photon],offset [photon],bkgstd [photon],chi2,uncertainty_xy [nm]\n" );
+  for( std::size_t i(0) ; i!=aData.mX.size() ; ++i )
+    fprintf( f , "%zu,1,%.3f,%.3f,150,1000,0,10,1,%.3f\n" , i+1 , aData.mX[i]/nanometer , aData.mY[i]/nanometer , aData.mS[i]/nanometer );
+
+  if( fclose( f ) ) throw std::runtime_error( "Failed writing " + aFilename );
+}
+
+//! Format a length for the configuration parser
+//! \param aLength The length [m]
+//! \return The length as a string in nanometers
+inline std::string Nanometers( const double& aLength )
+{
+  std::ostringstream lStr;
+  lStr << std::setprecision( 12 ) << aLength / nanometer << "nm";
+  return lStr.str();
+}
+
+Configuration SyntheticConfiguration( const SyntheticParameters& aParameters , const std::size_t& aRbins , const std::size_t& aTbins )
+{
+  const double lWidth( aParameters.Width() );
+  Configuration lConfiguration;
+  lConfiguration.FromVector( { "--centre" , Nanometers( lWidth/2 ) , Nanometers( lWidth/2 ) , "--width" , Nanometers( lWidth ) , Nanometers( lWidth ) ,
+                               "--sigma-bins" , "100" , "--sigma-low" , "5nm" , "--sigma-high" , "100nm" ,
+                               "--sigma-curve" , "0nm:0.03631079" , "20nm:0.110302441" , "30nm:0.214839819" , "40nm:0.268302465" , "50nm:0.214839819" ,
+                                                 "60nm:0.110302441" , "70nm:0.03631079" , "80nm:0.007664194" , "90nm:0.001037236" , "100nm:9.00054E-05" ,
+                               "--r-bins" , std::to_string( aRbins ) , "--r-low" , "0nm" , "--r-high" , "200nm" ,
+                               "--t-bins" , std::to_string( aTbins ) , "--t-low" , "0nm" , "--t-high" , "500nm" ,
+                               "--pb" , "0.2" , "--alpha" , "20" } );
+  return lConfiguration;
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
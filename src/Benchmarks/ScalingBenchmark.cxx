@@ -0,0 +1,240 @@
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Cluster.hpp"
+#include "BayesianClustering/DataProxy.hpp"
+#include "BayesianClustering/Event.hpp"
+#include "BayesianClustering/EventProxy.hpp"
+#include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Synthetic.hpp"
+
+/* ===== BOOST libraries ===== */
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+// /* ===== C++ ===== */
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <numeric>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProgressBar.hpp"
+#include "Utilities/Vectorize.hpp"
+
+
+//! The key of a benchmark measurement: the number of points, the number of threads, the size of the RT grid and the stage
+typedef std::tuple< std::size_t , std::size_t , std::size_t , std::string > tKey;
+
+//! Time a piece of work
+//! \param aWork The work to time
+//! \return The wall-clock time [s]
+template< typename tWork >
+double Time( tWork&& aWork )
+{
+  auto lStart = std::chrono::steady_clock::now();
+  aWork();
+  return std::chrono::duration< double >( std::chrono::steady_clock::now() - lStart ).count();
+}
+
+//! Run every stage once for one data-set, thread-count and grid
+//! \param aData       The synthetic data-set
+//! \param aParameters The parameters of the data-set
+//! \param aGrid       The number of R and of T bins
+//! \param aInputFile  The CSV file from which to load, or empty to load from memory
+//! \param aLoaded     Set to the number of points which survived cropping
+//! \return The time of each stage [s]
+std::vector< std::pair< std::string , double > > RunStages( const SyntheticData& aData , const SyntheticParameters& aParameters , const std::size_t& aGrid , const std::string& aInputFile , std::size_t& aLoaded )
+{
+  std::vector< std::pair< std::string , double > > lTimes;
+  Configuration lConfiguration( SyntheticConfiguration( aParameters , aGrid , aGrid ) );
+  if( aInputFile.size() ) lConfiguration.SetInputFile( aInputFile );
+
+  std::unique_ptr< Event > lEvent;
+  if( aInputFile.size() ) lTimes.emplace_back( "LoadCSV"    , Time( [&]{ lEvent.reset( new Event( lConfiguration ) ); } ) );
+  else                    lTimes.emplace_back( "LoadMemory" , Time( [&]{ lEvent.reset( new Event( lConfiguration , aData.mX , aData.mY , aData.mS ) ); } ) );
+  aLoaded = lEvent->mData.size();
+
+  lTimes.emplace_back( "Preprocess" , Time( [&]{ lEvent->Preprocess(); } ) );
+  lTimes.emplace_back( "PreprocessLocalizationScores" , Time( [&]{ lEvent->PreprocessScan(); } ) );
+
+  std::atomic< std::size_t > lCells( 0 );
+  lTimes.emplace_back( "Scan" , Time( [&]{ lEvent->ScanRT( [&]( const EventProxy& , const double& , const double& , std::pair<int,int> ){ ++lCells; } ); } ) );
+  if( lCells != aGrid * aGrid ) throw std::runtime_error( "Scan evaluated " + std::to_string( lCells ) + " cells, expected " + std::to_string( aGrid * aGrid ) );
+
+  // Time one row of the scan, at the middle R, with EventProxy::ScanT itself
+  EventProxy lProxy( *lEvent );
+  const uint32_t lRIndex( aGrid / 2 );
+  std::vector< uint32_t > lTIndices( aGrid );
+  std::iota( lTIndices.begin() , lTIndices.end() , 0 );
+  lTimes.emplace_back( "ScanRow" , Time( [&]{ lProxy.ScanT( []( const EventProxy& , const double& , const double& , std::pair<int,int> ){} , lRIndex , lTIndices ); } ) );
+
+  // Then split the same row into the clusterization and the scoring by taking the steps of ScanT in turn - the clusterization grows as T falls, and the cells at which no data-point joins are skipped
+  const double R( lConfiguration.Rvalue( lRIndex ) ) , twoR2( 4.0 * R * R );
+  double lClusterize( 0 ) , lScoring( 0 );
+  lProxy.ResetClusterization();
+  for( std::size_t j(0) ; j!=aGrid ; ++j )
+  {
+    if( j and lEvent->TUnchanged( lRIndex , j-1 , j ) ) continue;
+    lClusterize += Time( [&]{ lProxy.GrowClusterization( lRIndex , lConfiguration.Tvalue( j ) , twoR2 ); } );
+    lScoring += Time( [&]{ lProxy.UpdateLogScore(); } );
+  }
+  lProxy.ResetClusterization();
+  lTimes.emplace_back( "ClusterizeRow" , lClusterize );
+  lTimes.emplace_back( "ScoringRow" , lScoring );
+
+  return lTimes;
+}
+
+//! Read a results file written by a previous run
+//! \param aFilename The name of the file
+//! \return The time of each measurement [s]
+std::map< tKey , double > ReadResults( const std::string& aFilename )
+{
+  std::ifstream lFile( aFilename );
+  if( !lFile ) throw std::runtime_error( "Unable to open baseline " + aFilename );
+
+  std::map< tKey , double > lResults;
+  std::string lLine;
+  std::getline( lFile , lLine ); // Header
+  while( std::getline( lFile , lLine ) )
+  {
+    std::vector< std::string > lFields;
+    boost::split( lFields , lLine , [](char c){ return c==','; } );
+    if( lFields.size() != 6 ) continue;
+    lResults[ tKey( std::stoull( lFields[0] ) , std::stoull( lFields[2] ) , std::stoull( lFields[3] ) , lFields[4] ) ] = std::stod( lFields[5] );
+  }
+  return lResults;
+}
+
+
+/* ===== Main function ===== */
+int main(int argc, char **argv)
+{
+  std::cout << "+------------------------------------+" << std::endl;
+  ProgressBar2 lBar( "| Scaling Benchmark.                 |" , 1 );
+  std::cout << "+------------------------------------+" << std::endl;
+
+  namespace po = boost::program_options;
+  std::vector< double > lSizes{ 1e4 , 1e5 , 1e6 };
+  std::vector< std::size_t > lThreads{ Nthreads };
+  std::vector< std::size_t > lGrids{ 35 };
+  std::size_t lRepeats( 1 );
+  bool lMemory( false );
+  std::string lWorkdir( "/tmp" ) , lOutput , lBaseline;
+  double lTolerance( 0.2 ) , lMinDelta( 0.005 );
+  SyntheticParameters lParameters;
+  double lDensity( lParameters.mDensity * micrometer * micrometer ) , lSpread( lParameters.mClusterSpread / nanometer );
+  double lUncertainty( lParameters.mUncertainty / nanometer ) , lUncertaintySpread( lParameters.mUncertaintySpread / nanometer );
+
+  po::options_description lDesc( "Benchmark options" );
+  lDesc.add_options()
+    ( "help",               po::bool_switch()                                                  , "produce help message" )
+    ( "sizes",              po::value< std::vector< double > >( &lSizes )->multitoken()        , "Numbers of localizations to benchmark (default 1e4 1e5 1e6)" )
+    ( "threads",            po::value< std::vector< std::size_t > >( &lThreads )->multitoken() , "Thread-counts to benchmark (default is value given by std::threads::hardware_concurrency())" )
+    ( "grids",              po::value< std::vector< std::size_t > >( &lGrids )->multitoken()   , "Sizes N of the N-by-N RT grid to benchmark (default 35)" )
+    ( "repeats",            po::value< std::size_t >( &lRepeats )                              , "Number of repeats of each measurement, of which the fastest is kept (default 1)" )
+    ( "memory",             po::bool_switch( &lMemory )                                        , "Load from memory instead of timing LoadCSV on a generated ThunderSTORM file" )
+    ( "workdir",            po::value< std::string >( &lWorkdir )                              , "Directory for the generated CSV files (default /tmp)" )
+    ( "density",            po::value< double >( &lDensity )                                   , "Density of localizations, per square micrometer (default 500)" )
+    ( "cluster-fraction",   po::value< double >( &lParameters.mClusterFraction )               , "Fraction of localizations in clusters (default 0.5)" )
+    ( "cluster-size",       po::value< double >( &lParameters.mClusterSize )                   , "Mean number of localizations per cluster (default 50)" )
+    ( "cluster-spread",     po::value< double >( &lSpread )                                    , "Standard deviation of the clusters, in nanometers (default 30)" )
+    ( "uncertainty",        po::value< double >( &lUncertainty )                               , "Mean localization uncertainty, in nanometers (default 20)" )
+    ( "uncertainty-spread", po::value< double >( &lUncertaintySpread )                         , "Standard deviation of the localization uncertainty, in nanometers (default 5)" )
+    ( "seed",               po::value< uint64_t >( &lParameters.mSeed )                        , "Seed of the synthetic data (default 0)" )
+    ( "output,o",           po::value< std::string >( &lOutput )                               , "CSV file to which to write the results" )
+    ( "baseline",           po::value< std::string >( &lBaseline )                             , "Results of a previous run, against which to flag regressions" )
+    ( "tolerance",          po::value< double >( &lTolerance )                                 , "Fractional slow-down beyond which a stage is flagged as a regression (default 0.2)" )
+    ( "min-delta",          po::value< double >( &lMinDelta )                                  , "Slow-down, in seconds, below which a stage is never flagged (default 0.005)" )
+  ;
+
+  po::variables_map lVm;
+  po::store( po::parse_command_line( argc , argv , lDesc ) , lVm );
+  po::notify( lVm );
+  if( lVm[ "help" ].as< bool >() ) { std::cout << lDesc << std::endl; return 0; }
+
+  lParameters.mDensity = lDensity / ( micrometer * micrometer );
+  lParameters.mClusterSpread = lSpread * nanometer;
+  lParameters.mUncertainty = lUncertainty * nanometer;
+  lParameters.mUncertaintySpread = lUncertaintySpread * nanometer;
+
+  std::map< tKey , double > lBaselineResults;
+  if( lBaseline.size() ) lBaselineResults = ReadResults( lBaseline );
+
+  std::ostringstream lResults;
+  lResults << "points,loaded,threads,grid,stage,seconds\n";
+  std::size_t lRegressions( 0 );
+  std::ostringstream lSummary;
+  lSummary << std::left << std::setw( 10 ) << "points" << std::setw( 9 ) << "threads" << std::setw( 6 ) << "grid" << std::setw( 30 ) << "stage"
+           << std::right << std::setw( 12 ) << "seconds" << std::setw( 12 ) << "baseline" << std::setw( 10 ) << "change" << "\n";
+
+  for( auto& lSize : lSizes )
+  {
+    lParameters.mPoints = std::llround( lSize );
+    const SyntheticData lData( GenerateSynthetic( lParameters ) );
+
+    std::string lInputFile;
+    if( !lMemory )
+    {
+      lInputFile = lWorkdir + "/Synthetic_" + std::to_string( lParameters.mPoints ) + "_" + std::to_string( lParameters.mSeed ) + ".csv";
+      WriteThunderstormCSV( lInputFile , lData );
+    }
+
+    for( auto& lThreadCount : lThreads )
+    {
+      Nthreads = lThreadCount;
+      for( auto& lGrid : lGrids )
+      {
+        std::vector< std::pair< std::string , double > > lBest;
+        std::size_t lLoaded( 0 );
+        for( std::size_t i(0) ; i!=lRepeats ; ++i )
+        {
+          auto lTimes( RunStages( lData , lParameters , lGrid , lInputFile , lLoaded ) );
+          if( lBest.empty() ) lBest = lTimes;
+          for( std::size_t j(0) ; j!=lTimes.size() ; ++j ) lBest[j].second = std::min( lBest[j].second , lTimes[j].second );
+        }
+
+        for( auto& lStage : lBest )
+        {
+          lResults << lParameters.mPoints << "," << lLoaded << "," << lThreadCount << "," << lGrid << "," << lStage.first << "," << std::setprecision( 6 ) << lStage.second << "\n";
+          lSummary << std::left << std::setw( 10 ) << lParameters.mPoints << std::setw( 9 ) << lThreadCount << std::setw( 6 ) << lGrid << std::setw( 30 ) << lStage.first
+                   << std::right << std::fixed << std::setprecision( 4 ) << std::setw( 12 ) << lStage.second;
+
+          auto lIt( lBaselineResults.find( tKey( lParameters.mPoints , lThreadCount , lGrid , lStage.first ) ) );
+          if( lIt != lBaselineResults.end() )
+          {
+            const bool lRegression( lStage.second > lIt->second * ( 1.0 + lTolerance ) and lStage.second - lIt->second > lMinDelta );
+            lSummary << std::setw( 12 ) << lIt->second << std::setw( 9 ) << std::setprecision( 1 ) << 100.0 * ( lStage.second / lIt->second - 1.0 ) << "%" << ( lRegression ? "  REGRESSION" : "" );
+            if( lRegression ) ++lRegressions;
+          }
+          lSummary << std::defaultfloat << "\n";
+        }
+      }
+    }
+
+    if( lInputFile.size() ) std::remove( lInputFile.c_str() );
+  }
+
+  std::cout << "+------------------------------------+\n" << lSummary.str() << "+------------------------------------+" << std::endl;
+
+  if( lOutput.size() )
+  {
+    std::ofstream lFile( lOutput );
+    lFile << lResults.str();
+    if( !lFile ) throw std::runtime_error( "Failed writing " + lOutput );
+  }
+
+  if( lRegressions )
+  {
+    std::cout << lRegressions << " stage(s) regressed against " << lBaseline << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,276 @@
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Cluster.hpp"
+#include "BayesianClustering/Event.hpp"
+#include "BayesianClustering/EventProxy.hpp"
+#include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Synthetic.hpp"
+
+/* ===== BOOST libraries ===== */
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+
+// /* ===== C++ ===== */
+#include <cmath>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProgressBar.hpp"
+#include "Utilities/NormalCDF.hpp"
+
+
+//! A cluster sampled from a real clusterization: its size and its parameters for each sigma hypothesis
+struct ClusterSample
+{
+  //! The number of points in the cluster
+  std::size_t mClusterSize;
+  //! The parameters, one per sigma hypothesis
+  std::vector< Cluster::Parameter > mParams;
+};
+
+//! The throughput and accuracy of one scoring variant
+struct KernelResult
+{
+  //! The name of the variant
+  std::string mName;
+  //! The number of evaluations per pass over the inputs
+  std::size_t mEvaluations;
+  //! The time per evaluation [ns]
+  double mNanoseconds;
+  //! The largest absolute deviation from the reference
+  double mMaxDeviation;
+  //! The mean absolute deviation from the reference
+  double mMeanDeviation;
+  //! The largest deviation from the reference, relative to the reference
+  double mMaxRelativeDeviation;
+};
+
+//! Time a kernel, repeating passes over its inputs until a minimum time has elapsed
+//! \param aPass    A single pass over the inputs, returning a value which depends on every evaluation
+//! \param aMinTime The minimum time over which to measure [s]
+//! \param aCount   The number of evaluations in a pass
+//! \return The time per evaluation [ns]
+template< typename tPass >
+double TimeKernel( tPass&& aPass , const double& aMinTime , const std::size_t& aCount )
+{
+  volatile double lSink( aPass() ); // Warm the caches, and keep the result alive so that the work cannot be elided
+  std::size_t lPasses( 0 );
+  double lElapsed( 0 );
+  auto lStart = std::chrono::steady_clock::now();
+  do {
+    lSink = lSink + aPass();
+    ++lPasses;
+    lElapsed = std::chrono::duration< double >( std::chrono::steady_clock::now() - lStart ).count();
+  } while( lElapsed < aMinTime );
+  return 1e9 * lElapsed / ( lPasses * aCount );
+}
+
+//! Compare a set of values against their references
+//! \param aResult     The result to which to add the deviations
+//! \param aValues     The values of the variant under test
+//! \param aReferences The high-precision reference values
+void Deviations( KernelResult& aResult , const std::vector< double >& aValues , const std::vector< long double >& aReferences )
+{
+  long double lSum( 0 );
+  aResult.mMaxDeviation = aResult.mMaxRelativeDeviation = 0;
+  for( std::size_t i(0) ; i!=aValues.size() ; ++i )
+  {
+    const long double lDeviation( std::fabs( aValues[i] - aReferences[i] ) );
+    lSum += lDeviation;
+    aResult.mMaxDeviation = std::max< double >( aResult.mMaxDeviation , lDeviation );
+    if( aReferences[i] != 0 ) aResult.mMaxRelativeDeviation = std::max< double >( aResult.mMaxRelativeDeviation , lDeviation / std::fabs( aReferences[i] ) );
+  }
+  aResult.mEvaluations = aValues.size();
+  aResult.mMeanDeviation = aValues.size() ? double( lSum / aValues.size() ) : 0.0;
+}
+
+//! The normal CDF in long double precision
+//! \param x The point at which to evaluate the CDF
+//! \return The probability of a value below x
+long double ReferenceCDF( const long double& x )
+{
+  return 0.5L * std::erfc( -x / std::sqrt( 2.0L ) );
+}
+
+//! Cluster::Parameter::log_score in long double precision, from the same (double) inputs
+//! \param aParam The cluster parameters
+//! \param aE     Set to the long double value of C - Bx^2/A - By^2/A
+//! \return The log-score
+long double ReferenceLogScore( const Cluster::Parameter& aParam , long double& aE )
+{
+  const long double A( aParam.A ) , Bx( aParam.Bx ) , By( aParam.By ) , C( aParam.C ) , logF( aParam.logF );
+  const long double sqrt_A( std::sqrt( A ) ) , Dx( Bx / A ) , Dy( By / A );
+  aE = C - ( Bx * Dx ) - ( By * Dy );
+  const long double Gx( ReferenceCDF( sqrt_A * ( 1.0L - Dx ) ) - ReferenceCDF( sqrt_A * ( -1.0L - Dx ) ) );
+  const long double Gy( ReferenceCDF( sqrt_A * ( 1.0L - Dy ) ) - ReferenceCDF( sqrt_A * ( -1.0L - Dy ) ) );
+  return logF - std::log( A ) - ( 0.5L * aE ) + std::log( Gx ) + std::log( Gy );
+}
+
+//! Cluster::UpdateLogScore in long double precision: the same linear interpolation (i.e. trapezium rule) over the sigma bins
+//! \param aSample        The cluster
+//! \param aConfiguration The configuration, which determines the sigma hypotheses
+//! \return The log-score of the cluster
+long double ReferenceClusterScore( const ClusterSample& aSample , const Configuration& aConfiguration )
+{
+  const long double log2pi( std::log( 8.0L * std::atan( 1.0L ) ) );
+  const std::size_t lCount( aConfiguration.sigmacount() );
+
+  std::vector< long double > lArguments( lCount );
+  long double lLargest( -1e4000L ) , E;
+  for( std::size_t i(0) ; i!=lCount ; ++i )
+  {
+    lArguments[i] = ReferenceLogScore( aSample.mParams[i] , E ) + aConfiguration.log_probability_sigma( i );
+    lLargest = std::max( lLargest , lArguments[i] );
+  }
+
+  long double lIntegral( 0 );
+  for( std::size_t i(1) ; i!=lCount ; ++i )
+    lIntegral += 0.5L * ( std::exp( lArguments[i-1] - lLargest ) + std::exp( lArguments[i] - lLargest ) ) * ( (long double)( aConfiguration.sigmabins(i) ) - aConfiguration.sigmabins(i-1) );
+
+  const long double n( aSample.mClusterSize );
+  return std::log( lIntegral ) + lLargest - std::log( 4.0L ) + ( log2pi * ( 1.0L - n ) ) + std::log( 0.25L ) - ( n * log2pi );
+}
+
+
+/* ===== Main function ===== */
+int main(int argc, char **argv)
+{
+  std::cout << "+------------------------------------+" << std::endl;
+  ProgressBar2 lBar( "| Scoring Benchmark.                 |" , 1 );
+  std::cout << "+------------------------------------+" << std::endl;
+
+  namespace po = boost::program_options;
+  SyntheticParameters lParameters;
+  double lPoints( 1e5 ) , lMinTime( 0.5 );
+  std::vector< std::string > lRT{ "20nm:40nm" , "50nm:100nm" , "100nm:200nm" };
+  std::string lOutput;
+
+  po::options_description lDesc( "Benchmark options" );
+  lDesc.add_options()
+    ( "help",     po::bool_switch()                                                  , "produce help message" )
+    ( "points",   po::value< double >( &lPoints )                                    , "Number of localizations in the synthetic data-set from which the clusters are drawn (default 1e5)" )
+    ( "seed",     po::value< uint64_t >( &lParameters.mSeed )                        , "Seed of the synthetic data (default 0)" )
+    ( "rt",       po::value< std::vector< std::string > >( &lRT )->multitoken()      , "Colon-separated R:T pairs at which to clusterize to draw the clusters (default 20nm:40nm 50nm:100nm 100nm:200nm)" )
+    ( "min-time", po::value< double >( &lMinTime )                                   , "Minimum time over which to measure each variant, in seconds (default 0.5)" )
+    ( "output,o", po::value< std::string >( &lOutput )                               , "CSV file to which to write the results" )
+  ;
+
+  po::variables_map lVm;
+  po::store( po::parse_command_line( argc , argv , lDesc ) , lVm );
+  po::notify( lVm );
+  if( lVm[ "help" ].as< bool >() ) { std::cout << lDesc << std::endl; return 0; }
+
+  // Draw a population of clusters from real clusterizations of a synthetic data-set
+  lParameters.mPoints = std::llround( lPoints );
+  const Configuration lConfiguration( SyntheticConfiguration( lParameters , 1 , 1 ) );
+  const SyntheticData lData( GenerateSynthetic( lParameters ) );
+  Event lEvent( lConfiguration , lData.mX , lData.mY , lData.mS );
+
+  std::vector< ClusterSample > lSamples;
+  for( auto& i : lRT )
+  {
+    std::vector< std::string > lStrs;
+    boost::split( lStrs , i , [](char c){ return c==':'; } );
+    if( lStrs.size() != 2 ) throw std::runtime_error( "Expected a colon-separated R:T pair, got " + i );
+    lEvent.Clusterize( StrToDist( lStrs[0] ) , StrToDist( lStrs[1] ) , [&]( const EventProxy& aProxy ){
+      for( auto& j : aProxy.mClusters ) if( j.mClusterSize ) lSamples.push_back( ClusterSample{ j.mClusterSize , j.mParams } );
+    } );
+  }
+  if( lSamples.empty() ) throw std::runtime_error( "No clusters found" );
+
+  std::vector< Cluster::Parameter > lParams;
+  for( auto& i : lSamples ) lParams.insert( lParams.end() , i.mParams.begin() , i.mParams.end() );
+
+  // The references, and the arguments with which log_score calls the normal CDF
+  std::vector< long double > lRefLogScore( lParams.size() ) , lRefAltLogScore( lParams.size() );
+  std::vector< double > lS2( lParams.size() );
+  const long double log2pi( std::log( 8.0L * std::atan( 1.0L ) ) );
+  for( std::size_t i(0) ; i!=lParams.size() ; ++i )
+  {
+    long double E;
+    lRefLogScore[i] = ReferenceLogScore( lParams[i] , E );
+    lRefAltLogScore[i] = lRefLogScore[i] + log2pi;
+    lS2[i] = double( E ); // alt_log_score takes the residual from the validation pass, which is equal to E
+  }
+
+  std::vector< double > lCdfArguments;
+  for( auto& i : lParams )
+  {
+    const double sqrt_A( sqrt( i.A ) ) , Dx( i.Bx / i.A ) , Dy( i.By / i.A );
+    for( auto& j : { sqrt_A * ( 1.0 - Dx ) , sqrt_A * ( -1.0 - Dx ) , sqrt_A * ( 1.0 - Dy ) , sqrt_A * ( -1.0 - Dy ) } ) lCdfArguments.push_back( j );
+  }
+
+  // Since the cluster arguments are mostly far in the tails, also sweep the range where the CDF is not saturated
+  std::vector< double > lCdfSweep( 1 << 16 );
+  std::mt19937_64 lEngine( lParameters.mSeed );
+  std::uniform_real_distribution< double > lUniform( -10.0 , 10.0 );
+  for( auto& i : lCdfSweep ) i = lUniform( lEngine );
+
+  std::vector< Cluster > lClusters;
+  lClusters.reserve( lSamples.size() );
+  for( auto& i : lSamples )
+  {
+    lClusters.emplace_back( lConfiguration );
+    lClusters.back().mParams = i.mParams;
+    lClusters.back().mClusterSize = i.mClusterSize;
+  }
+  Cluster::Scratch lScratch( lConfiguration );
+
+  std::cout << "Sampled " << lSamples.size() << " clusters, " << lParams.size() << " parameter sets" << std::endl;
+
+  // Measure
+  std::vector< KernelResult > lResults;
+  auto Run = [&]( const std::string& aName , const std::size_t& aCount , const std::function< double( const std::size_t& ) >& aKernel , const std::vector< long double >& aReferences ){
+    KernelResult lResult{ aName };
+    std::vector< double > lValues( aCount );
+    for( std::size_t i(0) ; i!=aCount ; ++i ) lValues[i] = aKernel( i );
+    Deviations( lResult , lValues , aReferences );
+    lResult.mNanoseconds = TimeKernel( [&]{ double lSum( 0 ); for( std::size_t i(0) ; i!=aCount ; ++i ) lSum += aKernel( i ); return lSum; } , lMinTime , aCount );
+    lResults.push_back( lResult );
+  };
+
+  {
+    ProgressBar2 lProgressBar( "Benchmarking kernels" , 0 );
+
+    std::vector< long double > lRefCdf( lCdfArguments.size() ) , lRefSweep( lCdfSweep.size() ) , lRefCluster( lSamples.size() );
+    for( std::size_t i(0) ; i!=lCdfArguments.size() ; ++i ) lRefCdf[i] = ReferenceCDF( lCdfArguments[i] );
+    for( std::size_t i(0) ; i!=lCdfSweep.size() ; ++i )     lRefSweep[i] = ReferenceCDF( lCdfSweep[i] );
+    for( std::size_t i(0) ; i!=lSamples.size() ; ++i )      lRefCluster[i] = ReferenceClusterScore( lSamples[i] , lConfiguration );
+
+    Run( "normal_cdf (cluster arguments)" , lCdfArguments.size() , [&]( const std::size_t& i ){ return normal_cdf( lCdfArguments[i] ); } , lRefCdf );
+    Run( "normal_cdf (sweep -10 to 10)"   , lCdfSweep.size()     , [&]( const std::size_t& i ){ return normal_cdf( lCdfSweep[i] ); }     , lRefSweep );
+    Run( "log_score"                      , lParams.size()       , [&]( const std::size_t& i ){ return lParams[i].log_score(); }         , lRefLogScore );
+    Run( "alt_log_score"                  , lParams.size()       , [&]( const std::size_t& i ){ return lParams[i].alt_log_score( lS2[i] ); } , lRefAltLogScore );
+    Run( "UpdateLogScore (per cluster)"   , lClusters.size()     , [&]( const std::size_t& i ){
+      Cluster& lCluster( lClusters[i] );
+      lCluster.mLastClusterSize = 0; // Force the re-evaluation
+      lCluster.UpdateLogScore( lConfiguration , lScratch );
+      return double( lCluster.mClusterScore );
+    } , lRefCluster );
+  }
+
+  // Report
+  std::cout << "+------------------------------------+\n"
+            << std::left << std::setw( 34 ) << "variant" << std::right << std::setw( 12 ) << "evaluations" << std::setw( 12 ) << "ns/eval"
+            << std::setw( 14 ) << "max dev" << std::setw( 14 ) << "mean dev" << std::setw( 14 ) << "max rel dev" << "\n";
+  for( auto& i : lResults )
+    std::cout << std::left << std::setw( 34 ) << i.mName << std::right << std::setw( 12 ) << i.mEvaluations << std::fixed << std::setprecision( 2 ) << std::setw( 12 ) << i.mNanoseconds
+              << std::scientific << std::setprecision( 3 ) << std::setw( 14 ) << i.mMaxDeviation << std::setw( 14 ) << i.mMeanDeviation << std::setw( 14 ) << i.mMaxRelativeDeviation << std::defaultfloat << "\n";
+  std::cout << "+------------------------------------+" << std::endl;
+
+  if( lOutput.size() )
+  {
+    std::ofstream lFile( lOutput );
+    lFile << "variant,evaluations,ns_per_eval,max_deviation,mean_deviation,max_relative_deviation\n" << std::setprecision( 6 );
+    for( auto& i : lResults ) lFile << i.mName << "," << i.mEvaluations << "," << i.mNanoseconds << "," << i.mMaxDeviation << "," << i.mMeanDeviation << "," << i.mMaxRelativeDeviation << "\n";
+    if( !lFile ) throw std::runtime_error( "Failed writing " + lOutput );
+  }
+
+  return 0;
+}
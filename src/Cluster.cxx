@@ -3,6 +3,7 @@
 #include "BayesianClustering/Event.hpp"
 #include "BayesianClustering/EventProxy.hpp"
 #include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Export.hpp"
 
 // /* ===== C++ ===== */
 #include <vector>
@@ -13,28 +14,37 @@
   
 /* ===== Local utilities ===== */
 #include "Utilities/ProgressBar.hpp"
+#include "Utilities/Instrumentation.hpp"
+#include "Utilities/PerfCounters.hpp"
 #include "Utilities/ListComprehension.hpp"
+#include "Utilities/Vectorize.hpp"
 
 
-//! Callback to report clusters
-// \param aEvent The event to draw
-void ReportClusters( const EventProxy& aProxy )
+//! Report the clusters
+//! \param aLabels The dense cluster labels of a clusterization
+//! \return The report
+std::string ReportClusters( const ClusterLabels& aLabels )
 {
-  std::map< const Cluster* , std::vector< const Data* > > lClusters;
-
-  for( auto& i : aProxy.mData )
-  { 
-    lClusters[ i.mCluster ? i.mCluster->GetParent() : NULL ].push_back( i.mData );
-  }
-
-  std::cout << lClusters.size() << " Clusters" << std::endl;
-
-  for( auto& i : lClusters )
-  { 
-    if( i.first ) std::cout << " > Cluster of " << i.second.size() << " localizations" << std::endl;
-    else          std::cout << " > " << i.second.size() << " background localizations" << std::endl;    
-  } 
+  std::stringstream lStr;
+  lStr << aLabels.mSizes.size() << " Clusters" << std::endl;
+  for( auto& i : aLabels.mSizes ) lStr << " > Cluster of " << i << " localizations" << std::endl;
+  lStr << " > " << aLabels.mBackgroundCount << " background localizations" << std::endl;    
+  return lStr.str();
+}
 
+//! The name of the file to which to export the labelled localizations for a given (R, T) pair
+//! \param aFilename The output file given in the configuration
+//! \param aRT       The (R, T) pair
+//! \param aSuffix   Whether to add the (R, T) pair to the name, to distinguish the results of several pairs
+//! \return The name of the file
+std::string ExportFilename( const std::string& aFilename , const std::pair< double , double >& aRT , const bool& aSuffix )
+{
+  if( not aSuffix ) return aFilename;
+  std::stringstream lStr;
+  lStr << "_R" << aRT.first / nanometer << "nm_T" << aRT.second / nanometer << "nm";
+  const std::size_t lSlash( aFilename.find_last_of( '/' ) ) , lDot( aFilename.find_last_of( '.' ) );
+  if( lDot == std::string::npos or ( lSlash != std::string::npos and lSlash > lDot ) ) return aFilename + lStr.str();
+  return aFilename.substr( 0 , lDot ) + lStr.str() + aFilename.substr( lDot );
 }
 
 
@@ -45,18 +55,42 @@ int main(int argc, char **argv)
   std::cout << "+------------------------------------+" << std::endl;
   ProgressBar2 lBar( "| Cluster. Andrew W. Rose. 2022 |" , 1 );
   std::cout << "+------------------------------------+" << std::endl;
-  Configuration::Instance.FromCommandline( argc , argv );
-  Configuration::Instance.SetRBins( 0 , 0 , Configuration::Instance.ClusterR() );
+  Configuration lConfiguration;
+  lConfiguration.FromCommandline( argc , argv );
+
+  // Either a list of (R, T) pairs or a single pair
+  std::vector< std::pair< double , double > > lRT( lConfiguration.ClusterRT() );
+  if( lRT.empty() ) lRT.emplace_back( lConfiguration.ClusterR() , lConfiguration.ClusterT() );
+  for( auto& i : lRT ) if( i.first < 0 or i.second < 0 ) throw std::runtime_error( "R and T must be specified and non-negative" );
+
+  lConfiguration.SetRBins( 0 , 0 , std::max_element( lRT.begin() , lRT.end() )->first );
   std::cout << "+------------------------------------+" << std::endl;
 
-  Event lEvent;  
+  Nthreads = PlanThreads( lConfiguration , Nthreads ); // Before the load, which is itself parallel
+  Event lEvent( lConfiguration );  
+  lEvent.Preprocess(); // Once, for the largest R, shared by all the pairs
 
-  lEvent.Clusterize( 
-    Configuration::Instance.ClusterR() , 
-    Configuration::Instance.ClusterT() , 
-    &ReportClusters
-  ); 
+  // Each pair is clusterized in turn on its own proxy, across all the threads, and the labelled localizations optionally exported
+  const std::string& lFilename( lConfiguration.outputFile() );
+  std::vector< std::string > lReports( lRT.size() );
+  for( std::size_t i(0) ; i!=lRT.size() ; ++i )
+  {
+    lEvent.Clusterize( lRT[i].first , lRT[i].second , [&]( const EventProxy& aProxy ){ 
+      ClusterLabels lLabels( aProxy );
+      lReports[i] = ReportClusters( lLabels );
+      if( lFilename.size() ) lLabels.Write( ExportFilename( lFilename , lRT[i] , lRT.size() > 1 ) );
+    } ); 
+  }
+  lEvent.RecordMemory( "Clusterize" );
+
+  for( std::size_t i(0) ; i!=lRT.size() ; ++i )
+  {
+    std::cout << "R = " << lRT[i].first << ", T = " << lRT[i].second << ": " << lReports[i];
+  }
 
   std::cout << "+------------------------------------+" << std::endl;
+  WriteMemoryReport( lEvent.mMemoryLog , std::cout );
+  Instrumentation::Finalize();
+  PerfCounters::Finalize();
 
 }
@@ -0,0 +1,526 @@
+/* ===== Cluster sources ===== */
+#include "BayesianClustering/Cluster.hpp"
+#include "BayesianClustering/Data.hpp"
+#include "BayesianClustering/Event.hpp"
+#include "BayesianClustering/EventProxy.hpp"
+#include "BayesianClustering/Configuration.hpp"
+
+/* ===== BOOST libraries ===== */
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+
+// /* ===== C++ ===== */
+#include <list>
+#include <set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProgressBar.hpp"
+#include "Utilities/Instrumentation.hpp"
+#include "Utilities/PerfCounters.hpp"
+#include "Utilities/Vectorize.hpp"
+
+using boost::asio::local::stream_protocol;
+
+
+//! Escape a string for inclusion in a JSON document
+//! \param aStr The string to escape
+//! \return The quoted, escaped string
+std::string JsonString( const std::string& aStr )
+{
+  std::ostringstream lStr;
+  lStr << '"';
+  for( auto& c : aStr )
+  {
+    if( c == '"' or c == '\\' )                          lStr << '\\' << c;
+    else if( c == '\n' )                                 lStr << "\\n";
+    else if( static_cast< unsigned char >( c ) < 0x20 ) lStr << ' '; // Compared unsigned, so that the bytes of UTF-8 characters are kept
+    else                                                 lStr << c;
+  }
+  lStr << '"';
+  return lStr.str();
+}
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A preprocessed event held by the daemon
+struct Dataset
+{
+  //! The event, shared with any queries or scans currently using it
+  std::shared_ptr< Event > mEvent;
+  //! The memory accounted to the event in bytes
+  std::size_t mBytes;
+  //! The position of the dataset in the least-recently-used list
+  std::list< std::string >::iterator mLru;
+};
+
+//! An RT-scan job run in the background by the daemon
+struct ScanJob
+{
+  //! The name of the dataset being scanned
+  std::string mDataset;
+  //! The state of the job: "queued", "running", "done" or "failed"
+  std::string mState = "queued";
+  //! The error message if the job failed
+  std::string mError;
+  //! The number of cells completed
+  std::atomic< std::size_t > mDone{ 0 };
+  //! The R values of the scan
+  std::vector< double > mR;
+  //! The T values of the scan
+  std::vector< double > mT;
+  //! The log-probability density of each cell, as a flattened Rbins x Tbins matrix
+  std::vector< double > mScores;
+};
+
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! A daemon which keeps events preprocessed in memory and answers clusterization queries over a Unix-domain socket
+class Daemon
+{
+public:
+  //! Constructor
+  //! \param aPath        The path of the Unix-domain socket
+  //! \param aBudget      The memory budget for preprocessed events in bytes (0 for unlimited)
+  //! \param aWorkers     The number of connections which may be served concurrently
+  //! \param aScanWorkers The number of RT-scan jobs which may be run concurrently
+  Daemon( const std::string& aPath , const std::size_t& aBudget , const std::size_t& aWorkers , const std::size_t& aScanWorkers ) :
+    mPath( aPath ) , mBudget( aBudget ) , mUsed( 0 ) , mQueryPool( aWorkers ) , mScanPool( aScanWorkers ) , mNextJob( 0 ) , mStop( false )
+  {}
+
+  //! Accept connections until a shutdown request is received
+  void Run()
+  {
+    ::unlink( mPath.c_str() );
+    stream_protocol::acceptor lAcceptor( mContext , stream_protocol::endpoint( mPath ) );
+    std::cout << "Listening on " << mPath << std::endl;
+
+    while( true )
+    {
+      auto lSocket = std::make_shared< stream_protocol::socket >( mContext );
+      lAcceptor.accept( *lSocket );
+      if( mStop ) break;
+
+      std::lock_guard< std::mutex > lLock( mSocketMutex );
+      mSockets.insert( lSocket->native_handle() );
+      boost::asio::post( mQueryPool , [ this , lSocket ](){ Serve( lSocket ); } );
+    }
+
+    // Wake any connections blocked waiting for requests, then wait for the workers and any running scans
+    {
+      std::lock_guard< std::mutex > lLock( mSocketMutex );
+      for( auto& i : mSockets ) ::shutdown( i , SHUT_RDWR );
+    }
+    mQueryPool.join();
+    mScanPool.join();
+    ::unlink( mPath.c_str() );
+  }
+
+private:
+  //! Serve the requests on a single connection, one per line, until the client disconnects
+  //! \param aSocket The connected socket
+  void Serve( std::shared_ptr< stream_protocol::socket > aSocket )
+  {
+    boost::asio::streambuf lBuffer;
+    boost::system::error_code lError;
+
+    while( true )
+    {
+      boost::asio::read_until( *aSocket , lBuffer , '\n' , lError );
+      if( lError ) break;
+
+      std::istream lStream( &lBuffer );
+      std::string lLine;
+      std::getline( lStream , lLine );
+
+      const std::string lReply( Handle( lLine ) + "\n" );
+      boost::asio::write( *aSocket , boost::asio::buffer( lReply ) , lError );
+      if( lError ) break;
+    }
+
+    std::lock_guard< std::mutex > lLock( mSocketMutex );
+    mSockets.erase( aSocket->native_handle() );
+  }
+
+  //! Dispatch a single request
+  //! \param aLine The request
+  //! \return The JSON reply
+  std::string Handle( const std::string& aLine )
+  {
+    std::istringstream lArgs( aLine );
+    std::string lCommand;
+    lArgs >> lCommand;
+
+    try
+    {
+      if( lCommand == "load" )       return Load( lArgs );
+      if( lCommand == "unload" )     return Unload( lArgs );
+      if( lCommand == "list" )       return List();
+      if( lCommand == "clusterize" ) return Clusterize( lArgs );
+      if( lCommand == "scan" )       return Scan( lArgs );
+      if( lCommand == "result" )     return Result( lArgs );
+      if( lCommand == "shutdown" )   return Shutdown();
+      throw std::runtime_error( "Unknown command '" + lCommand + "'" );
+    }
+    catch( const std::exception& aExc )
+    {
+      return "{\"status\":\"error\",\"message\":" + JsonString( aExc.what() ) + "}";
+    }
+  }
+
+  //! Load and preprocess a dataset - `load <name> <configuration arguments...>`
+  //! \param aArgs The request arguments
+  //! \return The JSON reply
+  std::string Load( std::istream& aArgs )
+  {
+    std::string lName;
+    if( not ( aArgs >> lName ) ) throw std::runtime_error( "Usage: load <name> <configuration arguments...>" );
+
+    std::vector< std::string > lArgs;
+    for( std::string lArg ; aArgs >> lArg ; )
+    {
+      if( lArg == "--help" or lArg == "--threads" or lArg == "--memory-budget" ) throw std::runtime_error( "'" + lArg + "' is not permitted in a load request" );
+      lArgs.push_back( lArg );
+    }
+
+    Configuration lConfiguration;
+    lConfiguration.FromVector( lArgs );
+    if( lConfiguration.maxR() <= 0 ) throw std::runtime_error( "The R range must be specified: it bounds the R of all later queries" );
+
+    auto lEvent = std::make_shared< Event >( lConfiguration );
+    lEvent->PreprocessScan();
+    const std::size_t lBytes( lEvent->MemoryUsage().Total() );
+
+    std::lock_guard< std::mutex > lLock( mStoreMutex );
+    if( mBudget and lBytes > mBudget ) throw std::runtime_error( "Dataset requires " + std::to_string( lBytes ) + " bytes, which exceeds the memory budget" );
+    EraseDataset( lName );
+    while( mBudget and mUsed + lBytes > mBudget ) EraseDataset( mLru.back() );
+
+    mLru.push_front( lName );
+    mDatasets[ lName ] = Dataset{ lEvent , lBytes , mLru.begin() };
+    mUsed += lBytes;
+
+    std::ostringstream lStr;
+    lStr << "{\"status\":\"ok\",\"name\":" << JsonString( lName ) << ",\"points\":" << lEvent->mData.size() << ",\"bytes\":" << lBytes << "}";
+    return lStr.str();
+  }
+
+  //! Drop a dataset - `unload <name>`
+  //! \param aArgs The request arguments
+  //! \return The JSON reply
+  std::string Unload( std::istream& aArgs )
+  {
+    std::string lName;
+    aArgs >> lName;
+    std::lock_guard< std::mutex > lLock( mStoreMutex );
+    if( not EraseDataset( lName ) ) throw std::runtime_error( "Unknown dataset '" + lName + "'" );
+    return "{\"status\":\"ok\"}";
+  }
+
+  //! List the datasets, most-recently-used first - `list`
+  //! \return The JSON reply
+  std::string List()
+  {
+    std::lock_guard< std::mutex > lLock( mStoreMutex );
+    std::ostringstream lStr;
+    lStr << "{\"status\":\"ok\",\"budget\":" << mBudget << ",\"used\":" << mUsed << ",\"datasets\":[";
+    for( auto i( mLru.begin() ) ; i != mLru.end() ; ++i )
+    {
+      const Dataset& lDataset( mDatasets.at( *i ) );
+      lStr << ( i == mLru.begin() ? "" : "," ) << "{\"name\":" << JsonString( *i ) << ",\"points\":" << lDataset.mEvent->mData.size() << ",\"bytes\":" << lDataset.mBytes << "}";
+    }
+    lStr << "]}";
+    return lStr.str();
+  }
+
+  //! Clusterize a dataset for a single R and T - `clusterize <name> <R> <T> [points]`
+  //! \param aArgs The request arguments
+  //! \return The JSON reply, listing the size, score and mean position (in nm) of each cluster, and optionally the positions of their points
+  std::string Clusterize( std::istream& aArgs )
+  {
+    std::string lName , lR , lT , lOption;
+    if( not ( aArgs >> lName >> lR >> lT ) ) throw std::runtime_error( "Usage: clusterize <name> <R> <T> [points]" );
+    aArgs >> lOption;
+    const bool lPoints( lOption == "points" );
+    const double R( StrToDist( lR ) ) , T( StrToDist( lT ) );
+
+    std::shared_ptr< Event > lEvent( GetDataset( lName ) );
+    const Configuration& lConfiguration( lEvent->configuration() );
+    if( R < 0 or T < 0 ) throw std::runtime_error( "R and T must be non-negative" );
+    if( R > lConfiguration.maxR() ) throw std::runtime_error( "R exceeds the maximum R for which the dataset was preprocessed" ); // Otherwise the event would be re-preprocessed under our feet
+
+    std::ostringstream lStr;
+    lStr << std::setprecision( 10 );
+
+    lEvent->Clusterize( R , T , [&]( const EventProxy& aProxy ){
+      // Dense IDs are assigned in order of first appearance
+      std::vector< int64_t > lIds( aProxy.mClusters.size() , -1 );
+      std::vector< const Cluster* > lClusters;
+      std::vector< std::vector< const Data* > > lMembers;
+
+      for( auto& i : aProxy.mData )
+      {
+        if( !i.mCluster ) continue;
+        const Cluster* lCluster( i.mCluster->GetParent() );
+        int64_t& lId( lIds[ lCluster - aProxy.mClusters.data() ] );
+        if( lId < 0 )
+        {
+          lId = lClusters.size();
+          lClusters.push_back( lCluster );
+          lMembers.emplace_back();
+        }
+        lMembers[ lId ].push_back( i.mData );
+      }
+
+      lStr << "{\"status\":\"ok\",\"R\":" << R << ",\"T\":" << T << ",\"score\":" << aProxy.mLogP
+           << ",\"clustered\":" << aProxy.mClusteredCount << ",\"background\":" << aProxy.mBackgroundCount << ",\"clusters\":[";
+
+      for( std::size_t i(0) ; i!=lClusters.size() ; ++i )
+      {
+        double lX( 0 ) , lY( 0 );
+        for( auto& j : lMembers[i] ){ lX += j->x; lY += j->y; }
+        lX = ( ( lX / lMembers[i].size() ) + lConfiguration.getCentreX() ) / nanometer;
+        lY = ( ( lY / lMembers[i].size() ) + lConfiguration.getCentreY() ) / nanometer;
+
+        lStr << ( i ? "," : "" ) << "{\"size\":" << lClusters[i]->mClusterSize << ",\"score\":" << lClusters[i]->mClusterScore << ",\"x\":" << lX << ",\"y\":" << lY;
+        if( lPoints )
+        {
+          lStr << ",\"points\":[";
+          for( std::size_t j(0) ; j!=lMembers[i].size() ; ++j )
+            lStr << ( j ? "," : "" ) << "[" << ( lMembers[i][j]->x + lConfiguration.getCentreX() ) / nanometer << "," << ( lMembers[i][j]->y + lConfiguration.getCentreY() ) / nanometer << "]";
+          lStr << "]";
+        }
+        lStr << "}";
+      }
+      lStr << "]}";
+    } );
+
+    return lStr.str();
+  }
+
+  //! Start an RT-scan of a dataset in the background - `scan <name>`
+  //! \param aArgs The request arguments
+  //! \return The JSON reply, giving the ID of the job
+  std::string Scan( std::istream& aArgs )
+  {
+    std::string lName;
+    aArgs >> lName;
+    std::shared_ptr< Event > lEvent( GetDataset( lName ) );
+
+    auto lJob = std::make_shared< ScanJob >();
+    lJob->mDataset = lName;
+
+    uint64_t lId;
+    {
+      std::lock_guard< std::mutex > lLock( mJobMutex );
+      lId = mNextJob++;
+      mJobs[ lId ] = lJob;
+    }
+
+    boost::asio::post( mScanPool , [ lEvent , lJob , this ](){ RunScan( *lEvent , *lJob ); } );
+    return "{\"status\":\"ok\",\"job\":" + std::to_string( lId ) + "}";
+  }
+
+  //! Run an RT-scan job on the scan pool
+  //! \param aEvent The preprocessed event to scan
+  //! \param aJob   The job in which to record the results
+  void RunScan( Event& aEvent , ScanJob& aJob )
+  {
+    try
+    {
+      const Configuration& lConfiguration( aEvent.configuration() );
+      const std::size_t lRbins( lConfiguration.Rbins() ) , lTbins( lConfiguration.Tbins() );
+      {
+        std::lock_guard< std::mutex > lLock( mJobMutex );
+        aJob.mState = "running";
+        for( std::size_t i(0) ; i!=lRbins ; ++i ) aJob.mR.push_back( lConfiguration.Rvalue( i ) );
+        for( std::size_t j(0) ; j!=lTbins ; ++j ) aJob.mT.push_back( lConfiguration.Tvalue( j ) );
+        aJob.mScores.resize( lRbins * lTbins );
+      }
+
+      // Each cell is written by exactly one thread
+      auto lRecord = [&]( const EventProxy& aProxy , const double& , const double& , std::pair<int,int> aIJ ){
+        aJob.mScores[ ( aIJ.first * lTbins ) + aIJ.second ] = aProxy.mLogP;
+        ++aJob.mDone;
+      };
+
+      // The event was fully preprocessed at load, so the scan goes straight to clustering
+      aEvent.ScanRT( lRecord );
+
+      std::lock_guard< std::mutex > lLock( mJobMutex );
+      aJob.mState = "done";
+    }
+    catch( const std::exception& aExc )
+    {
+      std::lock_guard< std::mutex > lLock( mJobMutex );
+      aJob.mState = "failed";
+      aJob.mError = aExc.what();
+    }
+  }
+
+  //! Get the state, and when complete the results, of an RT-scan job - `result <job>`
+  //! \param aArgs The request arguments
+  //! \return The JSON reply
+  std::string Result( std::istream& aArgs )
+  {
+    uint64_t lId;
+    if( not ( aArgs >> lId ) ) throw std::runtime_error( "Usage: result <job>" );
+
+    std::lock_guard< std::mutex > lLock( mJobMutex );
+    auto lIt( mJobs.find( lId ) );
+    if( lIt == mJobs.end() ) throw std::runtime_error( "Unknown job " + std::to_string( lId ) );
+    const ScanJob& lJob( *lIt->second );
+
+    std::ostringstream lStr;
+    lStr << std::setprecision( 10 );
+    lStr << "{\"status\":\"ok\",\"job\":" << lId << ",\"dataset\":" << JsonString( lJob.mDataset ) << ",\"state\":\"" << lJob.mState << "\""
+         << ",\"done\":" << lJob.mDone << ",\"total\":" << lJob.mScores.size();
+    if( lJob.mState == "failed" ) lStr << ",\"message\":" << JsonString( lJob.mError );
+
+    if( lJob.mState == "done" and lJob.mScores.size() )
+    {
+      const std::size_t lTbins( lJob.mT.size() );
+      const std::size_t lBest( std::max_element( lJob.mScores.begin() , lJob.mScores.end() ) - lJob.mScores.begin() );
+      lStr << ",\"best\":{\"R\":" << lJob.mR[ lBest / lTbins ] << ",\"T\":" << lJob.mT[ lBest % lTbins ] << ",\"score\":" << lJob.mScores[ lBest ] << "}";
+
+      lStr << ",\"R\":[";
+      for( std::size_t i(0) ; i!=lJob.mR.size() ; ++i ) lStr << ( i ? "," : "" ) << lJob.mR[i];
+      lStr << "],\"T\":[";
+      for( std::size_t j(0) ; j!=lTbins ; ++j ) lStr << ( j ? "," : "" ) << lJob.mT[j];
+      lStr << "],\"scores\":[";
+      for( std::size_t i(0) ; i!=lJob.mR.size() ; ++i )
+      {
+        lStr << ( i ? ",[" : "[" );
+        for( std::size_t j(0) ; j!=lTbins ; ++j ) lStr << ( j ? "," : "" ) << lJob.mScores[ ( i * lTbins ) + j ];
+        lStr << "]";
+      }
+      lStr << "]";
+    }
+    lStr << "}";
+    return lStr.str();
+  }
+
+  //! Stop accepting connections - `shutdown`
+  //! \return The JSON reply
+  std::string Shutdown()
+  {
+    mStop = true;
+
+    // Connect to ourselves to wake the blocking accept
+    stream_protocol::socket lWake( mContext );
+    lWake.connect( stream_protocol::endpoint( mPath ) );
+    return "{\"status\":\"ok\"}";
+  }
+
+  //! Get a dataset, marking it as most-recently used
+  //! \param aName The name of the dataset
+  //! \return The event
+  std::shared_ptr< Event > GetDataset( const std::string& aName )
+  {
+    std::lock_guard< std::mutex > lLock( mStoreMutex );
+    auto lIt( mDatasets.find( aName ) );
+    if( lIt == mDatasets.end() ) throw std::runtime_error( "Unknown dataset '" + aName + "'" );
+    mLru.splice( mLru.begin() , mLru , lIt->second.mLru );
+    return lIt->second.mEvent;
+  }
+
+  //! Drop a dataset from the store (it is freed once any queries or scans using it complete) - the store mutex must be held
+  //! \param aName The name of the dataset
+  //! \return Whether the dataset existed
+  bool EraseDataset( const std::string& aName )
+  {
+    auto lIt( mDatasets.find( aName ) );
+    if( lIt == mDatasets.end() ) return false;
+    std::cout << "Dropping dataset '" << aName << "' (" << lIt->second.mBytes << " bytes)" << std::endl;
+    mUsed -= lIt->second.mBytes;
+    mLru.erase( lIt->second.mLru );
+    mDatasets.erase( lIt );
+    return true;
+  }
+
+private:
+  //! The path of the Unix-domain socket
+  std::string mPath;
+  //! The memory budget for preprocessed events in bytes (0 for unlimited)
+  std::size_t mBudget;
+  //! The estimated memory used by preprocessed events in bytes
+  std::size_t mUsed;
+
+  //! The asio context for the sockets
+  boost::asio::io_context mContext;
+  //! The pool serving connections
+  boost::asio::thread_pool mQueryPool;
+  //! The pool running RT-scan jobs, kept separate so that long scans never delay queries
+  boost::asio::thread_pool mScanPool;
+
+  //! Mutex guarding the dataset store
+  std::mutex mStoreMutex;
+  //! The datasets by name
+  std::map< std::string , Dataset > mDatasets;
+  //! The names of the datasets, most-recently used first
+  std::list< std::string > mLru;
+
+  //! Mutex guarding the jobs
+  std::mutex mJobMutex;
+  //! The RT-scan jobs by ID
+  std::map< uint64_t , std::shared_ptr< ScanJob > > mJobs;
+  //! The ID of the next job
+  uint64_t mNextJob;
+
+  //! Mutex guarding the set of open connections
+  std::mutex mSocketMutex;
+  //! The native handles of the open connections
+  std::set< int > mSockets;
+  //! Whether a shutdown has been requested
+  std::atomic< bool > mStop;
+};
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+
+
+/* ===== Main function ===== */
+int main(int argc, char **argv)
+{
+  std::cout << "+------------------------------------+" << std::endl;
+  ProgressBar2 lBar( "| Cluster Daemon. Andrew W. Rose. 2022 |" , 1 );
+  std::cout << "+------------------------------------+" << std::endl;
+
+  namespace po = boost::program_options;
+  std::string lSocket( "/tmp/BayesianClustering.sock" );
+  double lBudget( 0 );
+  std::size_t lWorkers( 4 ) , lScanWorkers( 1 );
+
+  po::options_description lDesc( "Daemon options" );
+  lDesc.add_options()
+    ( "help",          po::bool_switch()                      , "produce help message" )
+    ( "socket",        po::value< std::string >( &lSocket )   , "Path of the Unix-domain socket (default /tmp/BayesianClustering.sock)" )
+    ( "memory-budget", po::value< double >( &lBudget )        , "Memory budget for preprocessed datasets in MB, beyond which the least-recently-used are dropped (default unlimited)" )
+    ( "workers",       po::value< std::size_t >( &lWorkers )     , "Number of connections served concurrently (default 4)" )
+    ( "scan-workers",  po::value< std::size_t >( &lScanWorkers ) , "Number of RT-scan jobs run concurrently (default 1)" )
+    ( "threads",       po::value< std::size_t >( &Nthreads )     , "Number of threads used by each preprocessing or scan (default is value given by std::threads::hardware_concurrency())" )
+    ( "trace",         po::value< std::string >()->notifier( Instrumentation::SetTraceFile ) , "Write a Chrome trace-event JSON of the instrumentation to the given file on shutdown, and print a summary" )
+    ( "perf-counters", po::bool_switch()->notifier( []( const bool& aArg ){ if( aArg ) PerfCounters::Enable(); } ) , "Profile each stage with the hardware performance counters, and print a summary on shutdown" )
+  ;
+
+  po::variables_map lVm;
+  po::store( po::parse_command_line( argc , argv , lDesc ) , lVm );
+  po::notify( lVm );
+  if( lVm[ "help" ].as< bool >() ) { std::cout << lDesc << std::endl; return 0; }
+
+  std::cout << "+------------------------------------+" << std::endl;
+
+  Daemon lDaemon( lSocket , std::size_t( lBudget * 1024 * 1024 ) , lWorkers , lScanWorkers );
+  lDaemon.Run();
+
+  std::cout << "+------------------------------------+" << std::endl;
+  Instrumentation::Finalize();
+  PerfCounters::Finalize();
+}
@@ -2,7 +2,9 @@
 //! Self-contained sourcefile for producing python-bindings
 
 #include <boost/python.hpp>
+#include <boost/python/numpy.hpp>
 using namespace boost::python;
+namespace np = boost::python::numpy;
 
 #include "BayesianClustering/Configuration.hpp"
 #include "BayesianClustering/Event.hpp"
@@ -12,8 +14,15 @@ using namespace boost::python;
 #include "BayesianClustering/Data.hpp"
 #include "BayesianClustering/DataProxy.hpp"
 
+#include "Utilities/Vectorize.hpp"
+
 
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
 
 //! Utility function to convert a python list to STL vector
 //! \tparam T The object type in the STL container
@@ -97,22 +106,27 @@ struct PyIterator< U* >
 };
 // ---------------------------------------------------------------------------------------------
 
-//! Set the Bayesian-clustering configuration from a vector of arguments
+//! Create a Bayesian-clustering configuration from a vector of arguments
 //! \param aList A list of strings to parse as config arguments
-void ConfigFromVector( const boost::python::object& aList )
+//! \return The new configuration
+Configuration ConfigFromVector( const boost::python::object& aList )
 {
-  Configuration::Instance.FromVector( py_list_to_std_vector< std::string >( aList ) );
+  Configuration lConfiguration;
+  lConfiguration.FromVector( py_list_to_std_vector< std::string >( aList ) );
+  return lConfiguration;
 }
 
 //! Run a 1-pass clustering for a specified R & T and pass the results to a callback function
+//! \param aConfiguration The configuration specifying the input file and the R & T
 //! \param aCallback A callback to which results are passed
-void OneStopGetClusters( const boost::python::object& aCallback )
+void OneStopGetClusters( Configuration aConfiguration , const boost::python::object& aCallback )
 { 
-  Event lEvent;
+  aConfiguration.SetRBins( 0 , 0 , aConfiguration.ClusterR() );
 
-  Configuration::Instance.SetRBins( 0 , 0 , Configuration::Instance.ClusterR() );
+  ScopedThreads lThreads( PlanThreads( aConfiguration , Nthreads ) );
+  Event lEvent( aConfiguration );
 
-  lEvent.Clusterize( Configuration::Instance.ClusterR() , Configuration::Instance.ClusterT() , 
+  lEvent.Clusterize( aConfiguration.ClusterR() , aConfiguration.ClusterT() , 
     [&]( const EventProxy& aEventProxy ){
 
       boost::python::list lClusters;
@@ -134,6 +148,333 @@ void OneStopGetClusters( const boost::python::object& aCallback )
   ); 
 }
 
+//! Utility function to create a read-only numpy view of a member variable of every data-point in an event, without copying
+//! \param aEvent  A python handle to the event, which the returned array keeps alive
+//! \param aMember A pointer-to-member-variable of the data-points
+//! \return A strided numpy array viewing the C++ memory
+np::ndarray Event_GetView( const boost::python::object& aEvent , PRECISION Data::* aMember )
+{
+  const Event& lEvent = extract< const Event& >( aEvent );
+  if( lEvent.mData.empty() ) return np::empty( make_tuple( 0 ) , np::dtype::get_builtin< PRECISION >() );
+  const PRECISION* lPtr( &( lEvent.mData.front().*aMember ) );
+  return np::from_data( lPtr , np::dtype::get_builtin< PRECISION >() , make_tuple( lEvent.mData.size() ) , make_tuple( sizeof( Data ) ) , aEvent );
+}
+
+//! Zero-copy numpy view of the x-positions of the data-points in an event
+//! \param aEvent A python handle to the event
+//! \return A numpy array of the x-positions
+np::ndarray Event_GetX( const boost::python::object& aEvent ) { return Event_GetView( aEvent , &Data::x ); }
+//! Zero-copy numpy view of the y-positions of the data-points in an event
+//! \param aEvent A python handle to the event
+//! \return A numpy array of the y-positions
+np::ndarray Event_GetY( const boost::python::object& aEvent ) { return Event_GetView( aEvent , &Data::y ); }
+//! Zero-copy numpy view of the sigmas of the data-points in an event
+//! \param aEvent A python handle to the event
+//! \return A numpy array of the sigmas
+np::ndarray Event_GetS( const boost::python::object& aEvent ) { return Event_GetView( aEvent , &Data::s ); }
+
+//! Convert the results of a clusterization to numpy arrays in a single pass over the data-points
+//! \param aEventProxy The event-proxy holding the clusterization results
+//! \return A dictionary holding the per-point "label" (a dense cluster ID, or -1 for background) and the per-cluster "cluster_size", "cluster_score", "cluster_x" and "cluster_y" (the mean position)
+boost::python::dict ClustersToArrays( const EventProxy& aEventProxy )
+{
+  const std::size_t lSize( aEventProxy.mData.size() );
+  np::ndarray lLabels = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< int64_t >() );
+  int64_t* lLabelPtr( reinterpret_cast< int64_t* >( lLabels.get_data() ) );
+
+  // Dense IDs are assigned in order of first appearance, looked up by the position of the cluster in the event-proxy's list of clusters
+  std::vector< int64_t > lIds( aEventProxy.mClusters.size() , -1 );
+  std::vector< const Cluster* > lClusters;
+  std::vector< double > lSumX , lSumY;
+
+  for( std::size_t i(0) ; i!=lSize ; ++i )
+  {
+    const DataProxy& lProxy( aEventProxy.mData[i] );
+    if( !lProxy.mCluster ){ lLabelPtr[i] = -1; continue; }
+
+    const Cluster* lCluster( lProxy.mCluster->GetParent() );
+    int64_t& lId( lIds[ lCluster - aEventProxy.mClusters.data() ] );
+    if( lId < 0 )
+    {
+      lId = lClusters.size();
+      lClusters.push_back( lCluster );
+      lSumX.push_back( 0.0 );
+      lSumY.push_back( 0.0 );
+    }
+
+    lLabelPtr[i] = lId;
+    lSumX[ lId ] += lProxy.mData->x;
+    lSumY[ lId ] += lProxy.mData->y;
+  }
+
+  const std::size_t lCount( lClusters.size() );
+  np::ndarray lClusterSize  = np::empty( make_tuple( lCount ) , np::dtype::get_builtin< int64_t >() );
+  np::ndarray lClusterScore = np::empty( make_tuple( lCount ) , np::dtype::get_builtin< double >() );
+  np::ndarray lClusterX     = np::empty( make_tuple( lCount ) , np::dtype::get_builtin< double >() );
+  np::ndarray lClusterY     = np::empty( make_tuple( lCount ) , np::dtype::get_builtin< double >() );
+  int64_t* lSizePtr( reinterpret_cast< int64_t* >( lClusterSize.get_data() ) );
+  double* lScorePtr( reinterpret_cast< double* >( lClusterScore.get_data() ) );
+  double* lXPtr( reinterpret_cast< double* >( lClusterX.get_data() ) );
+  double* lYPtr( reinterpret_cast< double* >( lClusterY.get_data() ) );
+
+  for( std::size_t i(0) ; i!=lCount ; ++i )
+  {
+    lSizePtr[i]  = lClusters[i]->mClusterSize;
+    lScorePtr[i] = lClusters[i]->mClusterScore;
+    lXPtr[i]     = lSumX[i] / lClusters[i]->mClusterSize;
+    lYPtr[i]     = lSumY[i] / lClusters[i]->mClusterSize;
+  }
+
+  boost::python::dict lRet;
+  lRet[ "label" ] = lLabels;
+  lRet[ "cluster_size" ] = lClusterSize;
+  lRet[ "cluster_score" ] = lClusterScore;
+  lRet[ "cluster_x" ] = lClusterX;
+  lRet[ "cluster_y" ] = lClusterY;
+  return lRet;
+}
+
+//! Run a 1-pass clustering for the configured R & T and return the results as numpy arrays
+//! \param aConfiguration The configuration specifying the input file and the R & T
+//! \return A dictionary holding the "event", zero-copy views of the per-point "x", "y" and "s", and the clusterization results as per ClustersToArrays
+boost::python::dict OneStopGetClusterArrays( Configuration aConfiguration )
+{ 
+  aConfiguration.SetRBins( 0 , 0 , aConfiguration.ClusterR() );
+
+  ScopedThreads lThreads( PlanThreads( aConfiguration , Nthreads ) );
+
+  // Construct the event through python so that the views can hold a reference to it
+  boost::python::object lEventObj( boost::python::import( "BayesianClustering" ).attr( "Event" )( aConfiguration ) );
+  Event& lEvent = extract< Event& >( lEventObj );
+
+  boost::python::dict lRet;
+  lEvent.Clusterize( aConfiguration.ClusterR() , aConfiguration.ClusterT() , 
+    [&]( const EventProxy& aEventProxy ){ lRet = ClustersToArrays( aEventProxy ); }
+  ); 
+
+  lRet[ "event" ] = lEventObj;
+  lRet[ "x" ] = Event_GetX( lEventObj );
+  lRet[ "y" ] = Event_GetY( lEventObj );
+  lRet[ "s" ] = Event_GetS( lEventObj );
+  return lRet;
+}
+
+//! RAII helper to release the python GIL for the lifetime of the object
+struct ScopedGILRelease
+{
+  //! Constructor - releases the GIL
+  ScopedGILRelease() : mState( PyEval_SaveThread() ) {}
+
+  //! Destructor - reacquires the GIL
+  ~ScopedGILRelease() { PyEval_RestoreThread( mState ); }
+
+  //! The saved python thread-state
+  PyThreadState* mState;
+};
+
+//! A single result of an RT-scan, as queued for delivery to python
+struct ScanCell
+{
+  //! The index of the R-bin
+  int mRIndex;
+  //! The index of the T-bin
+  int mTIndex;
+  //! The log-probability density of the clusterization
+  double mLogP;
+  //! The number of clustered data-points
+  int64_t mClusteredCount;
+  //! The number of non-Null clusters
+  int64_t mClusterCount;
+};
+
+//! Convert a batch of RT-scan results to numpy arrays
+//! \param aConfiguration The configuration of the scanned event
+//! \param aBatch The batch of results
+//! \param aDone  The number of cells completed so far
+//! \param aTotal The total number of cells in the scan
+//! \return A dictionary holding the "R_index", "T_index", "R", "T", "score", "clustered" and "clusters" of each cell in the batch, plus the "done" and "total" cell counts
+boost::python::dict ScanBatchToArrays( const Configuration& aConfiguration , const std::vector< ScanCell >& aBatch , const std::size_t& aDone , const std::size_t& aTotal )
+{
+  const std::size_t lSize( aBatch.size() );
+  np::ndarray lRIndex = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< int64_t >() );
+  np::ndarray lTIndex = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< int64_t >() );
+  np::ndarray lR = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< double >() );
+  np::ndarray lT = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< double >() );
+  np::ndarray lScore = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< double >() );
+  np::ndarray lClustered = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< int64_t >() );
+  np::ndarray lClusters = np::empty( make_tuple( lSize ) , np::dtype::get_builtin< int64_t >() );
+
+  for( std::size_t i(0) ; i!=lSize ; ++i )
+  {
+    const ScanCell& lCell( aBatch[i] );
+    reinterpret_cast< int64_t* >( lRIndex.get_data() )[i] = lCell.mRIndex;
+    reinterpret_cast< int64_t* >( lTIndex.get_data() )[i] = lCell.mTIndex;
+    reinterpret_cast< double* >( lR.get_data() )[i] = aConfiguration.Rvalue( lCell.mRIndex );
+    reinterpret_cast< double* >( lT.get_data() )[i] = aConfiguration.Tvalue( lCell.mTIndex );
+    reinterpret_cast< double* >( lScore.get_data() )[i] = lCell.mLogP;
+    reinterpret_cast< int64_t* >( lClustered.get_data() )[i] = lCell.mClusteredCount;
+    reinterpret_cast< int64_t* >( lClusters.get_data() )[i] = lCell.mClusterCount;
+  }
+
+  boost::python::dict lRet;
+  lRet[ "R_index" ] = lRIndex;
+  lRet[ "T_index" ] = lTIndex;
+  lRet[ "R" ] = lR;
+  lRet[ "T" ] = lT;
+  lRet[ "score" ] = lScore;
+  lRet[ "clustered" ] = lClustered;
+  lRet[ "clusters" ] = lClusters;
+  lRet[ "done" ] = aDone;
+  lRet[ "total" ] = aTotal;
+  return lRet;
+}
+
+//! Gather the results of an RT-scan into a dictionary
+//! \param aR         The scanned R values
+//! \param aT         The scanned T values
+//! \param aScore     The Rbins x Tbins matrix of scores
+//! \param aClustered The Rbins x Tbins matrix of the number of clustered points
+//! \param aClusters  The Rbins x Tbins matrix of the number of clusters
+//! \return A dictionary holding "R", "T", "score", "clustered" and "clusters"
+boost::python::dict ScanResultsToDict( const np::ndarray& aR , const np::ndarray& aT , const np::ndarray& aScore , const np::ndarray& aClustered , const np::ndarray& aClusters )
+{
+  boost::python::dict lRet;
+  lRet[ "R" ] = aR;
+  lRet[ "T" ] = aT;
+  lRet[ "score" ] = aScore;
+  lRet[ "clustered" ] = aClustered;
+  lRet[ "clusters" ] = aClusters;
+  return lRet;
+}
+
+//! Run the RT-scan over the configured grid with the GIL released, and return the results as numpy arrays
+//! \param aEvent    The event to scan
+//! \param aCallback An optional python callable, which is passed batches of results (as per ScanBatchToArrays) as the scan progresses
+//! \param aInterval The minimum interval, in seconds, between calls to the callback - must be positive
+//! \return A dictionary holding the scanned "R" and "T" values, and the Rbins x Tbins matrices of "score", "clustered" (number of clustered points) and "clusters" (number of clusters)
+boost::python::dict Event_ScanRT( Event& aEvent , const boost::python::object& aCallback , const double& aInterval )
+{
+  const Configuration& lConfiguration( aEvent.configuration() );
+  const std::size_t lRbins( lConfiguration.Rbins() ) , lTbins( lConfiguration.Tbins() );
+  if( not ( aInterval > 0 ) ) throw std::runtime_error( "The interval between callbacks must be positive" ); // Else the delivery loop would spin holding the GIL
+
+  np::ndarray lR = np::empty( make_tuple( lRbins ) , np::dtype::get_builtin< double >() );
+  np::ndarray lT = np::empty( make_tuple( lTbins ) , np::dtype::get_builtin< double >() );
+  np::ndarray lScore = np::empty( make_tuple( lRbins , lTbins ) , np::dtype::get_builtin< double >() );
+  np::ndarray lClustered = np::empty( make_tuple( lRbins , lTbins ) , np::dtype::get_builtin< int64_t >() );
+  np::ndarray lClusters = np::empty( make_tuple( lRbins , lTbins ) , np::dtype::get_builtin< int64_t >() );
+
+  double* lRPtr( reinterpret_cast< double* >( lR.get_data() ) );
+  double* lTPtr( reinterpret_cast< double* >( lT.get_data() ) );
+  double* lScorePtr( reinterpret_cast< double* >( lScore.get_data() ) );
+  int64_t* lClusteredPtr( reinterpret_cast< int64_t* >( lClustered.get_data() ) );
+  int64_t* lClustersPtr( reinterpret_cast< int64_t* >( lClusters.get_data() ) );
+
+  for( std::size_t i(0) ; i!=lRbins ; ++i ) lRPtr[i] = lConfiguration.Rvalue( i );
+  for( std::size_t j(0) ; j!=lTbins ; ++j ) lTPtr[j] = lConfiguration.Tvalue( j );
+
+  // Each cell of the matrices is written by exactly one thread
+  auto lStore = [&]( const EventProxy& aProxy , const std::pair<int,int>& aIJ ){
+    const std::size_t lIndex( ( aIJ.first * lTbins ) + aIJ.second );
+    lScorePtr[ lIndex ] = aProxy.mLogP;
+    lClusteredPtr[ lIndex ] = aProxy.mClusteredCount;
+    lClustersPtr[ lIndex ] = aProxy.mClusterCount;
+  };
+
+  if( aCallback.is_none() )
+  {
+    // With nothing to deliver, the scan runs on this thread with no locking or batching
+    {
+      ScopedGILRelease lRelease;
+      aEvent.ScanRT( [&]( const EventProxy& aProxy , const double& , const double& , std::pair<int,int> aIJ ){ lStore( aProxy , aIJ ); } );
+    }
+    return ScanResultsToDict( lR , lT , lScore , lClustered , lClusters ); // With the GIL held again
+  }
+
+  std::mutex lMutex;
+  std::condition_variable lCondition;
+  std::vector< ScanCell > lPending;
+  std::size_t lDone( 0 );
+  bool lFinished( false );
+  std::exception_ptr lException;
+
+  // Only the batch queue needs locking
+  auto lRecord = [&]( const EventProxy& aProxy , const double& , const double& , std::pair<int,int> aIJ ){
+    lStore( aProxy , aIJ );
+    std::lock_guard< std::mutex > lLock( lMutex );
+    ++lDone;
+    lPending.push_back( { aIJ.first , aIJ.second , aProxy.mLogP , int64_t( aProxy.mClusteredCount ) , int64_t( aProxy.mClusterCount ) } );
+  };
+
+  // The scan runs on its own thread, so that this thread can deliver batches to python at a bounded rate
+  std::thread lScan( [&](){
+    try{ aEvent.ScanRT( lRecord ); }
+    catch( ... ){ lException = std::current_exception(); }
+    std::lock_guard< std::mutex > lLock( lMutex );
+    lFinished = true;
+    lCondition.notify_all();
+  } );
+
+  try
+  {
+    while( true )
+    {
+      std::vector< ScanCell > lBatch;
+      std::size_t lBatchDone;
+      bool lLast;
+      {
+        ScopedGILRelease lRelease;
+        std::unique_lock< std::mutex > lLock( lMutex );
+        lCondition.wait_for( lLock , std::chrono::duration< double >( aInterval ) , [&](){ return lFinished; } );
+        lBatch.swap( lPending );
+        lBatchDone = lDone;
+        lLast = lFinished;
+      }
+
+      if( lBatch.size() ) aCallback( ScanBatchToArrays( lConfiguration , lBatch , lBatchDone , lRbins * lTbins ) );
+      if( lLast ) break;
+    }
+  }
+  catch( ... )
+  {
+    // The scan cannot be interrupted, so wait for it to finish before propagating the python exception
+    ScopedGILRelease lRelease;
+    lScan.join();
+    throw;
+  }
+
+  lScan.join();
+  if( lException ) std::rethrow_exception( lException );
+
+  return ScanResultsToDict( lR , lT , lScore , lClustered , lClusters );
+}
+
+//! Construct an event from numpy arrays (or anything convertible to them) of physical positions and uncertainties
+//! \param aConfiguration The configuration specifying the RoI
+//! \param aX The x-positions of the data-points in physical units
+//! \param aY The y-positions of the data-points in physical units
+//! \param aS The uncertainties of the data-points in physical units
+//! \return A new event, cropped to the RoI and sorted by radius
+Event* Event_FromArrays( const Configuration& aConfiguration , const boost::python::object& aX , const boost::python::object& aY , const boost::python::object& aS )
+{
+  // Contiguous double-precision arrays are used in place; anything else is converted once
+  const np::dtype lDouble( np::dtype::get_builtin< double >() );
+  np::ndarray lX = np::from_object( aX , lDouble , 1 , 1 , np::ndarray::C_CONTIGUOUS | np::ndarray::ALIGNED );
+  np::ndarray lY = np::from_object( aY , lDouble , 1 , 1 , np::ndarray::C_CONTIGUOUS | np::ndarray::ALIGNED );
+  np::ndarray lS = np::from_object( aS , lDouble , 1 , 1 , np::ndarray::C_CONTIGUOUS | np::ndarray::ALIGNED );
+
+  const std::size_t lCount( lX.shape(0) );
+  if( lY.shape(0) != lCount or lS.shape(0) != lCount ) throw std::runtime_error( "x, y and s must be the same length" );
+
+  const double* lXPtr( reinterpret_cast< const double* >( lX.get_data() ) );
+  const double* lYPtr( reinterpret_cast< const double* >( lY.get_data() ) );
+  const double* lSPtr( reinterpret_cast< const double* >( lS.get_data() ) );
+
+  ScopedGILRelease lRelease;
+  ScopedThreads lThreads( PlanThreads( aConfiguration , lXPtr , lYPtr , lCount , Nthreads ) );
+  return new Event( aConfiguration , lXPtr , lYPtr , lSPtr , lCount );
+}
+
 //! Utility function to get a python iterator over all the data points in a clusters
 //! \param aCluster The cluster over which we are iterating
 //! \return An iterator object pointing to a member of the cluster
@@ -173,17 +514,25 @@ std::size_t Event_GetSize( Event& aEvent )
 //! Boost Python Wrapper providing bindings for our C++ functions
 BOOST_PYTHON_MODULE( BayesianClustering )
 {
+  np::initialize();
 
   def( "OneStopGetClusters", &OneStopGetClusters );
+  def( "OneStopGetClusterArrays", &OneStopGetClusterArrays );
 
 	class_< Configuration >( "Configuration" )
     .def( "FromVector" , &ConfigFromVector ).staticmethod("FromVector")
     ;
 
-	class_< Event, boost::noncopyable >( "Event" )
+	class_< Event, boost::noncopyable >( "Event" , init< const Configuration& >( arg( "configuration" ) ) )
+    .def( "__init__" , make_constructor( &Event_FromArrays , default_call_policies() , ( arg( "configuration" ) , arg( "x" ) , arg( "y" ) , arg( "s" ) ) ) )
     .def( "__iter__" , &Event_GetIterator )
     .def( "__len__" , &Event_GetSize ) 
-    .def( "Preprocess" , &Event::Preprocess )       
+    .def( "Preprocess" , static_cast< void (Event::*)() >( &Event::Preprocess ) )       
+    .def( "ScanRT" , &Event_ScanRT , ( arg( "callback" ) = boost::python::object() , arg( "interval" ) = 1.0 ) )
+    .add_property( "x" , &Event_GetX )
+    .add_property( "y" , &Event_GetY )
+    .add_property( "s" , &Event_GetS )
+    .add_property( "configuration" , make_function( &Event::configuration , return_value_policy< copy_const_reference >() ) )
     ;
 
   class_< PyIterator<Data> >( "DataIterator", no_init )
@@ -193,7 +542,7 @@ BOOST_PYTHON_MODULE( BayesianClustering )
   class_< EventProxy, boost::noncopyable >( "EventProxy", init< Event& >() )
     ;   
 
-  class_< Cluster, boost::noncopyable >( "Cluster" )
+  class_< Cluster, boost::noncopyable >( "Cluster" , no_init )
     .def( "__iter__" , &Cluster_GetIterator )
     .def( "__len__" , &Cluster_GetSize )    
     ;        
@@ -3,6 +3,8 @@
 #include "BayesianClustering/Event.hpp"
 #include "BayesianClustering/EventProxy.hpp"
 #include "BayesianClustering/Configuration.hpp"
+#include "BayesianClustering/Checkpoint.hpp"
+#include "BayesianClustering/LocalizationStore.hpp"
 
 // /* ===== C++ ===== */
 #include <vector>
@@ -10,76 +12,99 @@
 #include <sstream>
 #include <iostream>
 #include <mutex>
+#include <memory>
   
 /* ===== Local utilities ===== */
 #include "Utilities/ProgressBar.hpp"
+#include "Utilities/Instrumentation.hpp"
+#include "Utilities/PerfCounters.hpp"
+#include "Utilities/Vectorize.hpp"
 
 
 std::mutex mtx; // mutex for critical section
 
+//! The exit status when the best cell of any scan lies on the edge of its prescan window
+constexpr int PrescanEdgeStatus = 2;
 
 
-void XmlCallback( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int>& aCurrentIJ , std::stringstream& aOutput, 
+
+//! Record the result of a cell of the RT-scan
+//! \param aCell             The cell
+//! \param aOutput           The scan results
+//! \param aRTScores         The score of each cell
+//! \param aMaxScorePosition The position of the best cell
+//! \param aMaxRTScore       The score of the best cell
+void ResultCallback( const ScanCell& aCell , std::stringstream& aOutput, 
                   std::vector<std::vector<double>>& aRTScores, std::pair<int,int>& aMaxScorePosition, double& aMaxRTScore )
 {
   mtx.lock();
   // aOutput << "  { R:" << aR << ", T:" << aT << ", Score:" << aEvent.mLogP << ", NumClusteredPts:" << aEvent.mClusteredCount << ", NumBackgroundPts:" << aEvent.mBackgroundCount << ", Clusters:[\n";
-  aOutput << "  { R:" << aR << ", T:" << aT << ", Score:" << aEvent.mLogP << ", NumClusteredPts:" << aEvent.mClusteredCount << ", NumBackgroundPts:" << aEvent.mBackgroundCount << "}\n";
+  aOutput << "  { R:" << aCell.mR << ", T:" << aCell.mT << ", Score:" << aCell.mLogP << ", NumClusteredPts:" << aCell.mClusteredCount << ", NumBackgroundPts:" << aCell.mBackgroundCount << "}\n";
 
   // for( auto& i : aEvent.mClusters )
   // {
   //   if( i.mClusterSize ) aOutput << "    { Points:" << i.mClusterSize << ",  Score:" << i.mClusterScore << " },\n";
   // }
   
-  double lLogP = aEvent.mLogP;
+  double lLogP = aCell.mLogP;
   //score setting stuff
   if (lLogP > aMaxRTScore){
-    aMaxScorePosition = aCurrentIJ;
+    aMaxScorePosition = std::make_pair( aCell.mRIndex , aCell.mTIndex );
     aMaxRTScore = lLogP;
   }
 
-  uint32_t p = aCurrentIJ.first, q = aCurrentIJ.second;
+  uint32_t p = aCell.mRIndex, q = aCell.mTIndex;
   aRTScores[p][q] = lLogP;
 
   // aOutput << "   },\n";
   mtx.unlock();  
 }
 
-
-void JsonCallback( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int,int>& aCurrentIJ , std::stringstream& aOutput, 
-                  std::vector<std::vector<double>>& aRTScores, std::pair<int,int>& aMaxScorePosition, double& aMaxRTScore )
+//! Write the scan results as XML, with the performance counters if enabled
+//! \param aFilename    The name of the file
+//! \param aOutput      The scan results
+//! \param aPrescanEdge Whether the best cell lies on the edge of the prescan window, or null if there was no prescan
+void WriteXml( const std::string& aFilename , const std::stringstream& aOutput , const bool* aPrescanEdge = NULL )
 {
-  mtx.lock();
-  // aOutput << "  { R:" << aR << ", T:" << aT << ", Score:" << aEvent.mLogP << ", NumClusteredPts:" << aEvent.mClusteredCount << ", NumBackgroundPts:" << aEvent.mBackgroundCount << ", Clusters:[\n";
-  aOutput << "  { R:" << aR << ", T:" << aT << ", Score:" << aEvent.mLogP << ", NumClusteredPts:" << aEvent.mClusteredCount << ", NumBackgroundPts:" << aEvent.mBackgroundCount << "}\n";
-
-  // for( auto& i : aEvent.mClusters )
-  // {
-  //   if( i.mClusterSize ) aOutput << "    { Points:" << i.mClusterSize << ",  Score:" << i.mClusterScore << " },\n";
-  // }
-  
-  double lLogP = aEvent.mLogP;
-  //score setting stuff
-  if (lLogP > aMaxRTScore){
-    aMaxScorePosition = aCurrentIJ;
-    aMaxRTScore = lLogP;
+  std::ofstream lOutFile( aFilename );
+  lOutFile << "<Results>\n" << aOutput.str();
+  if( aPrescanEdge ) lOutFile << "<PrescanEdge>" << ( *aPrescanEdge ? "true" : "false" ) << "</PrescanEdge>\n";
+  if( PerfCounters::IsEnabled )
+  {
+    lOutFile << "<PerfCounters>\n";
+    PerfCounters::WriteRecords( lOutFile );
+    lOutFile << "</PerfCounters>\n";
   }
+  lOutFile << "</Results>\n";
+}
 
-  uint32_t p = aCurrentIJ.first, q = aCurrentIJ.second;
-  aRTScores[p][q] = lLogP;
-
-  // aOutput << "   },\n";
-  mtx.unlock();  
+//! Write the scan results as JSON, followed by the performance counters if enabled
+//! \param aFilename    The name of the file
+//! \param aOutput      The scan results
+//! \param aPrescanEdge Whether the best cell lies on the edge of the prescan window, or null if there was no prescan
+void WriteJson( const std::string& aFilename , const std::stringstream& aOutput , const bool* aPrescanEdge = NULL )
+{
+  std::ofstream lOutFile( aFilename );
+  lOutFile << "{\nResults:[\n" << aOutput.str() << "]";
+  if( aPrescanEdge ) lOutFile << ",\nPrescanEdge:" << ( *aPrescanEdge ? "true" : "false" );
+  if( PerfCounters::IsEnabled )
+  {
+    lOutFile << ",\nPerfCounters:[\n";
+    PerfCounters::WriteRecords( lOutFile );
+    lOutFile << "]";
+  }
+  lOutFile << "\n}";
 }
 
+
 //just prints the best R, T at the end
-std::pair<double,double> bestRT(std::pair<int, int>& aMaxScorePosition, std::vector<std::vector<double>>& aRTScores){
+std::pair<double,double> bestRT(const Configuration& aConfiguration, std::pair<int, int>& aMaxScorePosition, std::vector<std::vector<double>>& aRTScores){
   int i = aMaxScorePosition.first, j = aMaxScorePosition.second;
   double lRValue(0), lTValue(0);
   double lValueSum(0);
   for(int I(-2); I < 3 ; ++I ){
     if ((i < 2) or (j < 2)) break;
-    if ((i > Configuration::Instance.Rbins() - 3 ) or (j > Configuration::Instance.Tbins() - 3)) break;
+    if ((i > aConfiguration.Rbins() - 3 ) or (j > aConfiguration.Tbins() - 3)) break;
     for(int J(-2); J < 3 ; ++J ){
       auto lVal = aRTScores[i + I][j + J];
       lValueSum += lVal;
@@ -90,64 +115,222 @@ std::pair<double,double> bestRT(std::pair<int, int>& aMaxScorePosition, std::vec
   double lRIndex = lRValue / lValueSum;
   double lTIndex = lTValue /  lValueSum;
 
-  double outputR = Configuration::Instance.minScanR() + (lRIndex * Configuration::Instance.dR());
-  double outputT = Configuration::Instance.maxScanT() - (lTIndex * Configuration::Instance.dT());
+  double outputR = aConfiguration.Rvalue( lRIndex );
+  double outputT = aConfiguration.Tvalue( lTIndex );
 
   return std::make_pair( outputR, outputT );
 }
 
 
 
-/* ===== Main function ===== */
-int main(int argc, char **argv)
+//! Find the candidate RoIs in a density map, and write the map and the candidates if requested
+//! \param aDensityMap    The density map
+//! \param aConfiguration The configuration
+//! \return The candidate RoIs
+std::vector< RegionOfInterest > ReportDensityMap( const DensityMap& aDensityMap , const Configuration& aConfiguration )
 {
+  const auto lCandidates( aDensityMap.Candidates( aConfiguration.roiThreshold() ) );
+  std::cout << "Found " << lCandidates.size() << " candidate RoIs in the density map of " << aDensityMap.Entries() << " localizations" << std::endl;
+  if( aConfiguration.densityMapFile().size() ) aDensityMap.Write( aConfiguration.densityMapFile() , lCandidates );
+  return lCandidates;
+}
 
+//! Load, scan and write the results for a single event
+//! \param aConfiguration The configuration of the scan
+//! \param aLoad          A callback which loads the event, unless its saved preprocessed state is loaded instead
+//! \return Whether the best cell lies on the edge of the prescan window, such that the true optimum may lie outside it
+bool ScanEvent( const Configuration& aConfiguration , const std::function< Event() >& aLoad )
+{
+  // With --checkpoint-event, a resumed scan loads the saved preprocessed event rather than reloading and preprocessing the input
+  const std::string lEventState( aConfiguration.checkpointFile() + ".event" );
+  const bool lLoadState( aConfiguration.checkpointEvent() and aConfiguration.resume() and std::ifstream( lEventState ).good() );
+  Event lEvent( lLoadState ? Event::LoadState( aConfiguration , lEventState ) : aLoad() );
+  if( aConfiguration.checkpointEvent() and !lLoadState )
+  {
+    lEvent.PreprocessScan();
+    lEvent.SaveState( lEventState );
+  }
+  if( lEvent.mDensityMap.Enabled() ) ReportDensityMap( lEvent.mDensityMap , aConfiguration );
 
-  std::cout << "+------------------------------------+" << std::endl;
-  ProgressBar2 lBar( "| Cluster Scan. Andrew W. Rose. 2022 |" , 1 );
-  std::cout << "+------------------------------------+" << std::endl;
-  Configuration::Instance.FromCommandline( argc , argv );
-  std::cout << "+------------------------------------+" << std::endl;
-
-  Event lEvent;  
-  std::vector<std::vector<double>> lRTScores(Configuration::Instance.Rbins(),
-                                            std::vector<double>(Configuration::Instance.Tbins()/*, 1*/));
+  std::vector<std::vector<double>> lRTScores(aConfiguration.Rbins(),
+                                            std::vector<double>(aConfiguration.Tbins()/*, 1*/));
   std::pair<int, int> lMaxScorePosition;
   double lMaxRTScore = -9E99;
   //the above will store our scores - it needs to end up in the callback
+  bool lPrescanEdge( false );
 
-  const std::string& lFilename = Configuration::Instance.outputFile();
+  const std::string& lFilename = aConfiguration.outputFile();
 
-  if( lFilename.size() == 0 )
-  {
-    std::cout << "Warning: Running scan without callback" << std::endl;
-    lEvent.ScanRT( [&]( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int> aCurrentIJ){} ); // Null callback
-  }
-  else if( lFilename.size() > 4 and lFilename.substr(lFilename.size() - 4) == ".xml" )
-  {
-    std::stringstream lOutput;
-    lEvent.ScanRT( [&]( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int> aCurrentIJ ){ XmlCallback( aEvent , aR , aT, aCurrentIJ  , lOutput, lRTScores, lMaxScorePosition, lMaxRTScore); } );
-    std::ofstream lOutFile( lFilename );
-    lOutFile << "<Results>\n" << lOutput.str() << "</Results>\n";
-  }
-  else if( lFilename.size() > 5 and lFilename.substr(lFilename.size() - 5) == ".json" )
+  if( aConfiguration.prescanFraction() and aConfiguration.adaptiveStride() ) throw std::runtime_error( "The prescan and the adaptive scan cannot be combined" );
+  if( aConfiguration.checkpointFile().size() and aConfiguration.adaptiveStride() ) throw std::runtime_error( "The adaptive scan cannot be checkpointed" );
+
+  // With a prescan, the full scan is restricted to a window around the best prescan cell
+  RTWindow lWindow{ 0 , int( aConfiguration.Rbins() ) - 1 , 0 , int( aConfiguration.Tbins() ) - 1 };
+  if( aConfiguration.prescanFraction() ) lWindow = lEvent.PrescanRT();
+
+  std::size_t lProxyMemory( 0 ); // The memory held by the event-proxies of the scan, recorded once it completes
+  auto lScanRT = [&]( const std::function< void( const EventProxy& , const double& , const double& , std::pair<int,int>  ) >& aCallback ){
+    if( aConfiguration.prescanFraction() ) lProxyMemory = lEvent.ScanRT( aCallback , lWindow );
+    else                                   lProxyMemory = lEvent.ScanRT( aCallback );
+  };
+
+  if( aConfiguration.adaptiveStride() )
   {
+    auto lSurface = lEvent.AdaptiveScanRT( [&]( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int> aCurrentIJ){} , &lProxyMemory ); // Results are collected in the returned surface
+    lEvent.RecordMemory( "Adaptive scan" , lProxyMemory );
+
     std::stringstream lOutput;
-    lEvent.ScanRT( [&]( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int> aCurrentIJ ){ JsonCallback( aEvent , aR , aT, aCurrentIJ  , lOutput, lRTScores, lMaxScorePosition, lMaxRTScore); } );
-    std::ofstream lOutFile( lFilename );
-    lOutFile << "{\nResults:[\n" << lOutput.str() << "]\n}";
+    for( auto& i : lSurface )
+    {
+      auto& lCell( i.second );
+      lOutput << "  { R:" << lCell.mR << ", T:" << lCell.mT << ", Score:" << lCell.mLogP << ", NumClusteredPts:" << lCell.mClusteredCount << ", NumBackgroundPts:" << lCell.mBackgroundCount << ", Level:" << lCell.mLevel << "}\n";
+      lRTScores[ i.first.first ][ i.first.second ] = lCell.mLogP;
+      if( lCell.mLogP > lMaxRTScore ){
+        lMaxScorePosition = i.first;
+        lMaxRTScore = lCell.mLogP;
+      }
+    }
+
+    if( lFilename.size() == 0 )
+    {
+      std::cout << "Warning: Running scan without output" << std::endl;
+    }
+    else if( lFilename.size() > 4 and lFilename.substr(lFilename.size() - 4) == ".xml" )
+    {
+      WriteXml( lFilename , lOutput );
+    }
+    else if( lFilename.size() > 5 and lFilename.substr(lFilename.size() - 5) == ".json" )
+    {
+      WriteJson( lFilename , lOutput );
+    }
+    else
+    {
+      throw std::runtime_error( "No handler for specified output-file" );
+    }
   }
   else
   {
-    throw std::runtime_error( "No handler for specified output-file" );
+    const bool lXml( lFilename.size() > 4 and lFilename.substr(lFilename.size() - 4) == ".xml" );
+    const bool lJson( lFilename.size() > 5 and lFilename.substr(lFilename.size() - 5) == ".json" );
+    if( lFilename.size() and !lXml and !lJson ) throw std::runtime_error( "No handler for specified output-file" );
+
+    std::stringstream lOutput;
+    std::function< void( const ScanCell& ) > lRecord( [&]( const ScanCell& aCell ){ ResultCallback( aCell , lOutput, lRTScores, lMaxScorePosition, lMaxRTScore ); } );
+    if( lFilename.size() == 0 )
+    {
+      std::cout << "Warning: Running scan without callback" << std::endl;
+      lRecord = []( const ScanCell& aCell ){}; // Null callback
+    }
+
+    if( aConfiguration.checkpointFile().empty() )
+    {
+      lScanRT( [&]( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int> aCurrentIJ ){ lRecord( MakeScanCell( aEvent , aR , aT , aCurrentIJ ) ); } );
+    }
+    else
+    {
+      // Replay the rows completed before the interruption, then scan only the remaining rows of the window
+      ScanCheckpoint lCheckpoint( aConfiguration , lWindow.mTHi - lWindow.mTLo + 1 );
+      for( auto& i : lCheckpoint.Cells() ) lRecord( i );
+
+      std::map< uint32_t , std::vector< uint32_t > > lCells;
+      for( int i( lWindow.mRLo ) ; i <= lWindow.mRHi ; ++i )
+        if( !lCheckpoint.RowComplete( i ) )
+          for( int j( lWindow.mTLo ) ; j <= lWindow.mTHi ; ++j )
+            lCells[ i ].push_back( j );
+
+      auto lCallback = [&]( const EventProxy& aEvent , const double& aR , const double& aT, std::pair<int, int> aCurrentIJ ){
+        const ScanCell lCell( MakeScanCell( aEvent , aR , aT , aCurrentIJ ) );
+        lRecord( lCell );
+        lCheckpoint.Record( lCell );
+      };
+      if( lCheckpoint.Cells().empty() ) lScanRT( lCallback );
+      else if( lCells.size() )          lProxyMemory = lEvent.ScanRT( lCallback , lCells );
+      lCheckpoint.Write();
+    }
+    lEvent.RecordMemory( "Scan" , lProxyMemory );
+
+    // Recorded in the output, so that an unattended pipeline can tell that the reported optimum may be wrong
+    lPrescanEdge = aConfiguration.prescanFraction() and lWindow.OnNarrowedEdge( lMaxScorePosition , aConfiguration.Rbins() , aConfiguration.Tbins() );
+    const bool* lPrescanFlag( aConfiguration.prescanFraction() ? &lPrescanEdge : NULL );
+    if( lXml )       WriteXml( lFilename , lOutput , lPrescanFlag );
+    else if( lJson ) WriteJson( lFilename , lOutput , lPrescanFlag );
   }
 
   std::cout << "max score was: " << lMaxRTScore << std::endl;
   std::cout << "at position (" << lMaxScorePosition.first << ", " << lMaxScorePosition.second << ")"<< std::endl;
-  std::cout << "out of a possible " << Configuration::Instance.Rbins() << " R Bins"
-  << " and " << Configuration::Instance.Tbins() << " T Bins" << std::endl;
+  std::cout << "out of a possible " << aConfiguration.Rbins() << " R Bins"
+  << " and " << aConfiguration.Tbins() << " T Bins" << std::endl;
   std::pair<double,double> a;
-  a = bestRT(lMaxScorePosition, lRTScores);
+  a = bestRT(aConfiguration, lMaxScorePosition, lRTScores);
   std::cout << "best R value is: " << a.first << " and the best T value is: " << a.second << std::endl;
 
+  if( aConfiguration.uncertaintyClasses() and lMaxRTScore > -9E99 )
+  {
+    // Rescore the best cell from the exact uncertainties, to report the error due to their quantization
+    lEvent.Clusterize( aConfiguration.Rvalue( lMaxScorePosition.first ) , aConfiguration.Tvalue( lMaxScorePosition.second ) , [&]( const EventProxy& aProxy ){
+      const double lError( aProxy.QuantizationError() );
+      std::cout << "Quantization of the uncertainties: at the best cell, the log-posterior is " << aProxy.mLogP << ", and " << aProxy.mLogP + lError << " without quantization (error " << lError << ")" << std::endl;
+    } );
+  }
+
+  if( lPrescanEdge )
+  {
+    std::cout << "WARNING: the best cell lies on the edge of the prescan window - the true optimum may lie outside it. Rerun with a larger --prescan-margin or without --prescan" << std::endl;
+  }
+
+  std::cout << "+------------------------------------+" << std::endl;
+  WriteMemoryReport( lEvent.mMemoryLog , std::cout );
+  return lPrescanEdge;
+}
+
+
+
+/* ===== Main function ===== */
+int main(int argc, char **argv)
+{
+
+
+  std::cout << "+------------------------------------+" << std::endl;
+  ProgressBar2 lBar( "| Cluster Scan. Andrew W. Rose. 2022 |" , 1 );
+  std::cout << "+------------------------------------+" << std::endl;
+  Configuration lConfiguration;
+  lConfiguration.FromCommandline( argc , argv );
+  std::cout << "+------------------------------------+" << std::endl;
+
+  bool lPrescanEdge( false );
+  if( lConfiguration.regionsOfInterest().empty() and !lConfiguration.autoRoI() )
+  {
+    Nthreads = PlanThreads( lConfiguration , Nthreads ); // Before the load, which is itself parallel
+    lPrescanEdge = ScanEvent( lConfiguration , [&](){ return Event( lConfiguration ); } );
+  }
+  else
+  {
+    // The input is parsed only once, into a store from which each RoI is cropped - on first use, so that it is never read if every RoI is resumed from its saved event
+    // unless the density map is needed, in which case the candidate RoIs are found from the map accumulated while the store is parsed
+    std::unique_ptr< LocalizationStore > lStore;
+    if( lConfiguration.densityBinSize() )
+    {
+      lStore.reset( new LocalizationStore( lConfiguration.inputFile() , lConfiguration.densityBinSize() ) );
+      const auto lCandidates( ReportDensityMap( lStore->mDensityMap , lConfiguration ) );
+      if( lConfiguration.autoRoI() ) for( auto& i : lCandidates ) lConfiguration.AddRegionOfInterest( i.mCentreX , i.mCentreY , i.mWidthX , i.mWidthY );
+    }
+
+    // Planned for the largest RoI plus the store - before the store is parsed, unless the RoIs are only known from its density map
+    Nthreads = PlanThreads( lConfiguration , lStore.get() , Nthreads );
+
+    for( std::size_t i(0) ; i!=lConfiguration.regionsOfInterest().size() ; ++i )
+    {
+      std::cout << "+------------------------------------+" << std::endl;
+      const Configuration lRoIConfiguration( lConfiguration.ForRegionOfInterest( i ) );
+      lPrescanEdge |= ScanEvent( lRoIConfiguration , [&](){ 
+        if( !lStore ) lStore.reset( new LocalizationStore( lConfiguration.inputFile() ) );
+        return Event( lRoIConfiguration , *lStore ); 
+      } );
+    }
+  }
+
+  Instrumentation::Finalize();
+  PerfCounters::Finalize();
+
+  return lPrescanEdge ? PrescanEdgeStatus : 0;
 }
@@ -0,0 +1,310 @@
+
+/* ===== Local utilities ===== */
+#include "Utilities/Instrumentation.hpp"
+
+// /* ===== C++ ===== */
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! The shared state of the instrumentation, which is only touched when a name or a thread is first seen, and when reporting
+struct InstrumentationRegistry
+{
+  //! Guards everything below
+  std::mutex mMutex;
+  //! The names, indexed by ID
+  std::vector< std::string > mNames;
+  //! The IDs, indexed by name
+  std::map< std::string , uint32_t > mIds;
+  //! The records of the live threads, each owned by its thread
+  std::set< Instrumentation::ThreadRecord* > mLive;
+  //! The records which threads have finished with, on exiting or moving on to another worker, folded together per worker so that their number is bounded by the workers rather than the threads
+  std::map< std::size_t , Instrumentation::ThreadRecord > mFolded;
+  //! The file to which to write the trace, if any
+  std::string mTraceFile;
+};
+
+//! Get the shared state, constructing it on first use
+//! \return The shared state
+InstrumentationRegistry& Registry()
+{
+  static InstrumentationRegistry lRegistry;
+  return lRegistry;
+}
+
+//! Fold a record into the totals of its worker - the caller must hold the lock
+//! \param aRegistry The shared state
+//! \param aRecord   The record to fold, which is left empty
+void Fold( InstrumentationRegistry& aRegistry , Instrumentation::ThreadRecord& aRecord )
+{
+  auto& lTotal( aRegistry.mFolded[ aRecord.mWorker ] );
+  lTotal.mWorker = aRecord.mWorker;
+  lTotal.mSpans.insert( lTotal.mSpans.end() , aRecord.mSpans.begin() , aRecord.mSpans.end() );
+
+  if( lTotal.mCounters.size() < aRecord.mCounters.size() ) lTotal.mCounters.resize( aRecord.mCounters.size() , 0 );
+  for( std::size_t i(0) ; i!=aRecord.mCounters.size() ; ++i ) lTotal.mCounters[i] += aRecord.mCounters[i];
+
+  if( lTotal.mHistograms.size() < aRecord.mHistograms.size() ) lTotal.mHistograms.resize( aRecord.mHistograms.size() , std::array< uint64_t , Instrumentation::HistogramBuckets >{} );
+  for( std::size_t i(0) ; i!=aRecord.mHistograms.size() ; ++i )
+    for( std::size_t j(0) ; j!=Instrumentation::HistogramBuckets ; ++j ) lTotal.mHistograms[i][j] += aRecord.mHistograms[i][j];
+
+  aRecord.mSpans.clear();
+  aRecord.mCounters.clear();
+  aRecord.mHistograms.clear();
+}
+
+//! Get every record, live and folded - the caller must hold the lock
+//! \param aRegistry The shared state
+//! \return The records
+std::vector< const Instrumentation::ThreadRecord* > Records( const InstrumentationRegistry& aRegistry )
+{
+  std::vector< const Instrumentation::ThreadRecord* > lRecords( aRegistry.mLive.begin() , aRegistry.mLive.end() );
+  for( auto& i : aRegistry.mFolded ) lRecords.push_back( &i.second );
+  return lRecords;
+}
+
+//! Owns the record of a thread, and folds it into the totals of its worker when the thread exits
+struct LocalRecordOwner
+{
+  //! Destructor
+  ~LocalRecordOwner()
+  {
+    if( !mRecord ) return;
+    auto& lRegistry( Registry() );
+    std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+    Fold( lRegistry , *mRecord );
+    lRegistry.mLive.erase( mRecord.get() );
+  }
+
+  //! The record of the thread
+  std::unique_ptr< Instrumentation::ThreadRecord > mRecord;
+};
+
+//! The owner of the record of each thread
+thread_local LocalRecordOwner LocalOwner;
+
+//! Escape a string for inclusion in a JSON document
+//! \param aStr The string to escape
+//! \return The quoted, escaped string
+std::string JsonEscape( const std::string& aStr )
+{
+  std::string lStr( "\"" );
+  for( auto& c : aStr )
+  {
+    if( c == '"' or c == '\\' ) lStr += '\\';
+    if( (unsigned char)( c ) < 0x20 ) lStr += ' ';
+    else                              lStr += c;
+  }
+  return lStr + "\"";
+}
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+uint32_t Instrumentation::Register( const std::string& aName )
+{
+  auto& lRegistry( Registry() );
+  std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+  auto lIt( lRegistry.mIds.find( aName ) );
+  if( lIt != lRegistry.mIds.end() ) return lIt->second;
+  lRegistry.mNames.push_back( aName );
+  return lRegistry.mIds[ aName ] = lRegistry.mNames.size() - 1;
+}
+
+thread_local std::size_t Instrumentation::Worker( 0 );
+
+thread_local Instrumentation::ThreadRecord* Instrumentation::LocalRecord( NULL );
+
+std::atomic< bool > Instrumentation::Tracing( false );
+
+Instrumentation::ThreadRecord& Instrumentation::CreateLocal()
+{
+  auto& lRegistry( Registry() );
+  std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+  if( LocalOwner.mRecord ) Fold( lRegistry , *LocalOwner.mRecord ); // The emptied record is then reused for the new worker
+  else
+  {
+    LocalOwner.mRecord.reset( new ThreadRecord() );
+    lRegistry.mLive.insert( LocalOwner.mRecord.get() );
+  }
+  LocalRecord = LocalOwner.mRecord.get();
+  LocalRecord->mWorker = Worker;
+  return *LocalRecord;
+}
+
+uint64_t Instrumentation::Now()
+{
+  static const auto lOrigin( std::chrono::steady_clock::now() );
+  return std::chrono::duration_cast< std::chrono::nanoseconds >( std::chrono::steady_clock::now() - lOrigin ).count();
+}
+
+void Instrumentation::SetTraceFile( const std::string& aFilename )
+{
+  auto& lRegistry( Registry() );
+  std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+  lRegistry.mTraceFile = aFilename;
+  Tracing = aFilename.size();
+}
+
+void Instrumentation::WriteChromeTrace( const std::string& aFilename )
+{
+  auto& lRegistry( Registry() );
+  std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+
+  auto f = fopen( aFilename.c_str() , "w" );
+  if ( f == NULL ) throw std::runtime_error( "Unable to open " + aFilename + " for writing" );
+
+  std::vector< std::string > lNames( lRegistry.mNames.size() );
+  std::transform( lRegistry.mNames.begin() , lRegistry.mNames.end() , lNames.begin() , JsonEscape );
+
+  const auto lRecords( Records( lRegistry ) );
+
+  // Each worker is shown as a trace-thread, with worker 0 for the threads outside any parallel operator
+  std::set< std::size_t > lWorkers;
+  for( auto& lRecord : lRecords ) lWorkers.insert( lRecord->mWorker );
+
+  const char* lSeparator( "\n" );
+  uint64_t lEnd( 0 );
+  fprintf( f , "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+  for( auto& i : lWorkers )
+  {
+    fprintf( f , "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"Worker %zu\"}}" , lSeparator , i , i );
+    lSeparator = ",\n";
+  }
+
+  for( auto& lRecord : lRecords )
+    for( auto& i : lRecord->mSpans )
+    {
+      fprintf( f , "%s{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f" , lSeparator , lNames[ i.mName ].c_str() , lRecord->mWorker , i.mStart * 1e-3 , i.mDuration * 1e-3 );
+      if( i.mArg >= 0 ) fprintf( f , ",\"args\":{\"arg\":%lld}" , (long long)( i.mArg ) );
+      fprintf( f , "}" );
+      lSeparator = ",\n";
+      lEnd = std::max( lEnd , i.mStart + i.mDuration );
+    }
+
+  // Counters are written as one counter-event each, at the end of the trace, with the total of each worker as a series
+  for( std::size_t lName(0) ; lName!=lNames.size() ; ++lName )
+  {
+    std::map< std::size_t , uint64_t > lValues;
+    for( auto& lRecord : lRecords )
+      if( lName < lRecord->mCounters.size() and lRecord->mCounters[ lName ] ) lValues[ lRecord->mWorker ] += lRecord->mCounters[ lName ];
+
+    std::string lArgs;
+    for( auto& i : lValues ) lArgs += ( lArgs.size() ? ",\"" : "\"" ) + std::to_string( i.first ) + "\":" + std::to_string( i.second );
+    if( lArgs.empty() ) continue;
+    fprintf( f , "%s{\"name\":%s,\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{%s}}" , lSeparator , lNames[ lName ].c_str() , lEnd * 1e-3 , lArgs.c_str() );
+    lSeparator = ",\n";
+  }
+
+  // Histograms have no trace-event equivalent, so are merged over workers and written as metadata, keyed by the lower edge of each bucket
+  fprintf( f , "\n],\"otherData\":{" );
+  lSeparator = "";
+  for( std::size_t lName(0) ; lName!=lNames.size() ; ++lName )
+  {
+    std::array< uint64_t , HistogramBuckets > lSum{};
+    for( auto& lRecord : lRecords )
+      if( lName < lRecord->mHistograms.size() )
+        for( std::size_t i(0) ; i!=HistogramBuckets ; ++i ) lSum[i] += lRecord->mHistograms[ lName ][i];
+
+    std::string lArgs;
+    for( std::size_t i(0) ; i!=HistogramBuckets ; ++i )
+      if( lSum[i] ) lArgs += ( lArgs.size() ? ",\"" : "\"" ) + std::to_string( i ? uint64_t(1) << (i-1) : 0 ) + "\":" + std::to_string( lSum[i] );
+    if( lArgs.empty() ) continue;
+    fprintf( f , "%s%s:{%s}" , lSeparator , lNames[ lName ].c_str() , lArgs.c_str() );
+    lSeparator = ",";
+  }
+  fprintf( f , "}}\n" );
+
+  if( fclose( f ) ) throw std::runtime_error( "Failed writing " + aFilename );
+}
+
+void Instrumentation::WriteSummary( std::ostream& aStream )
+{
+  auto& lRegistry( Registry() );
+  std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+  const std::size_t lNames( lRegistry.mNames.size() );
+  const auto lRecords( Records( lRegistry ) );
+
+  // Spans: the busy-time of each worker is the sum of its spans of that name
+  std::vector< std::size_t > lCalls( lNames , 0 );
+  std::vector< uint64_t > lTotal( lNames , 0 ) , lMax( lNames , 0 );
+  std::vector< std::map< std::size_t , uint64_t > > lPerWorker( lNames );
+  for( auto& lRecord : lRecords )
+    for( auto& i : lRecord->mSpans )
+    {
+      ++lCalls[ i.mName ];
+      lTotal[ i.mName ] += i.mDuration;
+      lMax[ i.mName ] = std::max( lMax[ i.mName ] , i.mDuration );
+      lPerWorker[ i.mName ][ lRecord->mWorker ] += i.mDuration;
+    }
+
+  auto MinMax = []( const std::map< std::size_t , uint64_t >& aValues ){
+    uint64_t lMin( -1 ) , lMax( 0 );
+    for( auto& i : aValues ){ lMin = std::min( lMin , i.second ); lMax = std::max( lMax , i.second ); }
+    return std::make_pair( lMin , lMax );
+  };
+
+  aStream << std::left << std::setw( 40 ) << "span" << std::right << std::setw( 10 ) << "calls" << std::setw( 12 ) << "total [s]" << std::setw( 12 ) << "mean [ms]" << std::setw( 12 ) << "max [ms]"
+          << std::setw( 9 ) << "workers" << std::setw( 14 ) << "min/wkr [s]" << std::setw( 14 ) << "max/wkr [s]" << "\n" << std::fixed;
+  for( std::size_t i(0) ; i!=lNames ; ++i )
+  {
+    if( !lCalls[i] ) continue;
+    auto lSpread( MinMax( lPerWorker[i] ) );
+    aStream << std::left << std::setw( 40 ) << lRegistry.mNames[i].substr( 0 , 39 ) << std::right << std::setw( 10 ) << lCalls[i]
+            << std::setprecision( 3 ) << std::setw( 12 ) << lTotal[i] * 1e-9 << std::setw( 12 ) << lTotal[i] * 1e-6 / lCalls[i] << std::setw( 12 ) << lMax[i] * 1e-6
+            << std::setw( 9 ) << lPerWorker[i].size() << std::setw( 14 ) << lSpread.first * 1e-9 << std::setw( 14 ) << lSpread.second * 1e-9 << "\n";
+  }
+  aStream << std::defaultfloat;
+
+  // Counters
+  bool lHeader( false );
+  for( std::size_t i(0) ; i!=lNames ; ++i )
+  {
+    std::map< std::size_t , uint64_t > lValues;
+    uint64_t lSum( 0 );
+    for( auto& lRecord : lRecords )
+      if( i < lRecord->mCounters.size() and lRecord->mCounters[i] ){ lValues[ lRecord->mWorker ] += lRecord->mCounters[i]; lSum += lRecord->mCounters[i]; }
+    if( lValues.empty() ) continue;
+
+    if( !lHeader ) aStream << std::left << std::setw( 40 ) << "counter" << std::right << std::setw( 20 ) << "total" << std::setw( 9 ) << "workers" << std::setw( 20 ) << "min/wkr" << std::setw( 20 ) << "max/wkr" << "\n";
+    lHeader = true;
+    auto lSpread( MinMax( lValues ) );
+    aStream << std::left << std::setw( 40 ) << lRegistry.mNames[i].substr( 0 , 39 ) << std::right << std::setw( 20 ) << lSum << std::setw( 9 ) << lValues.size() << std::setw( 20 ) << lSpread.first << std::setw( 20 ) << lSpread.second << "\n";
+  }
+
+  // Histograms
+  for( std::size_t i(0) ; i!=lNames ; ++i )
+  {
+    std::array< uint64_t , HistogramBuckets > lSum{};
+    for( auto& lRecord : lRecords )
+      if( i < lRecord->mHistograms.size() )
+        for( std::size_t j(0) ; j!=HistogramBuckets ; ++j ) lSum[j] += lRecord->mHistograms[i][j];
+
+    std::ostringstream lBuckets;
+    for( std::size_t j(0) ; j!=HistogramBuckets ; ++j )
+      if( lSum[j] ) lBuckets << "  [" << ( j ? uint64_t(1) << (j-1) : 0 ) << "]:" << lSum[j];
+    if( lBuckets.str().size() ) aStream << "histogram " << lRegistry.mNames[i] << lBuckets.str() << "\n";
+  }
+}
+
+void Instrumentation::Finalize()
+{
+  std::string lTraceFile;
+  {
+    auto& lRegistry( Registry() );
+    std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+    lTraceFile = lRegistry.mTraceFile;
+  }
+  if( lTraceFile.empty() ) return;
+
+  WriteChromeTrace( lTraceFile );
+  std::cout << "+------------------------------------+" << std::endl;
+  WriteSummary( std::cout );
+  std::cout << "Trace written to " << lTraceFile << std::endl;
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
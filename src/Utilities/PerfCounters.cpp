@@ -0,0 +1,312 @@
+
+/* ===== Local utilities ===== */
+#include "Utilities/PerfCounters.hpp"
+#include "Utilities/Instrumentation.hpp"
+
+// /* ===== C++ ===== */
+#include <map>
+#include <set>
+#include <array>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <cstring>
+#include <cerrno>
+#include <iomanip>
+#include <algorithm>
+
+/* ===== Linux ===== */
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+const char* const PerfCounters::StageNames[ StageCount ] = { "Load" , "Preprocess" , "LocalizationScores" , "Clusterize" , "Score" };
+const char* const PerfCounters::CounterNames[ CounterCount ] = { "TaskClock" , "Cycles" , "Instructions" , "LLCMisses" , "DTLBMisses" , "BranchMisses" };
+bool PerfCounters::IsEnabled( false );
+thread_local int PerfCounters::CurrentStage( -1 );
+
+//! The perf_event type and config of each counter
+static const std::array< std::pair< uint32_t , uint64_t > , PerfCounters::CounterCount > CounterConfigs{ {
+  { PERF_TYPE_SOFTWARE , PERF_COUNT_SW_TASK_CLOCK } ,
+  { PERF_TYPE_HARDWARE , PERF_COUNT_HW_CPU_CYCLES } ,
+  { PERF_TYPE_HARDWARE , PERF_COUNT_HW_INSTRUCTIONS } ,
+  { PERF_TYPE_HW_CACHE , PERF_COUNT_HW_CACHE_LL   | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) } ,
+  { PERF_TYPE_HW_CACHE , PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) } ,
+  { PERF_TYPE_HARDWARE , PERF_COUNT_HW_BRANCH_MISSES }
+} };
+
+//! The counts of one thread for one worker
+struct PerfThreadCounts
+{
+  //! The worker for which the thread is counting, as per Instrumentation::Worker
+  std::size_t mWorker = 0;
+  //! The counts, per stage and counter
+  std::array< std::array< uint64_t , PerfCounters::CounterCount > , PerfCounters::StageCount > mCounts{};
+  //! Whether the thread counted anything in each stage
+  std::array< bool , PerfCounters::StageCount > mActive{};
+};
+
+//! The shared state of the profiling, which is only touched when a thread first counts, and when reporting
+struct PerfCountersRegistry
+{
+  //! Guards everything below
+  std::mutex mMutex;
+  //! Whether each counter could be opened
+  std::array< bool , PerfCounters::CounterCount > mAvailable{};
+  //! The counts of the live threads, each owned by its thread
+  std::set< PerfThreadCounts* > mLive;
+  //! The counts of threads which have exited or moved on to another worker, summed per worker
+  std::map< std::size_t , PerfThreadCounts > mFolded;
+};
+
+//! Get the shared state, constructing it on first use
+//! \return The shared state
+PerfCountersRegistry& PerfRegistry()
+{
+  static PerfCountersRegistry lRegistry;
+  return lRegistry;
+}
+
+//! Fold the counts of a thread into the totals of its worker - the caller must hold the lock
+//! \param aRegistry The shared state
+//! \param aCounts   The counts to fold, which are left zeroed
+void Fold( PerfCountersRegistry& aRegistry , PerfThreadCounts& aCounts )
+{
+  auto& lTotal( aRegistry.mFolded[ aCounts.mWorker ] );
+  lTotal.mWorker = aCounts.mWorker;
+  for( int s(0) ; s!=PerfCounters::StageCount ; ++s )
+  {
+    for( int c(0) ; c!=PerfCounters::CounterCount ; ++c ) lTotal.mCounts[s][c] += aCounts.mCounts[s][c];
+    lTotal.mActive[s] = lTotal.mActive[s] or aCounts.mActive[s];
+  }
+  aCounts.mCounts = {};
+  aCounts.mActive = {};
+}
+
+//! Open a counter for the calling thread, counting user-space only
+//! \param aCounter The counter
+//! \return The file descriptor, or -1 on failure
+int OpenCounter( const int& aCounter )
+{
+  perf_event_attr lAttr;
+  memset( &lAttr , 0 , sizeof( lAttr ) );
+  lAttr.size = sizeof( lAttr );
+  lAttr.type = CounterConfigs[ aCounter ].first;
+  lAttr.config = CounterConfigs[ aCounter ].second;
+  lAttr.exclude_kernel = 1;
+  lAttr.exclude_hv = 1;
+  lAttr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING; // To scale counts when the PMU is multiplexed
+  return syscall( SYS_perf_event_open , &lAttr , 0 , -1 , -1 , 0 );
+}
+
+//! The counters of one thread and the stack of stages open on it
+struct PerfCountersThread
+{
+  //! Constructor - opens the available counters and registers the counts
+  PerfCountersThread()
+  {
+    auto& lRegistry( PerfRegistry() );
+    for( int i(0) ; i!=PerfCounters::CounterCount ; ++i ) mFds[i] = lRegistry.mAvailable[i] ? OpenCounter( i ) : -1;
+    mCounts.mWorker = Instrumentation::Worker;
+
+    std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+    lRegistry.mLive.insert( &mCounts );
+  }
+
+  //! Destructor - closes the counters, and folds the counts into the totals of the worker
+  ~PerfCountersThread()
+  {
+    for( auto& i : mFds ) if( i >= 0 ) close( i );
+
+    auto& lRegistry( PerfRegistry() );
+    std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+    Fold( lRegistry , mCounts );
+    lRegistry.mLive.erase( &mCounts );
+  }
+
+  //! If the thread has moved on to another worker, fold the counts so far into the totals of the previous worker - called only with no stage open
+  void SetWorker()
+  {
+    if( mCounts.mWorker == Instrumentation::Worker ) return;
+    auto& lRegistry( PerfRegistry() );
+    std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+    Fold( lRegistry , mCounts );
+    mCounts.mWorker = Instrumentation::Worker;
+  }
+
+  //! Read the counters and attribute the counts since the last read to a stage
+  //! \param aStage The stage, or -1 to discard the counts
+  void Attribute( const int& aStage )
+  {
+    for( int i(0) ; i!=PerfCounters::CounterCount ; ++i )
+    {
+      if( mFds[i] < 0 ) continue;
+      uint64_t lValues[3]; // value, time enabled, time running
+      if( read( mFds[i] , lValues , sizeof( lValues ) ) != sizeof( lValues ) or !lValues[2] ) continue;
+      const uint64_t lScaled( lValues[2] == lValues[1] ? lValues[0] : uint64_t( double( lValues[0] ) * lValues[1] / lValues[2] ) );
+      if( aStage >= 0 and lScaled > mLast[i] ) mCounts.mCounts[ aStage ][ i ] += lScaled - mLast[i];
+      mLast[i] = lScaled;
+    }
+  }
+
+  //! The file descriptors of the counters, or -1 for those unavailable
+  std::array< int , PerfCounters::CounterCount > mFds;
+  //! The scaled counts at the last read
+  std::array< uint64_t , PerfCounters::CounterCount > mLast{};
+  //! The stages open on this thread, innermost last
+  std::vector< int > mStack;
+  //! The counts of this thread for its current worker
+  PerfThreadCounts mCounts;
+};
+
+//! Get the counters of the calling thread, opening them on first use
+//! \return The counters of the calling thread
+PerfCountersThread& PerfLocal()
+{
+  thread_local std::unique_ptr< PerfCountersThread > lThread;
+  if( !lThread )
+  {
+    lThread.reset( new PerfCountersThread() );
+    lThread->Attribute( -1 );
+  }
+  return *lThread;
+}
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+void PerfCounters::Enable()
+{
+  auto& lRegistry( PerfRegistry() );
+  bool lAny( false );
+  for( int i(0) ; i!=CounterCount ; ++i )
+  {
+    const int lFd( OpenCounter( i ) );
+    lRegistry.mAvailable[i] = ( lFd >= 0 );
+    if( lFd >= 0 ){ close( lFd ); lAny = true; continue; }
+    std::cout << "Warning: performance counter " << CounterNames[i] << " is unavailable (" << strerror( errno ) << ")" << std::endl;
+  }
+  if( !lAny ) std::cout << "Warning: no performance counters are available - check /proc/sys/kernel/perf_event_paranoid" << std::endl;
+  IsEnabled = lAny;
+}
+
+void PerfCounters::Begin( const int& aStage )
+{
+  auto& lThread( PerfLocal() );
+  lThread.Attribute( lThread.mStack.empty() ? -1 : lThread.mStack.back() );
+  if( lThread.mStack.empty() ) lThread.SetWorker(); // A thread-pool task opens its stage first thing, after setting the worker
+  lThread.mStack.push_back( aStage );
+  lThread.mCounts.mActive[ aStage ] = true;
+}
+
+void PerfCounters::End()
+{
+  auto& lThread( PerfLocal() );
+  lThread.Attribute( lThread.mStack.back() );
+  lThread.mStack.pop_back();
+}
+
+//! The totals of one stage over workers
+struct PerfStageTotals
+{
+  //! The sum over workers of each counter
+  std::array< uint64_t , PerfCounters::CounterCount > mSum{};
+  //! The number of workers which counted in the stage
+  std::size_t mWorkers = 0;
+  //! The smallest count of the spread counter by any pool worker (or by worker 0, if the stage ran only there)
+  uint64_t mMin = std::numeric_limits< uint64_t >::max();
+  //! The largest count of the spread counter by any pool worker (or by worker 0, if the stage ran only there)
+  uint64_t mMax = 0;
+};
+
+//! Sum the counts of each stage over workers
+//! \param aSpread The counter whose spread over workers is recorded
+//! \return The totals of each stage
+std::array< PerfStageTotals , PerfCounters::StageCount > PerfTotals( const int& aSpread )
+{
+  auto& lRegistry( PerfRegistry() );
+  std::lock_guard< std::mutex > lLock( lRegistry.mMutex );
+
+  // The folded counts are already per worker, but the live threads may add to them
+  std::map< std::size_t , PerfThreadCounts > lWorkers( lRegistry.mFolded );
+  for( auto& lThread : lRegistry.mLive )
+  {
+    auto& lWorker( lWorkers[ lThread->mWorker ] );
+    for( int s(0) ; s!=PerfCounters::StageCount ; ++s )
+    {
+      for( int c(0) ; c!=PerfCounters::CounterCount ; ++c ) lWorker.mCounts[s][c] += lThread->mCounts[s][c];
+      lWorker.mActive[s] = lWorker.mActive[s] or lThread->mActive[s];
+    }
+  }
+
+  std::array< PerfStageTotals , PerfCounters::StageCount > lTotals;
+  std::array< bool , PerfCounters::StageCount > lPool{};
+  for( auto& lWorker : lWorkers ) // In order of worker, so worker 0 - the threads outside the parallel operators - comes first
+    for( int s(0) ; s!=PerfCounters::StageCount ; ++s )
+    {
+      if( !lWorker.second.mActive[s] ) continue;
+      auto& lTotal( lTotals[s] );
+      auto& lCounts( lWorker.second.mCounts[s] );
+      for( int c(0) ; c!=PerfCounters::CounterCount ; ++c ) lTotal.mSum[c] += lCounts[c];
+      ++lTotal.mWorkers;
+
+      // Worker 0 only runs the serial part of a parallel stage, so the spread is over the pool workers if there are any
+      if( lWorker.first and !lPool[s] ){ lPool[s] = true; lTotal.mMin = std::numeric_limits< uint64_t >::max(); lTotal.mMax = 0; }
+      lTotal.mMin = std::min( lTotal.mMin , lCounts[ aSpread ] );
+      lTotal.mMax = std::max( lTotal.mMax , lCounts[ aSpread ] );
+    }
+  return lTotals;
+}
+
+void PerfCounters::WriteSummary( std::ostream& aStream )
+{
+  auto& lAvailable( PerfRegistry().mAvailable );
+  const int lSpread( lAvailable[ Cycles ] ? Cycles : TaskClock ); // Task-clock stands in for the cycles where the PMU is not exposed, e.g. in a VM
+  auto lTotals( PerfTotals( lSpread ) );
+
+  auto Value = [&]( const PerfStageTotals& aTotal , const int& aCounter ) -> std::string {
+    if( !lAvailable[ aCounter ] ) return "n/a";
+    if( aCounter == TaskClock ){ std::ostringstream lStr; lStr << std::fixed << std::setprecision( 3 ) << aTotal.mSum[ aCounter ] * 1e-9; return lStr.str(); }
+    return std::to_string( aTotal.mSum[ aCounter ] );
+  };
+
+  aStream << std::left << std::setw( 20 ) << "stage" << std::right << std::setw( 9 ) << "workers" << std::setw( 12 ) << "cpu [s]" << std::setw( 16 ) << "cycles" << std::setw( 16 ) << "instructions"
+          << std::setw( 7 ) << "IPC" << std::setw( 14 ) << "LLC misses" << std::setw( 14 ) << "dTLB misses" << std::setw( 14 ) << "br misses" << std::setw( 12 ) << "max/min wkr" << "\n";
+  for( int s(0) ; s!=StageCount ; ++s )
+  {
+    auto& lTotal( lTotals[s] );
+    if( !lTotal.mWorkers ) continue;
+    std::ostringstream lIPC , lImbalance;
+    if( lAvailable[ Cycles ] and lAvailable[ Instructions ] and lTotal.mSum[ Cycles ] ) lIPC << std::fixed << std::setprecision( 2 ) << double( lTotal.mSum[ Instructions ] ) / lTotal.mSum[ Cycles ];
+    else                                                                                 lIPC << "n/a";
+    if( lTotal.mMin ) lImbalance << std::fixed << std::setprecision( 2 ) << double( lTotal.mMax ) / lTotal.mMin;
+    else              lImbalance << "n/a";
+
+    aStream << std::left << std::setw( 20 ) << StageNames[s] << std::right << std::setw( 9 ) << lTotal.mWorkers << std::setw( 12 ) << Value( lTotal , TaskClock ) << std::setw( 16 ) << Value( lTotal , Cycles )
+            << std::setw( 16 ) << Value( lTotal , Instructions ) << std::setw( 7 ) << lIPC.str() << std::setw( 14 ) << Value( lTotal , LLCMisses ) << std::setw( 14 ) << Value( lTotal , DTLBMisses )
+            << std::setw( 14 ) << Value( lTotal , BranchMisses ) << std::setw( 12 ) << lImbalance.str() << "\n";
+  }
+}
+
+void PerfCounters::WriteRecords( std::ostream& aStream )
+{
+  auto& lAvailable( PerfRegistry().mAvailable );
+  auto lTotals( PerfTotals( Cycles ) );
+  for( int s(0) ; s!=StageCount ; ++s )
+  {
+    if( !lTotals[s].mWorkers ) continue;
+    aStream << "  { Stage:" << StageNames[s] << ", Workers:" << lTotals[s].mWorkers;
+    for( int c(0) ; c!=CounterCount ; ++c ) if( lAvailable[c] ) aStream << ", " << CounterNames[c] << ":" << lTotals[s].mSum[c];
+    aStream << "}\n";
+  }
+}
+
+void PerfCounters::Finalize()
+{
+  if( !IsEnabled ) return;
+  std::cout << "+------------------------------------+" << std::endl;
+  WriteSummary( std::cout );
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,52 @@
+
+/* ===== Local utilities ===== */
+#include "Utilities/ProcessMemory.hpp"
+
+// /* ===== C++ ===== */
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+/* ===== Linux ===== */
+#include <sys/resource.h>
+
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+//! Read a field, given in kB, from /proc/self/status
+//! \param aField The name of the field, including the trailing colon
+//! \return The value in bytes, or 0 if the field cannot be read
+std::size_t ProcStatus( const std::string& aField )
+{
+  std::ifstream lFile( "/proc/self/status" );
+  for( std::string lLine ; std::getline( lFile , lLine ) ; )
+  {
+    if( lLine.compare( 0 , aField.size() , aField ) ) continue;
+    std::istringstream lStr( lLine.substr( aField.size() ) );
+    std::size_t lKilobytes( 0 );
+    lStr >> lKilobytes;
+    return lKilobytes * 1024;
+  }
+  return 0;
+}
+
+std::size_t ResidentMemory()
+{
+  return ProcStatus( "VmRSS:" );
+}
+
+std::size_t PeakResidentMemory()
+{
+  const std::size_t lPeak( ProcStatus( "VmHWM:" ) );
+  if( lPeak ) return lPeak;
+
+  rusage lUsage; // Fall back to the maximum resident-set size, which is reported in kB on Linux
+  if( getrusage( RUSAGE_SELF , &lUsage ) ) return 0;
+  return std::size_t( lUsage.ru_maxrss ) * 1024;
+}
+
+std::string FormatMegabytes( const std::size_t& aBytes )
+{
+  std::ostringstream lStr;
+  lStr << std::fixed << std::setprecision( 1 ) << aBytes / ( 1024.0 * 1024.0 ) << " MB";
+  return lStr.str();
+}
+// -------------------------------------------------------------------------------------------------------------------------------------------------------------------------------
@@ -30,7 +30,8 @@ void ProgressBar::operator++ ( int ) { operator++ (); }
 
 
 ProgressBar2::ProgressBar2( const std::string& aLabel , const uint32_t& aMax ) : 
-mStart( std::chrono::high_resolution_clock::now() )
+mStart( std::chrono::high_resolution_clock::now() ) ,
+mTimer( Instrumentation::Enabled() ? new Instrumentation::ScopedTimer( Instrumentation::Register( aLabel ) ) : NULL )
 {
   std::cout << aLabel << std::endl;  
 }
@@ -3,3 +3,4 @@
 #include <thread>
 
 std::size_t Nthreads( std::thread::hardware_concurrency() );
+thread_local std::size_t LocalThreads( 0 );